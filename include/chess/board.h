@@ -11,6 +11,14 @@
 typedef enum
 {
   ConsiderChecks = 1 << 0,
+
+  // Stages, with none of them every move is generated
+  GetMovesCaptures = 1 << 1,    // And promotions, en passant too
+  GetMovesQuiets = 1 << 2,      // Everything else, castling included
+  GetMovesEvasions = 1 << 3,    // Only moves that might get out of check
+  GetMovesQuietChecks = 1 << 4, // Quiet moves that give check
+  GetMovesStages = GetMovesCaptures | GetMovesQuiets | GetMovesEvasions |
+                   GetMovesQuietChecks,
 } GetMovesFlags;
 
 typedef enum
@@ -27,18 +35,23 @@ typedef enum
   CheckInfoStalemate,
 } CheckInfo;
 
-void board_new(Board* board, char* fen);
+bool board_new(Board* board, char* fen);
 void board_new_from_string(Board* board, char* board_str);
 void board_update(Board* board, Move* move);
 bool board_can_move(ChessPiece piece, Board board, int pos88);
 Array board_get_moves(Board _board, int pos, GetMovesFlags flags);
 Array board_get_moves_all(Board board, GetMovesAllFlags flags);
+Array board_get_moves_stage(Board board, bool isWhite, GetMovesFlags stages);
+// Checks one move for the side to move without generating any move lists
+bool board_is_legal(Board* board, Move move);
 
 char* board_tostring(Board board);
 Move* board_calculate_line(Board board, int depth, bool maximising_player);
 
+bool board_has_legal_move(Board board, bool isWhite);
 CheckInfo get_check_info(Board board, bool isWhite);
 
 bool is_in_check(Board board, bool isWhite);
 bool is_in_checkmate(Board board, bool isWhite);
 bool is_in_stalemate(Board board, bool isWhite);
+bool can_take_en_passant(Board board);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "defs.h"
+
+#include <stddef.h>
+
+// Opening books in the Polyglot .bin layout: 16 byte big endian entries of
+// key, move, weight and learn data, sorted by key.
+//
+// @@FIXME Keys follow Polyglot's layout but use our own random numbers since
+// we don't have a copy of the official Random64 table to hand. Until it's
+// dropped into book_random in book.c only books made with book_build will
+// match. With it the start position's key is 0x463b96181691fc9c and after
+// e2e4 it's 0x823c9b50fd114196, which test_book_key should then check.
+
+typedef struct
+{
+  u64 key;
+  u16 move;
+  u16 weight;
+  u32 learn;
+} BookEntry;
+
+typedef struct
+{
+  char* data; // The mapped file
+  size_t size;
+  size_t nentries;
+
+  int max_ply;  // Stop using the book after this many plies
+  int variety;  // 0 always plays the most popular move, up to 100 picks
+                // from every move in proportion to its weight
+} Book;
+
+enum
+{
+  BookDefaultMaxPly = 16,
+  BookDefaultVariety = 50,
+};
+
+int book_open(Book* book, char* path);
+void book_close(Book* book);
+u64 book_key(Board board);
+Move book_probe(Book* book, Board board);
+int book_build(char* lines_path, char* book_path, int max_ply);
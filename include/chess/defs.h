@@ -12,6 +12,14 @@
 
 extern int depth;
 
+// For code written once and instantiated for each colour with the colour as a
+// constant, see board_update_colour
+#ifdef _MSC_VER
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -47,14 +55,50 @@ typedef enum
   MessageTypeIsInStalemateReply,
   MessageTypeCheckInfoRequest,
   MessageTypeCheckInfoReply,
+  // Batched versions of the above to save on round trips
+  MessageTypeGetAllMovesRequest,
+  MessageTypeGetAllMovesReply,
+  MessageTypeCheckInfoBothRequest,
+  MessageTypeCheckInfoBothReply,
+  MessageTypeEvaluateRequest,
+  MessageTypeEvaluateReply,
+  MessageTypeSearchStatsRequest,
+  MessageTypeSearchStatsReply,
+  MessageTypeProfileReportRequest,
+  MessageTypeProfileReportReply,
+  MessageTypeResultCacheStatsRequest,
+  MessageTypeResultCacheStatsReply,
+  MessageTypeSchedulerStatsRequest,
+  MessageTypeSchedulerStatsReply,
+  MessageTypeStopSearchRequest,
+  MessageTypeStopSearchReply,
+  // Not a reply, sent after each iteration of a search with the guid of the
+  // BestMoveRequest it's for
+  MessageTypeSearchInfo,
   // We need to use this to pad out the enum to make sure it's always
   // sizeof(int)
   __MessageTypeSizeMarker = 1 << (sizeof(int) - 1),
 } MessageType;
 
-// We don't want the compiler to pad this struct since this would mess up some
+// An EvaluateReply has a value for each FEN in the request in the same order,
+// skipping empty ones. FENs we can't read get this instead.
+enum
+{
+  EvaluateInvalidFen = INT32_MIN,
+};
+
+// This is what goes over the wire in front of each message's data. We don't
+// want the compiler to pad this struct since this would mess up some
 // reads/writes
 #pragma pack(push, 1)
+typedef struct
+{
+  u32 len; // Size of data in bytes
+  s32 type;
+  byte guid[16];
+} MessageHeader;
+#pragma pack(pop)
+
 typedef struct
 {
   u32 len; // Size of data in bytes
@@ -62,6 +106,28 @@ typedef struct
   byte guid[16];
   byte* data;
 } Message;
+
+// How a move goes over the wire. This is the layout Move had before it was
+// packed, so clients didn't need to change. The null move is 255 to 255.
+#pragma pack(push, 1)
+typedef struct
+{
+  u8 from;
+  u8 to;
+  u8 padding[2];
+  s32 promotion; // ChessPiece
+} WireMove;
+
+// How a SearchInfo goes over the wire, followed by pv_len WireMoves
+typedef struct
+{
+  u32 depth;
+  s32 value; // From white's point of view
+  u64 nodes;
+  u64 nps;
+  u64 time_ms;
+  u32 pv_len;
+} WireSearchInfo;
 #pragma pack(pop)
 
 typedef enum
@@ -76,17 +142,24 @@ typedef enum
   ChessPieceIsWhite = 1 << 6
 } ChessPiece;
 
-typedef struct
+// Packed into 16 bits so move lists stay small and moves compare as plain
+// integers. The promotion piece is shifted down a bit to fit, so go through
+// move_promotion and move_set_promotion rather than promo. Over IPC moves are
+// sent as WireMove.
+typedef union
 {
-  u8 from;
-  u8 to;
-
-  ChessPiece promotion;
+  struct
+  {
+    u16 from : 6;
+    u16 to : 6;
+    u16 promo : 4;
+  };
+  u16 bits;
 } Move;
 
 typedef struct
 {
-  ChessPiece state[64];
+  u8 state[64]; // ChessPiece for each square, a byte each to keep Board small
   bool white_to_move;
   int en_passant_tile; // Set to -1 if en passant not possible
 
@@ -113,10 +186,13 @@ struct Node
   bool isWhite; // Is it white's turn after this move
 };
 
+typedef struct SearchContext SearchContext;
+
 typedef struct Tree Tree;
 struct Tree
 {
   Node* root;
   Board board;
   size_t depth;
+  SearchContext* context; // Search state shared between searches, may be NULL
 };
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "defs.h"
+#include "ringbuffer.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Linux only. Rather than going through libipc we listen on the unix sockets
+// that back the .NET pipes ourselves, which lets one thread wait on every
+// client with epoll instead of polling each socket.
+
+typedef struct
+{
+  u64 start;
+  u64 end;
+} RingSpan;
+
+typedef struct EventLoop EventLoop;
+
+typedef struct Connection Connection;
+struct Connection
+{
+  EventLoop* loop;
+  int fd_in;  // Requests, only read by the event loop
+  int fd_out; // Replies, written by whoever handles the request
+
+  // Requests are received into the ring and handed out pointing into it, so
+  // each message must be given back with connection_release once handled.
+  // The ring can only move past a message once everything before it has been
+  // released, so messages released early are kept in released until then.
+  RingBuffer* ring;
+  u64 parsed;         // Bytes of the ring that have been handed out
+  atomic_bool paused; // Stopped reading because the ring is full
+  RingSpan* released;
+  size_t nreleased;
+  size_t released_cap;
+  pthread_mutex_t release_lock;
+  int epoll_fd;
+
+  void* userdata;
+  Connection* next; // Used while waiting for the other half of the pair
+};
+
+typedef struct
+{
+  void (*on_connect)(Connection* conn);
+  void (*on_message)(Connection* conn, Message mess);
+  // The connection can still be written to until connection_free is called
+  void (*on_close)(Connection* conn);
+} EventLoopCallbacks;
+
+struct EventLoop
+{
+  int epoll_fd;
+  int listen_in;
+  int listen_out;
+  // Clients connect to the requests and replies sockets separately so we
+  // keep each half here until the other one turns up.
+  Connection* pending_in;
+  Connection* pending_out;
+  EventLoopCallbacks callbacks;
+  void* userdata;
+};
+
+int eventloop_new(EventLoop* loop, char* requests_path, char* replies_path,
+                  EventLoopCallbacks callbacks);
+void eventloop_free(EventLoop* loop);
+void eventloop_run(EventLoop* loop);
+int eventloop_run_once(EventLoop* loop, int timeout_ms);
+
+// Not safe to call from several threads at once for the same connection
+int connection_send(Connection* conn, Message mess);
+void connection_release(Connection* conn, Message mess);
+void connection_free(Connection* conn);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "defs.h"
+
+u64 board_hash(Board board);
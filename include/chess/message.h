@@ -1,9 +1,18 @@
 #pragma once
 
 #include "defs.h"
+#include "search.h"
 
 #include <ipc/socket.h>
 
+MessageHeader message_header(Message mess);
+Message message_from_header(MessageHeader header, byte* data);
 ipcError message_receive(Message* mess, Socket* sock);
 ipcError message_send(Message mess, Socket* sock);
+void message_log(Message mess);
 char* messagetype_tostring(MessageType type);
+
+WireMove message_move_to_wire(Move move);
+Move message_move_from_wire(byte* data);
+void message_board_state_to_wire(Board board, byte* data);
+u32 message_search_info_to_wire(SearchInfo* info, byte* data);
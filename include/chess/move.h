@@ -6,5 +6,10 @@
 // New move from 0x88 positions
 Move move_new(int from, int to);
 char* move_tostring(Move move);
+char* move_to_uci(Move move);
+Move move_from_uci(char* str);
 bool move_equals(Move move, Move other);
+bool move_is_null(Move move);
+ChessPiece move_promotion(Move move);
+void move_set_promotion(Move* move, ChessPiece piece);
 Move move_get_random(Board board, int flags);
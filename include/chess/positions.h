@@ -0,0 +1,6 @@
+#pragma once
+
+// The positions searched by ChessEngineBench and timed by
+// ChessEngineMicroBench. Changing them changes the bench signature.
+extern char* bench_positions[];
+extern const int bench_npositions;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "defs.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Timers for the hot paths, compiled in with -DCHESS_PROFILE=ON. Without it
+// PROFILE_ZONE expands to nothing so there's no cost at all.
+//
+// Each thread keeps its own call counts and times so timing a zone doesn't
+// need any locking. Set CHESS_PROFILE_OUT to have a report written at exit, a
+// .json name gives a Chrome trace (chrome://tracing, Perfetto) rather than a
+// table.
+
+typedef enum
+{
+  ProfileZoneBoardGetMoves,
+  ProfileZonePositionOfChecker,
+  ProfileZoneBoardUpdate,
+  ProfileZoneEvaluateBoard,
+  ProfileZoneNodeNew,
+  ProfileZoneCount,
+} ProfileZone;
+
+typedef enum
+{
+  ProfileFormatText,
+  ProfileFormatChrome,
+} ProfileFormat;
+
+typedef struct
+{
+  ProfileZone zone;
+  u64 start;
+} ProfileScope;
+
+#ifdef CHESS_PROFILE
+// Times the rest of the enclosing block
+#define PROFILE_ZONE(zone)                                                     \
+  __attribute__((cleanup(profile_scope_end))) ProfileScope PROFILE_NAME(       \
+      profile_scope_, __LINE__) = profile_scope_begin(zone)
+#define PROFILE_NAME(a, b) PROFILE_NAME_(a, b)
+#define PROFILE_NAME_(a, b) a##b
+#else
+#define PROFILE_ZONE(zone)
+#endif
+
+ProfileScope profile_scope_begin(ProfileZone zone);
+void profile_scope_end(ProfileScope* scope);
+
+void profile_set_trace(bool enabled);
+void profile_report(FILE* out, ProfileFormat format);
+char* profile_report_string(ProfileFormat format);
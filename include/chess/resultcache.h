@@ -0,0 +1,89 @@
+#pragma once
+
+#include "defs.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Results of whole searches, shared between every game on the server so a
+// position one game has already searched is answered straight away in the
+// next. Results are looked up by position and the depth the search was asked
+// for. Once the cache is full the result used longest ago makes way.
+//
+// The file it's saved to is a ResultCacheHeader followed by the entries,
+// least recently used first, so loading them in order keeps the same order.
+
+enum
+{
+  ResultCacheDefaultMb = 4,
+  ResultCacheSaveEvery = 16, // New results between saves
+};
+
+#pragma pack(push, 1)
+typedef struct
+{
+  u64 key;   // board_hash, which has the side to move, castling and en passant
+  u32 depth; // Asked for
+  u32 depth_reached;
+  s32 value; // From white's point of view
+  Move move;
+  u8 pad[2];
+} ResultEntry;
+
+// On disk, followed by the entries
+typedef struct
+{
+  char magic[4];
+  u8 pad[4];
+  u64 nentries;
+} ResultCacheHeader;
+
+// This goes over the wire as it is in ResultCacheStatsReply
+typedef struct
+{
+  u64 probes;
+  u64 hits;
+  u64 stores;
+  u64 evictions;
+  u64 entries;
+  u64 capacity;
+  u64 bytes; // Memory taken by the table
+} ResultCacheStats;
+#pragma pack(pop)
+
+typedef struct ResultCacheNode ResultCacheNode;
+struct ResultCacheNode
+{
+  ResultEntry entry;
+  ResultCacheNode* chain; // Next in the same bucket, or the next unused node
+  ResultCacheNode* newer;
+  ResultCacheNode* older;
+};
+
+typedef struct
+{
+  ResultCacheNode* nodes; // All allocated up front
+  ResultCacheNode** buckets;
+  size_t nbuckets; // Always a power of 2
+  ResultCacheNode* newest;
+  ResultCacheNode* oldest;
+  ResultCacheNode* unused;
+
+  char* path; // Saved to every ResultCacheSaveEvery stores, may be NULL
+  int unsaved;
+
+  ResultCacheStats stats;
+  pthread_mutex_t lock;
+  pthread_mutex_t save_lock; // Taken before lock, held while writing the file
+} ResultCache;
+
+void result_cache_new(ResultCache* cache, size_t size_mb);
+void result_cache_free(ResultCache* cache);
+int result_cache_load(ResultCache* cache, char* path);
+int result_cache_save(ResultCache* cache);
+bool result_cache_probe(ResultCache* cache, Board board, int depth,
+                        ResultEntry* entry);
+void result_cache_store(ResultCache* cache, Board board, int depth, Move move,
+                        int value, int depth_reached);
+ResultCacheStats result_cache_stats(ResultCache* cache);
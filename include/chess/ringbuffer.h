@@ -0,0 +1,31 @@
+#pragma once
+
+#include "defs.h"
+
+#include <stdatomic.h>
+
+// Linux only. The buffer's pages are mapped twice back to back, so any span of
+// up to size bytes starting anywhere in the buffer can be read as one
+// contiguous block. That lets messages be parsed where they were received
+// even when they wrap around the end.
+typedef struct RingBuffer RingBuffer;
+struct RingBuffer
+{
+  byte* base;
+  size_t size;
+
+  u64 head;             // Total bytes written
+  atomic_uint_fast64_t tail; // Total bytes released by the reader
+
+  RingBuffer* next; // Next free buffer in the pool
+};
+
+enum
+{
+  RingBufferSize = 256 * 1024,
+};
+
+RingBuffer* ringbuffer_acquire();
+void ringbuffer_return(RingBuffer* ring);
+byte* ringbuffer_at(RingBuffer* ring, u64 pos);
+size_t ringbuffer_free_space(RingBuffer* ring);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "defs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Runs the server's requests on a fixed set of workers. Each worker has its
+// own queue for each priority. It takes the oldest task from its own queue so
+// requests run in about the order they came in, and once that's empty steals
+// the newest from someone else's rather than waiting. Owners and thieves work
+// at opposite ends so they rarely want the same task.
+//
+// Interactive requests are always taken before searches. Searches are only
+// run by the first nsearch workers, so the rest are always free for
+// interactive requests however many searches are waiting.
+
+typedef enum
+{
+  SchedulerPriorityInteractive,
+  SchedulerPrioritySearch,
+  SchedulerPriorityCount,
+} SchedulerPriority;
+
+enum
+{
+  SchedulerDefaultWorkers = 4,
+  SchedulerMaxWorkers = 64,
+};
+
+typedef struct
+{
+  void* (*fn)(void* arg);
+  void* arg;
+  u64 queued_ns;
+} SchedulerTask;
+
+// A worker's queue for one priority, a ring that grows as needed
+typedef struct
+{
+  SchedulerTask* tasks;
+  u32 capacity; // Always a power of 2
+  u32 head;     // Oldest task
+  u32 count;
+} SchedulerDeque;
+
+// For one priority. This goes over the wire as it is in SchedulerStatsReply.
+#pragma pack(push, 1)
+typedef struct
+{
+  u64 queued;     // Waiting right now
+  u64 max_queued; // Most ever waiting at once
+  u64 completed;
+  u64 stolen; // Run by a worker other than the one it was queued on
+  u64 total_wait_ns;
+  u64 max_wait_ns;
+} SchedulerStats;
+#pragma pack(pop)
+
+typedef struct Scheduler Scheduler;
+
+typedef struct
+{
+  Scheduler* scheduler;
+  int index;
+  pthread_t thread;
+  pthread_mutex_t lock; // Guards queues
+  SchedulerDeque queues[SchedulerPriorityCount];
+} SchedulerWorker;
+
+struct Scheduler
+{
+  SchedulerWorker workers[SchedulerMaxWorkers];
+  int nworkers;
+  int nsearch; // Workers that take searches
+
+  // Idle workers sleep on wake until there's something they can run
+  int pending[SchedulerPriorityCount];
+  bool stopping;
+  pthread_mutex_t lock; // Guards pending, stopping and stats
+  pthread_cond_t wake;
+  atomic_uint next_worker; // For spreading out tasks queued from outside
+
+  SchedulerStats stats[SchedulerPriorityCount];
+};
+
+void scheduler_new(Scheduler* scheduler, int nworkers, int nsearch);
+void scheduler_free(Scheduler* scheduler);
+void scheduler_queue(Scheduler* scheduler, SchedulerPriority priority,
+                     void* (*fn)(void* arg), void* arg);
+void scheduler_get_stats(Scheduler* scheduler,
+                         SchedulerStats stats[SchedulerPriorityCount]);
@@ -1,7 +1,110 @@
 #pragma once
 
 #include "defs.h"
+#include "tablebase.h"
+#include "transtable.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 
+enum
+{
+  SearchMaxPly = 64,
+  SearchDefaultHashMb = 16,
+  // Nodes this close to the root are kept after the final iteration so that
+  // the tree can be reused after the next couple of moves.
+  SearchKeepPly = 3,
+  // Played positions kept for spotting repetitions. Only those since the last
+  // capture or pawn move matter so we never need more than 100.
+  SearchMaxGamePly = 128,
+  SearchFiftyMovePly = 100,
+  // Being mated scores minus this, less the plies from the root to the mate
+  SearchMateScore = INT_MAX,
+};
+
+// Limits for a single search. Zero means no limit.
+typedef struct
+{
+  u64 nodes;
+  u64 time_ms;
+  bool infinite; // Keep deepening until stopped
+} SearchLimits;
+
+// Reported after each completed iteration
+typedef struct
+{
+  int depth;
+  int value; // From white's point of view
+  u64 nodes;
+  u64 time_ms;
+  Move pv[SearchMaxPly];
+  int pv_len;
+} SearchInfo;
+
+// Counters for a single search, so we can tell whether a change made the
+// search faster or just made it do less. This goes over the wire as it is in
+// SearchStatsReply so there's no padding.
+#pragma pack(push, 1)
+typedef struct
+{
+  u64 nodes;
+  u64 qnodes; // Evaluated at the horizon
+  u64 nps;
+  u64 time_ms;
+  u64 tt_probes;
+  u64 tt_hits;
+  u64 tt_cutoffs;       // Values taken from the table without searching
+  u64 fail_highs;       // Beta cutoffs
+  u64 fail_highs_first; // Beta cutoffs from the first move searched
+  // Indexed by depth - 1, for each completed iteration
+  u64 iteration_nodes[SearchMaxPly];
+  u64 iteration_ms[SearchMaxPly];
+  u32 depth; // Deepest completed iteration
+} SearchStats;
+#pragma pack(pop)
+
+// State that outlives a single search. Keeping one of these per game means
+// later searches benefit from the work done by earlier ones.
+struct SearchContext
+{
+  TransTable tt;
+  Move killers[SearchMaxPly][2]; // Quiet moves that caused a cutoff at ply
+  int history[64][64];           // Cutoff scores indexed by [from][to]
+  atomic_bool stop;              // Set to abort a running search
+  bool owns_tt; // Helper contexts share the main context's table
+  Tablebase* tb; // May be NULL, probed once few enough pieces are left
+
+  // Hash keys of the positions played before the root, oldest first. While
+  // searching the keys along the current path follow on from them.
+  u64 keys[SearchMaxGamePly + SearchMaxPly];
+  int nkeys; // Played positions
+
+  // Set before calling search. The search sets stop itself once it reaches
+  // the limits.
+  SearchLimits limits;
+  u64 start_ms;
+  atomic_uint_fast64_t nodes; // Nodes visited by the current search
+  SearchInfo info;            // From the last completed iteration
+  SearchStats stats;          // For the last search, filled in as it goes
+
+  void (*on_info)(SearchInfo* info, void* userdata); // May be NULL
+  void* userdata;
+};
+
+void search_context_new(SearchContext* ctx, size_t hash_mb);
+void search_context_new_helper(SearchContext* ctx, SearchContext* main);
+void search_context_free(SearchContext* ctx);
+void search_context_clear(SearchContext* ctx);
+void search_context_age(SearchContext* ctx, int plies);
+void search_context_push_position(SearchContext* ctx, Board board);
+void search_context_pop_position(SearchContext* ctx);
+void search_context_clear_positions(SearchContext* ctx);
+
+// The plies from the root to the mate a mate or tablebase value counts down to
+/// @return -1 if value isn't one
+int search_mate_plies(int value);
+
+double search_stats_branching(SearchStats* stats, int depth);
+void search_stats_log(SearchStats* stats);
+
 Move search(Tree* tree);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "book.h"
+#include "defs.h"
+#ifdef __linux__
+#include "eventloop.h"
+#endif
+#include "resultcache.h"
+#include "scheduler.h"
+#include "session.h"
+#include "tablebase.h"
+
+#include <ipc/socket.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Plays games with clients over IPC, each client getting its own Session.
+
+typedef struct
+{
+  Scheduler* scheduler; // Every client's requests are handled here
+  char* start_fen;
+  int depth;
+  Book* book;           // May be NULL, shared between every client
+  Tablebase* tb;        // May be NULL
+  ResultCache* results; // May be NULL
+
+  // Called on each thread before it handles a request, may be NULL
+  void (*thread_setup)();
+} Server;
+
+typedef struct Client Client;
+
+typedef struct MessageQueueItem MessageQueueItem;
+struct MessageQueueItem
+{
+  Client* client;
+  Message mess;
+  bool stopped; // For a StopSearchRequest, whether there was a search to stop
+  MessageQueueItem* next;
+};
+
+// A connected client and the game being played over it.
+//
+// Requests that only look at the game are handled in parallel on the shared
+// scheduler, and their replies can go out in any order so clients match them
+// up by guid. Requests that change the game wait for everything before them to
+// finish and hold up everything after them, so a client never sees the
+// effects of its requests out of order.
+struct Client
+{
+  Server* server;
+  Session session;
+#ifdef __linux__
+  Connection* conn;
+#else
+  Socket sock_in;
+  Socket sock_out;
+#endif
+
+  MessageQueueItem* queue_head;
+  MessageQueueItem* queue_tail;
+  int readers;  // Read only requests being handled
+  bool writer;  // Is a request that changes the game being handled
+  bool closed;  // Has the client disconnected
+  byte search_guid[16]; // Of the BestMoveRequest being searched
+  pthread_mutex_t lock;
+  pthread_mutex_t send_lock;
+};
+
+Client* client_new(Server* server);
+void client_queue_message(Client* client, Message mess);
+void client_close(Client* client);
+
+#ifdef __linux__
+// For an EventLoop with the Server as its userdata
+EventLoopCallbacks server_callbacks();
+#endif
+/// @return Only if we couldn't start listening
+int server_run(Server* server, char* requests_name, char* replies_name);
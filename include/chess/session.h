@@ -0,0 +1,113 @@
+#pragma once
+
+#include "book.h"
+#include "defs.h"
+#include "resultcache.h"
+#include "scheduler.h"
+#include "search.h"
+
+#include <rgl/array.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+enum
+{
+  SessionMaxMoves = 512, // More than both colours can have between them
+};
+
+// Every legal move in one position for both colours, grouped by the square
+// they're from: the moves from square i are moves[first[i]] up to but not
+// including moves[first[i + 1]].
+typedef struct
+{
+  u64 board_version; // The version of the board they're for, 0 for none
+  u16 first[65];
+  Move moves[SessionMaxMoves];
+} SessionMoves;
+
+// A copy of the board as it was after one change, which is never changed
+// itself. Readers can use one without holding any locks while the game moves
+// on.
+typedef struct
+{
+  Board board;
+  u64 version; // The session's board_version when it was taken
+  int readers;
+  bool replaced; // Freed by its last reader
+} BoardSnapshot;
+
+typedef struct SessionPonder SessionPonder;
+
+// Everything the server keeps for one game. The search tree and context are
+// carried between moves, and while the player is thinking we search the reply
+// we expect them to make.
+typedef struct
+{
+  Board board; // Only used with lock held, readers use snapshot
+  u64 board_version; // Goes up every time board changes
+  int depth;
+
+  // A new snapshot is published after every change to board. Readers count
+  // themselves in the one they take, so a replaced snapshot is freed as soon
+  // as the last one reading it is done.
+  BoardSnapshot* snapshot;
+  int replaced; // Replaced snapshots still being read
+  pthread_mutex_t snapshot_lock; // Only held to take or give back a snapshot
+
+  // The client asks about the moves one square at a time, so they're all
+  // worked out on the first query and kept until the board changes
+  SessionMoves moves;
+  pthread_mutex_t moves_lock;
+
+  Tree* tree; // Rooted at board unless we're pondering
+  SearchContext context;
+  SearchStats stats; // From the last search for one of our moves
+
+  // The context's killers are kept by ply from the root of the search that
+  // last used it, which is the expected reply's position if we pondered
+  u64 plies;         // Played since the board was set
+  u64 context_plies; // plies at the root of the context's last search
+
+  Book* book; // May be NULL, shared between sessions
+  ResultCache* results; // May be NULL, shared between sessions
+
+  // Pondering is queued on the scheduler as a search so it counts against the
+  // searches it allows. Without a scheduler we don't ponder.
+  Scheduler* scheduler; // May be NULL, shared between sessions
+  void (*thread_setup)(); // Called before pondering on a worker, may be NULL
+
+  // Changed under lock, but the search info callback reads it from the search
+  // threads without it
+  atomic_bool pondering;
+  Move ponder_move; // The reply we expect from the player
+  SessionPonder* ponder; // The queued task while pondering
+  pthread_mutex_t ponder_lock;
+  pthread_cond_t ponder_done;
+
+  // Searches for our move are counted as they're asked for and as they start,
+  // so session_stop_search can stop the running one and any still to come
+  // without the stop hanging around for later ones
+  pthread_mutex_t stop_lock;
+  u64 searches_asked;
+  u64 searches_started;
+  u64 searches_stopped; // Searches numbered up to this one are stopped
+  bool searching;
+
+  pthread_mutex_t lock;
+} Session;
+
+void session_new(Session* session, char* fen, int depth);
+void session_free(Session* session);
+void session_set_board(Session* session, char* fen);
+void session_make_move(Session* session, Move move);
+void session_promote(Session* session, ChessPiece piece);
+Move session_best_move(Session* session);
+BoardSnapshot* session_snapshot_acquire(Session* session);
+void session_snapshot_release(Session* session, BoardSnapshot* snapshot);
+void session_ask_search(Session* session);
+bool session_stop_search(Session* session);
+/// @return The legal moves from pos, to be freed by the caller
+Array session_get_moves(Session* session, int pos);
+bool session_is_legal(Session* session, Move move);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "defs.h"
+
+#include <rgl/threadpool.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Endgame tablebases. Each material combination has its own file, named by
+// its signature (e.g. KQvKR.ctb), that's mapped the first time a position
+// needs it.
+//
+// A table holds one byte for every placement of its pieces (square of the
+// first piece is most significant) with white to move, then the same again
+// with black to move. Each byte gives the result for the side to move and how
+// many plies it takes to get there with best play:
+//   0           draw (or an impossible placement)
+//   1 to 127    win, mating in that many plies
+//   128 + n     loss, mated in n plies
+//
+// The stronger side is always white, positions where black is stronger are
+// flipped before looking them up.
+
+enum
+{
+  TablebaseMaxPieces = 4,
+  TablebaseEntryDraw = 0,
+  TablebaseEntryLoss = 128,
+  // Scores for tablebase wins sit above any evaluation but below mate
+  TablebaseWinScore = 1000000,
+};
+
+typedef enum
+{
+  TablebaseWdlLoss = -1,
+  TablebaseWdlDraw = 0,
+  TablebaseWdlWin = 1,
+} TablebaseWdl;
+
+typedef struct
+{
+  TablebaseWdl wdl; // For the side to move
+  int plies;        // Until mate
+} TablebaseResult;
+
+// On disk, followed by the entries
+#pragma pack(push, 1)
+typedef struct
+{
+  char magic[4];
+  u8 npieces;
+  u8 pieces[TablebaseMaxPieces]; // ChessPieces in signature order
+  u8 pad[7];
+  u64 nentries; // Per side to move
+} TablebaseHeader;
+#pragma pack(pop)
+
+typedef struct TablebaseTable TablebaseTable;
+struct TablebaseTable
+{
+  char signature[16];
+  char* data; // NULL if there's no file for this signature
+  size_t size;
+  byte* entries;
+  u64 nentries;
+  TablebaseTable* next;
+};
+
+typedef struct
+{
+  char* path;     // Directory holding the tables
+  int max_pieces; // Don't probe positions with more pieces than this
+  // Tables are only ever added at the front so probes can walk the list
+  // without the lock
+  _Atomic(TablebaseTable*) tables;
+  pthread_mutex_t lock;
+} Tablebase;
+
+void tablebase_new(Tablebase* tb, char* path);
+void tablebase_free(Tablebase* tb);
+int tablebase_count_pieces(Board board);
+bool tablebase_probe(Tablebase* tb, Board board, TablebaseResult* result);
+bool tablebase_root_move(Tablebase* tb, Board board, Move* move,
+                         TablebaseResult* result);
+int tablebase_score(TablebaseResult result, bool white_to_move);
+int tablebase_generate(ThreadPool* pool, char* dir, char* signature,
+                       bool verify);
+
+// Shared with the generator
+int tablebase_sort_pieces(Board* board, u8* squares);
+void tablebase_signature(Board board, char* signature);
+u64 tablebase_index(u8* squares, int npieces);
+int tablebase_parse_signature(char* signature, ChessPiece* pieces);
+bool tablebase_board(ChessPiece* pieces, int npieces, u64 index,
+                     bool white_to_move, Board* board);
+int tablebase_write(char* path, ChessPiece* pieces, int npieces,
+                    byte* entries, u64 nentries);
+byte tablebase_entry(TablebaseResult result);
+TablebaseResult tablebase_result(byte entry);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "defs.h"
+
+typedef enum
+{
+  TTBoundExact,
+  TTBoundLower, // Value is at least this (beta cutoff)
+  TTBoundUpper, // Value is at most this (no move raised alpha)
+} TTBound;
+
+typedef struct
+{
+  u64 key;
+  Move move;
+  int value;
+  u8 depth;
+  u8 bound;
+} TTEntry;
+
+typedef struct
+{
+  TTEntry* entries;
+  size_t size; // Always a power of 2
+} TransTable;
+
+void transtable_new(TransTable* tt, size_t size_mb);
+void transtable_free(TransTable* tt);
+void transtable_clear(TransTable* tt);
+TTEntry* transtable_probe(TransTable* tt, u64 key);
+void transtable_store(TransTable* tt, u64 key, Move move, int value, int depth,
+                      TTBound bound);
@@ -10,6 +10,7 @@ size_t node_find_depth(Node* node);
 
 Tree* tree_new(Node* node, Board board, size_t depth);
 int tree_free(Tree** tree);
+void tree_advance(Tree* tree, Move move);
 void tree_print_best_line(Tree tree);
 Node** tree_traverse(Node* root, bool (*condition)(Node), size_t* node_count);
 bool tree_get_leaves_condition(Node node);
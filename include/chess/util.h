@@ -2,6 +2,8 @@
 
 #include "defs.h"
 
+#include <stddef.h>
+
 int randrange(int lower, int upper);
 
 u8 topos64(u8 pos88);
@@ -14,3 +16,8 @@ u8 tofile88(u8 pos88);
 u8 torank88(u8 pos88);
 
 char* get_dotnet_pipe_name(char* name);
+u64 get_time_ms();
+u64 get_time_ns();
+char* map_file(char* path, size_t* size);
+void unmap_file(char* data, size_t size);
+int cpu_count();
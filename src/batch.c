@@ -0,0 +1,374 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/defs.h>
+#include <chess/move.h>
+#include <chess/search.h>
+#include <chess/tree.h>
+#include <chess/util.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Searches every position in a FEN/EPD file and writes one result per line.
+//
+// Positions are handed out to the workers in file order and the results are
+// written in the same order. That way the last line in the output is always
+// the last one finished, so an interrupted run can be carried on with
+// --start.
+
+int depth = 5;
+
+enum
+{
+  BatchMaxThreads = 256,
+  BatchDefaultHashMb = 4,
+  BatchLineMax = 512,
+  // How many positions the workers can get ahead of the oldest unfinished
+  // one, per worker
+  BatchWindowPerThread = 4,
+  BatchOutputBufferSize = 1 << 20,
+  BatchFlushMs = 1000,
+};
+
+typedef enum
+{
+  BatchFormatCsv,
+  BatchFormatJsonl,
+} BatchFormat;
+
+typedef struct
+{
+  bool done;
+  char* text; // Output record
+} BatchResult;
+
+typedef struct
+{
+  // The input file
+  char* data;
+  size_t size;
+
+  int depth;
+  u64 nodes;
+  size_t hash_mb;
+  BatchFormat format;
+  FILE* out;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pos;      // Offset of the next line to hand out
+  u64 next_line;   // Line number at pos
+  u64 write_line;  // Oldest line not yet written
+  BatchResult* window;
+  size_t window_size;
+  u64 last_flush_ms;
+  u64 npositions;
+} Batch;
+
+static void usage(char* name)
+{
+  fprintf(stderr,
+          "Usage: %s <input> [-o output] [--depth n | --nodes n]\n"
+          "          [--threads n] [--hash mb] [--format csv|jsonl]\n"
+          "          [--start line]\n",
+          name);
+}
+
+// Copies the position out of an EPD or FEN line. EPD lines have only four
+// fields followed by operations (bm, id, ...) which the FEN parser would
+// choke on, so we stop after the fourth field unless the next two are the
+// move counters.
+/// @return false if the line doesn't hold a position
+static bool batch_line_to_fen(char* line, size_t len, char* fen)
+{
+  while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' '))
+    len--;
+  if (len == 0 || line[0] == '#' || len >= BatchLineMax)
+    return false;
+  memcpy(fen, line, len);
+  fen[len] = '\0';
+
+  int field = 0;
+  for (char* c = fen; *c; c++)
+  {
+    if (*c != ' ')
+      continue;
+    field++;
+    if (field == 4)
+    {
+      char* end;
+      strtol(c + 1, &end, 10);
+      bool counters = end != c + 1 && *end == ' ';
+      if (counters)
+      {
+        strtol(end + 1, &end, 10);
+        counters = *end == ' ' || *end == '\0';
+      }
+      *(counters ? end : c) = '\0';
+      break;
+    }
+  }
+  return field >= 3;
+}
+
+static char* batch_format_result(Batch* batch, u64 line, char* fen,
+                                 Move move, int value, u64 nodes, u64 time_ms)
+{
+  char* move_str = move_to_uci(move);
+  char* text = malloc(BatchLineMax + 256);
+  if (batch->format == BatchFormatCsv)
+    sprintf(text, "%llu,%s,%s,%d,%llu,%llu\n", (unsigned long long)line, fen,
+            move_str, value, (unsigned long long)nodes,
+            (unsigned long long)time_ms);
+  else
+    sprintf(text,
+            "{\"line\":%llu,\"fen\":\"%s\",\"bestmove\":\"%s\",\"score\":%d,"
+            "\"nodes\":%llu,\"time_ms\":%llu}\n",
+            (unsigned long long)line, fen, move_str, value,
+            (unsigned long long)nodes, (unsigned long long)time_ms);
+  free(move_str);
+  return text;
+}
+
+/// Takes the next line of the input. Must hold batch->lock.
+/// @return false if the line doesn't hold a position
+static bool batch_take_line(Batch* batch, u64* line_num, char* fen)
+{
+  char* line = batch->data + batch->pos;
+  char* end = memchr(line, '\n', batch->size - batch->pos);
+  size_t len = end ? end - line : batch->size - batch->pos;
+  batch->pos += len + (end ? 1 : 0);
+  *line_num = batch->next_line++;
+  return batch_line_to_fen(line, len, fen);
+}
+
+// Writes out every finished result at the front of the window. Must hold
+// batch->lock.
+static void batch_write_results(Batch* batch)
+{
+  for (;;)
+  {
+    BatchResult* result =
+        &batch->window[batch->write_line % batch->window_size];
+    if (!result->done)
+      break;
+    if (result->text)
+    {
+      fputs(result->text, batch->out);
+      free(result->text);
+      batch->npositions++;
+    }
+    result->done = false;
+    result->text = NULL;
+    batch->write_line++;
+  }
+
+  u64 now = get_time_ms();
+  if (now - batch->last_flush_ms >= BatchFlushMs)
+  {
+    fflush(batch->out);
+    batch->last_flush_ms = now;
+    ILOG("Written up to line %llu\n", (unsigned long long)batch->write_line);
+  }
+  pthread_cond_broadcast(&batch->cond);
+}
+
+static void* batch_worker(void* void_batch)
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+  Batch* batch = void_batch;
+
+  SearchContext ctx;
+  search_context_new(&ctx, batch->hash_mb);
+  char fen[BatchLineMax];
+
+  pthread_mutex_lock(&batch->lock);
+  for (;;)
+  {
+    // Don't get too far ahead of the writer
+    while (batch->next_line - batch->write_line >= batch->window_size)
+    {
+      batch_write_results(batch);
+      if (batch->next_line - batch->write_line < batch->window_size)
+        break;
+      pthread_cond_wait(&batch->cond, &batch->lock);
+    }
+
+    if (batch->pos >= batch->size)
+      break;
+    u64 line;
+    if (!batch_take_line(batch, &line, fen))
+    {
+      // Nothing to search but it still has to go through the window
+      batch->window[line % batch->window_size].done = true;
+      continue;
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    Board board;
+    board_new(&board, fen);
+
+    // Every position is searched from scratch so the results don't depend
+    // on which worker got which position
+    search_context_clear(&ctx);
+    ctx.limits = (SearchLimits){.nodes = batch->nodes};
+    atomic_store(&ctx.stop, false);
+
+    Node* root = node_new(NULL, move_new(-1, -1), board.white_to_move);
+    Tree* tree = tree_new(root, board, batch->depth);
+    tree->context = &ctx;
+
+    u64 start = get_time_ms();
+    Move move = search(tree);
+    u64 time_ms = get_time_ms() - start;
+
+    // Scores are from the side to move's point of view, like UCI
+    int value = board.white_to_move ? ctx.info.value : -ctx.info.value;
+    char* text = batch_format_result(batch, line, fen, move, value,
+                                     atomic_load(&ctx.nodes), time_ms);
+    tree_free(&tree);
+
+    pthread_mutex_lock(&batch->lock);
+    BatchResult* result = &batch->window[line % batch->window_size];
+    result->text = text;
+    result->done = true;
+    batch_write_results(batch);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  search_context_free(&ctx);
+  return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+
+  char* input = NULL;
+  char* output = NULL;
+  int nthreads = cpu_count();
+  u64 start_line = 1;
+
+  Batch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.hash_mb = BatchDefaultHashMb;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-o") == 0 && has_value)
+      output = argv[++i];
+    else if (strcmp(argv[i], "--depth") == 0 && has_value)
+      batch.depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--nodes") == 0 && has_value)
+      batch.nodes = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--threads") == 0 && has_value)
+      nthreads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--hash") == 0 && has_value)
+      batch.hash_mb = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--start") == 0 && has_value)
+      start_line = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--format") == 0 && has_value)
+    {
+      i++;
+      if (strcmp(argv[i], "csv") == 0)
+        batch.format = BatchFormatCsv;
+      else if (strcmp(argv[i], "jsonl") == 0)
+        batch.format = BatchFormatJsonl;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (!input && argv[i][0] != '-')
+      input = argv[i];
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!input)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  // A node limit on its own means search as deep as the nodes allow
+  if (!batch.depth)
+    batch.depth = batch.nodes ? SearchMaxPly : depth;
+  if (batch.depth < 1 || batch.depth > SearchMaxPly)
+    batch.depth = batch.depth < 1 ? 1 : SearchMaxPly;
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > BatchMaxThreads)
+    nthreads = BatchMaxThreads;
+  if (start_line < 1)
+    start_line = 1;
+
+  batch.data = map_file(input, &batch.size);
+  if (!batch.data)
+  {
+    ELOG("Couldn't read %s\n", input);
+    return 1;
+  }
+
+  // Skip to where a previous run got to
+  batch.next_line = 1;
+  while (batch.next_line < start_line && batch.pos < batch.size)
+  {
+    char* end = memchr(batch.data + batch.pos, '\n', batch.size - batch.pos);
+    batch.pos = end ? end - batch.data + 1 : batch.size;
+    batch.next_line++;
+  }
+  batch.write_line = batch.next_line;
+
+  // Carrying on from a previous run appends to its output
+  bool resuming = start_line > 1;
+  batch.out = output ? fopen(output, resuming ? "a" : "w") : stdout;
+  if (!batch.out)
+  {
+    ELOG("Couldn't open %s\n", output);
+    return 1;
+  }
+  setvbuf(batch.out, NULL, _IOFBF, BatchOutputBufferSize);
+  if (batch.format == BatchFormatCsv && !resuming)
+    fputs("line,fen,bestmove,score,nodes,time_ms\n", batch.out);
+
+  batch.window_size = nthreads * BatchWindowPerThread;
+  batch.window = calloc(batch.window_size, sizeof(*batch.window));
+  batch.last_flush_ms = get_time_ms();
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+
+  u64 start = get_time_ms();
+  pthread_t threads[BatchMaxThreads];
+  for (int i = 0; i < nthreads; i++)
+    pthread_create(&threads[i], NULL, batch_worker, &batch);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_lock(&batch.lock);
+  batch_write_results(&batch);
+  pthread_mutex_unlock(&batch.lock);
+  fflush(batch.out);
+
+  ILOG("Searched %llu positions in %llums\n",
+       (unsigned long long)batch.npositions,
+       (unsigned long long)(get_time_ms() - start));
+
+  if (batch.out != stdout)
+    fclose(batch.out);
+  free(batch.window);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.cond);
+  unmap_file(batch.data, batch.size);
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/defs.h>
+#include <chess/move.h>
+#include <chess/positions.h>
+#include <chess/search.h>
+#include <chess/tree.h>
+#include <chess/util.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Searches a fixed set of positions to a fixed depth and prints the nodes,
+// time and speed, like the bench command most engines have.
+//
+// With one thread the total node count only changes when the search does
+// something different, so it's a signature for the search: patches that
+// are meant to only make things faster shouldn't change it. Helper threads
+// make the count vary from run to run but show how well we scale.
+
+int depth = 5;
+
+enum
+{
+  BenchMaxThreads = 64,
+  BenchDefaultDepth = 4,
+  BenchDefaultHashMb = 16,
+};
+
+typedef struct
+{
+  SearchContext context;
+  Tree* tree;
+  pthread_t thread;
+} BenchHelper;
+
+static void usage(char* name)
+{
+  fprintf(stderr, "Usage: %s [--depth n] [--threads n] [--hash mb]\n", name);
+}
+
+static Tree* bench_tree_new(Board board, int depth)
+{
+  Node* root = node_new(NULL, move_new(-1, -1), board.white_to_move);
+  return tree_new(root, board, depth);
+}
+
+static void* bench_helper_run(void* void_helper)
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+  BenchHelper* helper = void_helper;
+  search(helper->tree);
+  return NULL;
+}
+
+// Searches one position from scratch, with the helpers doing lazy SMP the
+// same way as the UCI engine.
+/// @return Nodes searched by all the threads
+static u64 bench_position(SearchContext* ctx, BenchHelper* helpers,
+                          int nhelpers, Board board, int depth, Move* move)
+{
+  search_context_clear(ctx);
+  search_context_clear_positions(ctx);
+  ctx->limits = (SearchLimits){0};
+  atomic_store(&ctx->stop, false);
+
+  for (int i = 0; i < nhelpers; i++)
+  {
+    BenchHelper* helper = &helpers[i];
+    search_context_clear(&helper->context);
+    search_context_clear_positions(&helper->context);
+    helper->context.limits = (SearchLimits){.infinite = true};
+    atomic_store(&helper->context.stop, false);
+    atomic_store(&helper->context.nodes, 0);
+    // The odd ones go a ply deeper, but never past what search keeps stats for
+    int helper_depth = depth + i % 2;
+    if (helper_depth > SearchMaxPly)
+      helper_depth = SearchMaxPly;
+    helper->tree = bench_tree_new(board, helper_depth);
+    helper->tree->context = &helper->context;
+    pthread_create(&helper->thread, NULL, bench_helper_run, helper);
+  }
+
+  Tree* tree = bench_tree_new(board, depth);
+  tree->context = ctx;
+  *move = search(tree);
+  u64 nodes = atomic_load(&ctx->nodes);
+  tree_free(&tree);
+
+  for (int i = 0; i < nhelpers; i++)
+  {
+    BenchHelper* helper = &helpers[i];
+    atomic_store(&helper->context.stop, true);
+    pthread_join(helper->thread, NULL);
+    nodes += atomic_load(&helper->context.nodes);
+    tree_free(&helper->tree);
+  }
+  return nodes;
+}
+
+int main(int argc, char* argv[])
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+
+  int bench_depth = BenchDefaultDepth;
+  int nthreads = 1;
+  size_t hash_mb = BenchDefaultHashMb;
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--depth") == 0 && has_value)
+      bench_depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--threads") == 0 && has_value)
+      nthreads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--hash") == 0 && has_value)
+      hash_mb = atoi(argv[++i]);
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (bench_depth < 1 || bench_depth > SearchMaxPly)
+    bench_depth = bench_depth < 1 ? 1 : SearchMaxPly;
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > BenchMaxThreads)
+    nthreads = BenchMaxThreads;
+
+  // The helpers and their contexts are made once like they would be in a
+  // game, only the tables are cleared between positions
+  SearchContext ctx;
+  search_context_new(&ctx, hash_mb);
+  BenchHelper helpers[BenchMaxThreads - 1];
+  for (int i = 0; i < nthreads - 1; i++)
+    search_context_new_helper(&helpers[i].context, &ctx);
+
+  u64 total_nodes = 0;
+  u64 start = get_time_ms();
+  for (int i = 0; i < bench_npositions; i++)
+  {
+    Board board;
+    board_new(&board, bench_positions[i]);
+
+    u64 position_start = get_time_ms();
+    Move move;
+    u64 nodes = bench_position(&ctx, helpers, nthreads - 1, board,
+                               bench_depth, &move);
+    u64 time_ms = get_time_ms() - position_start;
+    total_nodes += nodes;
+
+    char* move_str = move_to_uci(move);
+    printf("Position %2d/%d: %-6s %10llu nodes %7llums  %s\n", i + 1,
+           bench_npositions, move_str, (unsigned long long)nodes,
+           (unsigned long long)time_ms, bench_positions[i]);
+    free(move_str);
+  }
+  u64 time_ms = get_time_ms() - start;
+
+  printf("\n==========================\n");
+  printf("Depth           : %d\n", bench_depth);
+  printf("Threads         : %d\n", nthreads);
+  printf("Total time (ms) : %llu\n", (unsigned long long)time_ms);
+  printf("Nodes searched  : %llu\n", (unsigned long long)total_nodes);
+  printf("Nodes/second    : %llu\n",
+         (unsigned long long)(total_nodes * 1000 / (time_ms ? time_ms : 1)));
+
+  for (int i = 0; i < nthreads - 1; i++)
+    search_context_free(&helpers[i].context);
+  search_context_free(&ctx);
+  return 0;
+}
@@ -1,6 +1,7 @@
 #include <rgl/logging.h>
 
 #include <chess/board.h>
+#include <chess/profile.h>
 #include <chess/search.h>
 #include <chess/tree.h>
 #include <chess/util.h>
@@ -20,9 +21,12 @@ static void board_init(Board* board)
     board->can_castle_ks[i] = board->can_castle_qs[i] = true;
 }
 
-static void parse_fen(Board* board, char* fen)
+/// @return false if fen doesn't lay out exactly 64 squares or has a number
+/// too long for us
+static bool parse_fen(Board* board, char* fen)
 {
   board_init(board);
+  int squares = 0;
   int idx = 0;
   int stage = 0; // Which segment are we parsing? (board, turn, castling, ...)
 
@@ -48,11 +52,17 @@ static void parse_fen(Board* board, char* fen)
     switch (stage)
     {
     case 0: // Board layout
-      if (atoi(cstr))
+      if (c >= '1' && c <= '8')
+      {
+        if (squares + atoi(cstr) > 64)
+          return false;
         for (int i = 0; i < atoi(cstr); i++)
-          board->state[idx++] = ChessPieceNone;
+          board->state[squares++] = ChessPieceNone;
+      }
+      else if (squares < 64 && strchr("0pnbrqkPNBRQK", c))
+        board->state[squares++] = piece_from_char(c);
       else
-        board->state[idx++] = piece_from_char(c);
+        return false;
       break;
     case 1: // Turn
       if (c == 'w')
@@ -87,13 +97,25 @@ static void parse_fen(Board* board, char* fen)
         break;
       }
 
+      // Standard FENs give a square like e3, we also accept a board index
+      if (c >= 'a' && c <= 'h' && fen[1] >= '1' && fen[1] <= '8')
+      {
+        board->en_passant_tile = topos64fr(c - 'a', '8' - fen[1]);
+        fen++;
+        break;
+      }
+
       idx = 0;
       while (isdigit(c))
       {
+        if (idx == sizeof(ep_str) - 1)
+          return false;
         ep_str[idx++] = c;
         c = *(++fen);
       }
       board->en_passant_tile = atoi(ep_str);
+      if (idx == 0 || board->en_passant_tile >= 64)
+        return false;
       c = *(--fen); // Since we increment at the end of the for loop, need to
                     // decrement here
       break;
@@ -102,6 +124,8 @@ static void parse_fen(Board* board, char* fen)
       idx = 0;
       while (isdigit(c))
       {
+        if (idx == sizeof(hm_str) - 1)
+          return false;
         hm_str[idx++] = c;
         c = *(++fen);
       }
@@ -113,6 +137,8 @@ static void parse_fen(Board* board, char* fen)
       idx = 0;
       while (isdigit(c))
       {
+        if (idx == sizeof(fm_str) - 1)
+          return false;
         fm_str[idx++] = c;
         c = *(++fen);
       }
@@ -124,12 +150,15 @@ static void parse_fen(Board* board, char* fen)
       break;
     }
   }
+  return squares == 64;
 }
 
-void board_new(Board* board, char* fen)
+// Any text is safe to give this, but only a valid FEN gives a usable board
+/// @return false if fen isn't valid
+bool board_new(Board* board, char* fen)
 {
   board_init(board);
-  parse_fen(board, fen);
+  return parse_fen(board, fen);
 }
 
 // Initialises a board from the string representation of a board.
@@ -168,11 +197,18 @@ char* board_tostring(Board board)
   return str;
 }
 
-void board_update(Board* board, Move* move)
+// Written once for both colours. Callers pass isWhite as a constant so that
+// each copy has the colour checks folded away.
+static FORCE_INLINE void board_update_colour(Board* board, Move* move,
+                                             const bool isWhite)
 {
+  // Captures and pawn moves can't be undone so they reset the clock
+  bool irreversible = board->state[move->to] != ChessPieceNone ||
+                      (board->state[move->from] & ChessPiecePawn);
+  board->halfmove_clock = irreversible ? 0 : board->halfmove_clock + 1;
+
   board->state[move->to] = board->state[move->from];
   board->state[move->from] = ChessPieceNone;
-  bool isWhite = board->state[move->to] & ChessPieceIsWhite;
 
   // Do castling move
   if (board->state[move->to] & ChessPieceKing)
@@ -207,11 +243,12 @@ void board_update(Board* board, Move* move)
   // Pawn promotion
   if (board->state[move->to] & ChessPiecePawn)
   {
-    if (torank64(move->to) == (isWhite ? 0 : 7) && move->promotion)
+    if (torank64(move->to) == (isWhite ? 0 : 7) && move->promo)
     {
-      ILOG("Promoting %d at %d to %d\n", board->state[move->to], move->to, move->promotion);
-      board->state[move->to] =
-          move->promotion | (isWhite ? ChessPieceIsWhite : 0);
+      ChessPiece promotion = move_promotion(*move);
+      ILOG("Promoting %d at %d to %d\n", board->state[move->to], move->to,
+           promotion);
+      board->state[move->to] = promotion | (isWhite ? ChessPieceIsWhite : 0);
     }
   }
 
@@ -223,15 +260,26 @@ void board_update(Board* board, Move* move)
   if (board->state[move->to] & ChessPiecePawn)
     if (abs(move->to - move->from) == 16) // Pawn has double moved
       board->en_passant_tile = move->to + (isWhite ? 8 : -8);
+
+  if (!isWhite)
+    board->fullmove_count++;
+  board->white_to_move = !isWhite;
+}
+
+void board_update(Board* board, Move* move)
+{
+  PROFILE_ZONE(ProfileZoneBoardUpdate);
+  if (board->state[move->from] & ChessPieceIsWhite)
+    board_update_colour(board, move, true);
+  else
+    board_update_colour(board, move, false);
 }
 
 // Checks that we're not doing a self capture.
-static bool is_self_capture(Board board, int origin_pos, int target_pos)
+static FORCE_INLINE bool is_own_piece(u8* board, int pos, const bool isWhite)
 {
-  if (board.state[target_pos] == ChessPieceNone)
-    return false;
-  return !((board.state[origin_pos] & ChessPieceIsWhite) ^
-           (board.state[target_pos] & ChessPieceIsWhite));
+  return board[pos] != ChessPieceNone &&
+         !(board[pos] & ChessPieceIsWhite) == !isWhite;
 }
 
 static int find_king(Board board, bool isWhite)
@@ -288,6 +336,7 @@ end:
 ///         in check
 static int position_of_checker(Board board, bool isWhite)
 {
+  PROFILE_ZONE(ProfileZonePositionOfChecker);
   int frompos;
   int king_pos = find_king(board, isWhite);
 
@@ -313,62 +362,104 @@ static int position_of_checker(Board board, bool isWhite)
   return frompos;
 }
 
-CheckInfo get_check_info(Board board, bool isWhite)
+bool is_in_check(Board board, bool isWhite)
 {
-  CheckInfo result = CheckInfoNone;
-  Array moves = board_get_moves_all(board, isWhite ? GetMovesWhite : GetMovesBlack);
-  bool can_move = moves.used != 0;
-  bool in_check = is_in_check(board, isWhite);
-
-  if (in_check)
-    result = CheckInfoCheck;
-
-  if (!can_move && in_check)
-    result = CheckInfoCheckmate;
-
-  if (!can_move && !in_check)
-    result = CheckInfoStalemate;
-
-  array_free(&moves);
-  return result;
+  return position_of_checker(board, isWhite) >= 0;
 }
 
-bool is_in_check(Board board, bool isWhite)
+// en_passant_tile is set after every double pawn move, this checks there's a
+// pawn in place to take
+bool can_take_en_passant(Board board)
 {
-  return position_of_checker(board, isWhite) >= 0;
+  int ep = board.en_passant_tile;
+  if (ep < 0 || ep >= 64)
+    return false;
+  ChessPiece pawn =
+      ChessPiecePawn | (board.white_to_move ? ChessPieceIsWhite : 0);
+  int pawn_rank = torank64(ep) + (board.white_to_move ? 1 : -1);
+  int file = tofile64(ep);
+  return (file > 0 && board.state[topos64fr(file - 1, pawn_rank)] == pawn) ||
+         (file < 7 && board.state[topos64fr(file + 1, pawn_rank)] == pawn);
 }
 
-bool can_move(Board board, bool is_white)
+// Squares a piece other than the king has to move to to get out of check from
+// the piece at checker: the checker itself or anywhere between it and the
+// king. Every square if checker is -1, i.e. we're not in check.
+static u64 board_evasion_targets(Board board, bool isWhite, int checker)
 {
-  Array moves = board_get_moves_all(board, is_white ? GetMovesWhite : GetMovesBlack);
-  return array_free(&moves), moves.used != 0;
+  if (checker < 0)
+    return ~0ull;
+
+  u64 targets = 1ull << checker;
+  if (board.state[checker] &
+      (ChessPieceBishop | ChessPieceCastle | ChessPieceQueen))
+  {
+    int king_88 = topos88(find_king(board, isWhite));
+    int checker_88 = topos88(checker);
+    int rank_step = (torank88(king_88) > torank88(checker_88)) -
+                    (torank88(king_88) < torank88(checker_88));
+    int file_step = (tofile88(king_88) > tofile88(checker_88)) -
+                    (tofile88(king_88) < tofile88(checker_88));
+    int step = rank_step * 16 + file_step;
+    for (int pos_88 = checker_88 + step; pos_88 != king_88; pos_88 += step)
+      targets |= 1ull << topos64(pos_88);
+  }
+
+  // A pawn that's just double moved can be taken en passant
+  int ep = board.en_passant_tile;
+  if (ep >= 0 && ep < 64 && checker == ep + (isWhite ? 8 : -8))
+    targets |= 1ull << ep;
+  return targets;
 }
-bool is_in_checkmate(Board board, bool is_white)
+
+static FORCE_INLINE void board_add_move(Array* moves, int from, int to,
+                                        bool wanted, u64 targets)
 {
-  if (!is_in_check(board, is_white))
-    return false;
-  return can_move(board, is_white);
+  if (!wanted || !(targets >> to & 1))
+    return;
+  Move move = move_new(from, to);
+  array_push(moves, &move);
 }
-bool is_in_stalemate(Board board, bool is_white)
+
+// Promotions go with the captures since they change the material too
+static FORCE_INLINE void board_add_promotions(Array* moves, int from, int to,
+                                              bool captures, u64 targets)
 {
-  if (is_in_check(board, is_white))
-    return false;
-  return can_move(board, is_white);
+  if (!captures || !(targets >> to & 1))
+    return;
+  ChessPiece pieces[] = {ChessPieceCastle, ChessPieceKnight, ChessPieceBishop,
+                         ChessPieceQueen};
+  for (int i = 0; i < 4; i++)
+  {
+    Move promotion = move_new(from, to);
+    // Handle this in board update
+    move_set_promotion(&promotion, pieces[i]);
+    array_push(moves, &promotion);
+  }
 }
 
-/// @return Array array of moves
-Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
+// The moves for the piece at pos, which must be on the board and have the
+// colour isWhite. Instantiated once per colour like board_update_colour.
+//
+// Only moves of the stages in flags are generated, or all of them if there
+// aren't any. Pieces other than the king can only move to squares in targets.
+static FORCE_INLINE Array board_get_moves_colour(Board _board, int pos,
+                                                 GetMovesFlags flags,
+                                                 u64 targets,
+                                                 const bool isWhite)
 {
   Array moves;
   array_new(&moves, 32, sizeof(Move));
 
   u8 pos_88 = topos88(pos);
+  u8* board = _board.state;
 
-  if (pos_88 & 0x88)
-    goto end;
-
-  ChessPiece* board = _board.state;
-  bool isWhite = board[pos] & ChessPieceIsWhite;
+  bool all = !(flags & GetMovesStages);
+  bool captures = all || (flags & (GetMovesCaptures | GetMovesEvasions));
+  bool quiets = all || (flags & (GetMovesQuiets | GetMovesQuietChecks |
+                                 GetMovesEvasions));
+  if (board[pos] & ChessPieceKing)
+    targets = ~0ull;
 
   // Want to check:
   //  If we're off the board
@@ -383,17 +474,15 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
       int tpos_88 = pos_88 + move_offsets[i];
       if (tpos_88 & 0x88)
         continue;
-      if (!is_self_capture(_board, pos, topos64(tpos_88)))
-      {
-        Move move = move_new(pos, topos64(tpos_88));
-        array_push(&moves, &move);
-      }
+      int tpos = topos64(tpos_88);
+      if (!is_own_piece(board, tpos, isWhite))
+        board_add_move(&moves, pos, tpos, board[tpos] ? captures : quiets,
+                       targets);
     }
   }
 
   if (board[pos] & ChessPiecePawn)
   {
-    bool isWhite = board[pos] & ChessPieceIsWhite;
     int dirsgn = isWhite ? -1 : 1; // Pawns can only move forwards
 
     // Pawns can double move at the start
@@ -401,34 +490,17 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
     if (torank64(pos) == double_move_rank &&
         board[pos + dirsgn * 16] == ChessPieceNone &&
         board[pos + dirsgn * 8] == ChessPieceNone)
-    {
-      Move move = move_new(pos, pos + dirsgn * 16);
-      array_push(&moves, &move);
-    }
+      board_add_move(&moves, pos, pos + dirsgn * 16, quiets, targets);
 
     int tpos_88 = pos_88 + dirsgn * 16;
 
-    ChessPiece pieces[] = {ChessPieceCastle, ChessPieceKnight, ChessPieceBishop,
-                           ChessPieceQueen};
-
     // Pawns can only move forwards to an empty square
     if (!(tpos_88 & 0x88) && board[topos64(tpos_88)] == ChessPieceNone)
     {
-      // @@Rework make this only need one promotion if block
       if (torank88(tpos_88) == (isWhite ? 0 : 7))
-      {
-        for (int i = 0; i < 4; i++)
-        {
-          Move promotion = move_new(pos, topos64(tpos_88));
-          promotion.promotion = pieces[i]; // Handle this in board update
-          array_push(&moves, &promotion);
-        }
-      }
+        board_add_promotions(&moves, pos, topos64(tpos_88), captures, targets);
       else
-      {
-        Move move = move_new(pos, topos64(tpos_88));
-        array_push(&moves, &move);
-      }
+        board_add_move(&moves, pos, topos64(tpos_88), quiets, targets);
     }
 
     int diagonals[] = {15, 17};
@@ -441,25 +513,15 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
 
       // Pawns can only move diagonally if they're capturing a piece or taking
       // en_passant_tile
-      bool can_capture = !is_self_capture(_board, pos, tpos) && board[tpos];
+      bool can_capture = board[tpos] && !is_own_piece(board, tpos, isWhite);
       can_capture = can_capture || tpos == _board.en_passant_tile;
 
       if (can_capture)
       {
         if (torank88(tpos_88) == (isWhite ? 0 : 7))
-        {
-          for (int i = 0; i < 4; i++)
-          {
-            Move promotion = move_new(pos, topos64(tpos_88));
-            promotion.promotion = pieces[i]; // Handle this in board update
-            array_push(&moves, &promotion);
-          }
-        }
+          board_add_promotions(&moves, pos, tpos, captures, targets);
         else
-        {
-          Move move = move_new(pos, tpos);
-          array_push(&moves, &move);
-        }
+          board_add_move(&moves, pos, tpos, captures, targets);
       }
     }
   }
@@ -480,12 +542,13 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
     {
       int tpos_88 = topos88(pos) + slide_offset[i];
       while (!(tpos_88 & 0x88) &&
-             !is_self_capture(_board, pos, topos64(tpos_88)))
+             !is_own_piece(board, topos64(tpos_88), isWhite))
       {
-        Move move = move_new(pos, topos64(tpos_88));
-        array_push(&moves, &move);
+        int tpos = topos64(tpos_88);
+        board_add_move(&moves, pos, tpos, board[tpos] ? captures : quiets,
+                       targets);
 
-        if (board[topos64(tpos_88)])
+        if (board[tpos])
           break;
 
         tpos_88 += slide_offset[i];
@@ -496,7 +559,7 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
   }
 
   // Castling
-  if (board[pos] & ChessPieceKing)
+  if ((board[pos] & ChessPieceKing) && quiets)
   {
     for (int castling_ks = 0; castling_ks < 2; castling_ks++)
     {
@@ -547,41 +610,124 @@ Array board_get_moves(Board _board, int pos, GetMovesFlags flags)
   // piece can still give check: i.e. a piece that is pinned against the king
   // can still move to kill the enemy king even if doing so leaves its own
   // king in check.
-  if (flags & ConsiderChecks)
+  //
+  // When only the quiet checks were asked for, quiet moves that don't give
+  // check go too.
+  bool quiet_checks_only = (flags & GetMovesQuietChecks) &&
+                           !(flags & (GetMovesQuiets | GetMovesEvasions));
+  if ((flags & ConsiderChecks) || quiet_checks_only)
   {
     Board board_after = _board;
     for (int i = 0; i < moves.capacity; i++)
     {
       if (!array_index_is_allocated(&moves, i))
         continue;
-      board_update(&board_after, array_get(&moves, i));
-      if ((position_of_checker(board_after, board[pos] & ChessPieceIsWhite)) >=
-          0)
+      Move* move = array_get(&moves, i);
+      board_update(&board_after, move);
+      bool is_quiet = board[move->to] == ChessPieceNone && !move->promo &&
+                      !((board[pos] & ChessPiecePawn) &&
+                        move->to == _board.en_passant_tile);
+      if ((flags & ConsiderChecks) &&
+          position_of_checker(board_after, isWhite) >= 0)
+        array_remove(&moves, i);
+      else if (quiet_checks_only && is_quiet &&
+               position_of_checker(board_after, !isWhite) < 0)
         array_remove(&moves, i);
       board_after = _board;
     }
   }
 
-end:
   array_squash(&moves);
   return moves;
 }
 
-Array board_get_moves_all(Board board, GetMovesAllFlags flags)
+static Array board_get_moves_white(Board board, int pos, GetMovesFlags flags,
+                                   u64 targets)
+{
+  return board_get_moves_colour(board, pos, flags, targets, true);
+}
+
+static Array board_get_moves_black(Board board, int pos, GetMovesFlags flags,
+                                   u64 targets)
 {
+  return board_get_moves_colour(board, pos, flags, targets, false);
+}
+
+/// @return Array array of moves
+Array board_get_moves(Board board, int pos, GetMovesFlags flags)
+{
+  PROFILE_ZONE(ProfileZoneBoardGetMoves);
+  if (topos88(pos) & 0x88)
+  {
+    Array moves;
+    array_new(&moves, 32, sizeof(Move));
+    array_squash(&moves);
+    return moves;
+  }
+
+  bool isWhite = board.state[pos] & ChessPieceIsWhite;
+  u64 targets = ~0ull;
+  if (flags & GetMovesEvasions)
+    targets = board_evasion_targets(board, isWhite,
+                                    position_of_checker(board, isWhite));
+  if (isWhite)
+    return board_get_moves_white(board, pos, flags, targets);
+  return board_get_moves_black(board, pos, flags, targets);
+}
+
+// Legal moves for one colour, only those of the stages asked for. The search
+// can ask for the captures first and only generate the quiets if it still
+// needs them.
+Array board_get_moves_stage(Board board, bool isWhite, GetMovesFlags stages)
+{
+  PROFILE_ZONE(ProfileZoneBoardGetMoves);
   Array moves;
   array_new(&moves, 64, sizeof(Move));
 
+  // Worked out once here rather than for each piece
+  u64 targets = ~0ull;
+  if (stages & GetMovesEvasions)
+    targets = board_evasion_targets(board, isWhite,
+                                    position_of_checker(board, isWhite));
+
+  GetMovesFlags flags = ConsiderChecks | (stages & GetMovesStages);
   for (int i = 0; i < 64; i++)
   {
-    if ((flags & GetMovesWhite) && !(flags & GetMovesBlack))
-      if (!(board.state[i] & ChessPieceIsWhite))
-        continue;
-    if ((flags & GetMovesBlack) && !(flags & GetMovesWhite))
-      if (board.state[i] & ChessPieceIsWhite)
+    ChessPiece piece = board.state[i];
+    if (piece == ChessPieceNone || !(piece & ChessPieceIsWhite) != !isWhite)
+      continue;
+
+    Array piece_moves = isWhite
+                            ? board_get_moves_white(board, i, flags, targets)
+                            : board_get_moves_black(board, i, flags, targets);
+    for (size_t j = 0; j < piece_moves.capacity; j++)
+    {
+      if (!array_index_is_allocated(&piece_moves, j))
         continue;
+      array_push(&moves, array_get(&piece_moves, j));
+    }
+    array_free(&piece_moves);
+  }
+  array_squash(&moves);
+  return moves;
+}
+
+Array board_get_moves_all(Board board, GetMovesAllFlags flags)
+{
+  bool white = flags & GetMovesWhite;
+  bool black = flags & GetMovesBlack;
+  if (white != black)
+    return board_get_moves_stage(board, white, 0);
+
+  // Both colours at once
+  Array moves;
+  array_new(&moves, 64, sizeof(Move));
+
+  for (int i = 0; i < 64; i++)
+  {
+    if (board.state[i] == ChessPieceNone)
+      continue;
 
-    size_t nmoves = 0;
     Array piece_moves = board_get_moves(board, i, ConsiderChecks);
     for (size_t j = 0; j < piece_moves.capacity; j++)
     {
@@ -594,3 +740,193 @@ Array board_get_moves_all(Board board, GetMovesAllFlags flags)
   array_squash(&moves);
   return moves;
 }
+
+// Tries the pieces one at a time and stops at the first legal move, rather
+// than finding every move like board_get_moves_all. checker is from
+// position_of_checker.
+static bool board_has_legal_move_checker(Board board, bool isWhite,
+                                         int checker)
+{
+  u64 targets = board_evasion_targets(board, isWhite, checker);
+  for (int i = 0; i < 64; i++)
+  {
+    ChessPiece piece = board.state[i];
+    if (piece == ChessPieceNone || !(piece & ChessPieceIsWhite) != !isWhite)
+      continue;
+
+    // Checked for legality here so we can stop as soon as one is
+    Array moves = isWhite ? board_get_moves_white(board, i, 0, targets)
+                          : board_get_moves_black(board, i, 0, targets);
+    bool found = false;
+    for (size_t j = 0; !found && j < moves.capacity; j++)
+    {
+      if (!array_index_is_allocated(&moves, j))
+        continue;
+      Move* move = array_get(&moves, j);
+      // Castling isn't checked for passing through check without
+      // ConsiderChecks. We can skip it since whenever castling is legal the
+      // king's single step that way is too.
+      if ((piece & ChessPieceKing) && abs(move->to - move->from) == 2)
+        continue;
+      Board board_after = board;
+      board_update(&board_after, move);
+      found = position_of_checker(board_after, isWhite) < 0;
+    }
+    array_free(&moves);
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+bool board_has_legal_move(Board board, bool isWhite)
+{
+  return board_has_legal_move_checker(board, isWhite,
+                                      position_of_checker(board, isWhite));
+}
+
+// Finds the checker once and uses it both for whether we're in check and to
+// narrow down the moves that could get us out of it
+CheckInfo get_check_info(Board board, bool isWhite)
+{
+  int checker = position_of_checker(board, isWhite);
+  bool in_check = checker >= 0;
+  bool can_move = board_has_legal_move_checker(board, isWhite, checker);
+
+  if (!can_move)
+    return in_check ? CheckInfoCheckmate : CheckInfoStalemate;
+  return in_check ? CheckInfoCheck : CheckInfoNone;
+}
+
+bool is_in_checkmate(Board board, bool isWhite)
+{
+  return get_check_info(board, isWhite) == CheckInfoCheckmate;
+}
+
+bool is_in_stalemate(Board board, bool isWhite)
+{
+  return get_check_info(board, isWhite) == CheckInfoStalemate;
+}
+
+// Whether nothing is in the way between from and to, which must be on the same
+// rank, file or diagonal
+static bool board_path_is_clear(Board* board, int from, int to)
+{
+  int from_88 = topos88(from);
+  int to_88 = topos88(to);
+  int rank_step = (torank88(to_88) > torank88(from_88)) -
+                  (torank88(to_88) < torank88(from_88));
+  int file_step = (tofile88(to_88) > tofile88(from_88)) -
+                  (tofile88(to_88) < tofile88(from_88));
+  int step = rank_step * 16 + file_step;
+  for (int pos_88 = from_88 + step; pos_88 != to_88; pos_88 += step)
+    if (board->state[topos64(pos_88)] != ChessPieceNone)
+      return false;
+  return true;
+}
+
+// Castling needs the rights, an empty path and the king not to be in or pass
+// through check. The same squares are checked as in board_get_moves.
+static bool board_castle_is_legal(Board* board, int from, int to,
+                                  bool isWhite)
+{
+  bool castling_ks = to > from;
+  if (from != topos64fr(4, isWhite ? 7 : 0))
+    return false;
+  if (!(castling_ks ? board->can_castle_ks[isWhite]
+                    : board->can_castle_qs[isWhite]))
+    return false;
+  if (!(board->state[topos64fr(castling_ks ? 7 : 0, isWhite ? 7 : 0)] &
+        ChessPieceCastle))
+    return false;
+  if (position_of_checker(*board, isWhite) >= 0)
+    return false;
+
+  int sign = castling_ks ? 1 : -1;
+  for (int i = 1; i < (castling_ks ? 3 : 4); i++)
+  {
+    int tpos = from + sign * i;
+    if (board->state[tpos] != ChessPieceNone)
+      return false;
+    Board board_cpy = *board;
+    Move tmp = move_new(from, tpos);
+    board_update(&board_cpy, &tmp);
+    if (position_of_checker(board_cpy, isWhite) >= 0)
+      return false;
+  }
+  return true;
+}
+
+// Whether the piece on move.from can make the move by the rules for its type,
+// without looking at whether it leaves our king in check
+static bool board_is_pseudo_legal(Board* board, Move move, bool isWhite)
+{
+  u8* state = board->state;
+  ChessPiece piece = state[move.from];
+  if (move_is_null(move) || piece == ChessPieceNone ||
+      !(piece & ChessPieceIsWhite) != !isWhite ||
+      is_own_piece(state, move.to, isWhite))
+    return false;
+
+  int rank_diff = torank64(move.to) - torank64(move.from);
+  int file_diff = tofile64(move.to) - tofile64(move.from);
+  int rank_dist = abs(rank_diff);
+  int file_dist = abs(file_diff);
+
+  // A promotion piece is needed exactly when a pawn reaches the last rank
+  bool promoting = (piece & ChessPiecePawn) &&
+                   torank64(move.to) == (isWhite ? 0 : 7);
+  ChessPiece promotion = move_promotion(move);
+  if (promoting != (promotion != ChessPieceNone))
+    return false;
+  if (promoting && (!(promotion & (ChessPieceKnight | ChessPieceBishop |
+                                   ChessPieceCastle | ChessPieceQueen)) ||
+                    (promotion & (promotion - 1))))
+    return false;
+
+  if (piece & ChessPiecePawn)
+  {
+    int dirsgn = isWhite ? -1 : 1;
+    if (file_dist == 1 && rank_diff == dirsgn)
+      return state[move.to] != ChessPieceNone ||
+             move.to == board->en_passant_tile;
+    if (file_dist != 0 || state[move.to] != ChessPieceNone)
+      return false;
+    if (rank_diff == dirsgn)
+      return true;
+    return rank_diff == 2 * dirsgn &&
+           torank64(move.from) == (isWhite ? 6 : 1) &&
+           state[move.from + dirsgn * 8] == ChessPieceNone;
+  }
+
+  if (piece & ChessPieceKnight)
+    return (rank_dist == 1 && file_dist == 2) ||
+           (rank_dist == 2 && file_dist == 1);
+
+  if (piece & ChessPieceKing)
+  {
+    if (rank_dist == 0 && file_dist == 2)
+      return board_castle_is_legal(board, move.from, move.to, isWhite);
+    return rank_dist <= 1 && file_dist <= 1;
+  }
+
+  bool straight = rank_dist == 0 || file_dist == 0;
+  bool diagonal = rank_dist == file_dist;
+  if ((piece & ChessPieceBishop) && !diagonal)
+    return false;
+  if ((piece & ChessPieceCastle) && !straight)
+    return false;
+  if ((piece & ChessPieceQueen) && !straight && !diagonal)
+    return false;
+  return board_path_is_clear(board, move.from, move.to);
+}
+
+bool board_is_legal(Board* board, Move move)
+{
+  bool isWhite = board->white_to_move;
+  if (!board_is_pseudo_legal(board, move, isWhite))
+    return false;
+  Board board_after = *board;
+  board_update(&board_after, &move);
+  return position_of_checker(board_after, isWhite) < 0;
+}
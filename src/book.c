@@ -0,0 +1,348 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/book.h>
+#include <chess/move.h>
+#include <chess/util.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+  BookEntrySize = 16, // On disk
+  BookRandomCastle = 768,
+  BookRandomEnPassant = 772,
+  BookRandomTurn = 780,
+  BookRandomCount = 781,
+  BookLineMax = 4096,
+};
+
+// Polyglot's Random64 layout: 12 * 64 piece squares, 4 castling rights, 8 en
+// passant files and the side to move. See the note in book.h.
+static u64 book_random[BookRandomCount];
+
+__attribute__((constructor))
+static void book_random_init()
+{
+  // xorshift64*, seeded differently to the search's Zobrist keys
+  u64 state = 0x6A09E667F3BCC908ULL;
+  for (int i = 0; i < BookRandomCount; i++)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    book_random[i] = state * 0x2545F4914F6CDD1DULL;
+  }
+}
+
+// Polyglot counts ranks from white's side, we count them from black's
+static int book_row(u8 pos64)
+{
+  return 7 - torank64(pos64);
+}
+
+static u8 book_square(int file, int row)
+{
+  return topos64fr(file, 7 - row);
+}
+
+static u64 read_be(byte* data, int nbytes)
+{
+  u64 value = 0;
+  for (int i = 0; i < nbytes; i++)
+    value = (value << 8) | data[i];
+  return value;
+}
+
+static void write_be(byte* data, u64 value, int nbytes)
+{
+  for (int i = nbytes - 1; i >= 0; i--, value >>= 8)
+    data[i] = value & 0xff;
+}
+
+static BookEntry book_entry(Book* book, size_t i)
+{
+  byte* data = (byte*)book->data + i * BookEntrySize;
+  BookEntry entry;
+  entry.key = read_be(data, 8);
+  entry.move = read_be(data + 8, 2);
+  entry.weight = read_be(data + 10, 2);
+  entry.learn = read_be(data + 12, 4);
+  return entry;
+}
+
+/// @return 0 on success
+int book_open(Book* book, char* path)
+{
+  memset(book, 0, sizeof(*book));
+  book->max_ply = BookDefaultMaxPly;
+  book->variety = BookDefaultVariety;
+
+  book->data = map_file(path, &book->size);
+  if (!book->data)
+  {
+    ELOG("Couldn't open book %s\n", path);
+    return -1;
+  }
+  book->nentries = book->size / BookEntrySize;
+  ILOG("Opened book %s with %zu entries\n", path, book->nentries);
+  return 0;
+}
+
+void book_close(Book* book)
+{
+  if (book->data)
+    unmap_file(book->data, book->size);
+  book->data = NULL;
+  book->nentries = 0;
+}
+
+u64 book_key(Board board)
+{
+  u64 key = 0;
+  for (int i = 0; i < 64; i++)
+  {
+    ChessPiece piece = board.state[i];
+    if (piece == ChessPieceNone)
+      continue;
+    // Black pawn, white pawn, black knight, ...
+    int kind = 2 * __builtin_ctz(piece & ~ChessPieceIsWhite) +
+               ((piece & ChessPieceIsWhite) ? 1 : 0);
+    key ^= book_random[64 * kind + 8 * book_row(i) + tofile64(i)];
+  }
+
+  // White king side, white queen side, black king side, black queen side
+  if (board.can_castle_ks[1])
+    key ^= book_random[BookRandomCastle + 0];
+  if (board.can_castle_qs[1])
+    key ^= book_random[BookRandomCastle + 1];
+  if (board.can_castle_ks[0])
+    key ^= book_random[BookRandomCastle + 2];
+  if (board.can_castle_qs[0])
+    key ^= book_random[BookRandomCastle + 3];
+
+  // En passant only counts if there's a pawn that could actually take
+  if (can_take_en_passant(board))
+    key ^= book_random[BookRandomEnPassant + tofile64(board.en_passant_tile)];
+
+  if (board.white_to_move)
+    key ^= book_random[BookRandomTurn];
+
+  return key;
+}
+
+static const ChessPiece book_promotions[] = {
+    ChessPieceNone,   ChessPieceKnight, ChessPieceBishop,
+    ChessPieceCastle, ChessPieceQueen,
+};
+
+static Move book_decode_move(Board board, u16 data)
+{
+  int to_file = data & 7;
+  int to_row = (data >> 3) & 7;
+  int from_file = (data >> 6) & 7;
+  int from_row = (data >> 9) & 7;
+  int promotion = (data >> 12) & 7;
+
+  u8 from = book_square(from_file, from_row);
+  // Castling is written as the king taking its own rook
+  if ((board.state[from] & ChessPieceKing) && from_file == 4 &&
+      from_row == to_row && (to_file == 0 || to_file == 7))
+    to_file = to_file == 7 ? 6 : 2;
+
+  Move move = move_new(from, book_square(to_file, to_row));
+  if (promotion < sizeof(book_promotions) / sizeof(book_promotions[0]))
+    move_set_promotion(&move, book_promotions[promotion]);
+  return move;
+}
+
+static u16 book_encode_move(Board board, Move move)
+{
+  int to_file = tofile64(move.to);
+  int from_file = tofile64(move.from);
+  if ((board.state[move.from] & ChessPieceKing) &&
+      abs(to_file - from_file) == 2)
+    to_file = to_file > from_file ? 7 : 0;
+
+  int promotion = 0;
+  for (int i = 0; i < sizeof(book_promotions) / sizeof(book_promotions[0]);
+       i++)
+    if (move.promo && book_promotions[i] == move_promotion(move))
+      promotion = i;
+
+  return to_file | book_row(move.to) << 3 | from_file << 6 |
+         book_row(move.from) << 9 | promotion << 12;
+}
+
+static bool book_move_is_legal(Board board, Move move)
+{
+  Array moves = board_get_moves(board, move.from, ConsiderChecks);
+  bool legal = false;
+  for (int i = 0; i < moves.capacity; i++)
+  {
+    if (!array_index_is_allocated(&moves, i))
+      continue;
+    if (move_equals(*(Move*)array_get(&moves, i), move))
+      legal = true;
+  }
+  array_free(&moves);
+  return legal;
+}
+
+/// @return A move from the book or the null move if we're out of book
+Move book_probe(Book* book, Board board)
+{
+  Move none = move_new(-1, -1);
+  int ply = (board.fullmove_count - 1) * 2 + (board.white_to_move ? 0 : 1);
+  if (!book || book->nentries == 0 || ply >= book->max_ply)
+    return none;
+
+  // Find the first entry for this position
+  u64 key = book_key(board);
+  size_t lo = 0;
+  size_t hi = book->nentries;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (book_entry(book, mid).key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  u32 max_weight = 0;
+  for (size_t i = lo; i < book->nentries && book_entry(book, i).key == key; i++)
+    if (book_entry(book, i).weight > max_weight)
+      max_weight = book_entry(book, i).weight;
+  if (max_weight == 0)
+    return none;
+
+  // Only moves close enough to the most popular one get a look in
+  u32 min_weight = max_weight * (100 - book->variety) / 100;
+  if (min_weight == 0)
+    min_weight = 1;
+
+  u32 total = 0;
+  for (size_t i = lo; i < book->nentries && book_entry(book, i).key == key; i++)
+    if (book_entry(book, i).weight >= min_weight)
+      total += book_entry(book, i).weight;
+
+  int pick = randrange(0, total - 1);
+  for (size_t i = lo; i < book->nentries && book_entry(book, i).key == key; i++)
+  {
+    BookEntry entry = book_entry(book, i);
+    if (entry.weight < min_weight)
+      continue;
+    pick -= entry.weight;
+    if (pick >= 0)
+      continue;
+
+    Move move = book_decode_move(board, entry.move);
+    // A key collision or a broken book could give us anything
+    if (!book_move_is_legal(board, move))
+    {
+      WLOG("Ignoring illegal book move %s\n", move_tostring(move));
+      return none;
+    }
+    return move;
+  }
+  return none;
+}
+
+static int book_entry_compare(const void* a_ptr, const void* b_ptr)
+{
+  const BookEntry* a = a_ptr;
+  const BookEntry* b = b_ptr;
+  if (a->key != b->key)
+    return a->key < b->key ? -1 : 1;
+  return (int)a->move - (int)b->move;
+}
+
+// Makes a book from a text file with one line of play per line, given as UCI
+// moves from the starting position. Each time a move is played counts
+// towards its weight.
+/// @return 0 on success
+int book_build(char* lines_path, char* book_path, int max_ply)
+{
+  FILE* in = fopen(lines_path, "r");
+  if (!in)
+  {
+    ELOG("Couldn't open %s\n", lines_path);
+    return -1;
+  }
+
+  size_t nentries = 0;
+  size_t cap = 1024;
+  BookEntry* entries = malloc(cap * sizeof(*entries));
+
+  char line[BookLineMax];
+  while (fgets(line, sizeof(line), in))
+  {
+    Board board;
+    board_new(&board,
+              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    int ply = 0;
+    for (char* tok = strtok(line, " \t\r\n"); tok && ply < max_ply;
+         tok = strtok(NULL, " \t\r\n"), ply++)
+    {
+      Move move = move_from_uci(tok);
+      if (move_is_null(move) || !book_move_is_legal(board, move))
+      {
+        WLOG("Skipping rest of line at illegal move %s\n", tok);
+        break;
+      }
+
+      if (nentries == cap)
+      {
+        cap *= 2;
+        entries = realloc(entries, cap * sizeof(*entries));
+      }
+      entries[nentries++] = (BookEntry){
+          .key = book_key(board),
+          .move = book_encode_move(board, move),
+          .weight = 1,
+      };
+      board_update(&board, &move);
+    }
+  }
+  fclose(in);
+
+  // Merge the duplicates, adding up their weights
+  qsort(entries, nentries, sizeof(*entries), book_entry_compare);
+  size_t nmerged = 0;
+  for (size_t i = 0; i < nentries; i++)
+  {
+    BookEntry* last = nmerged ? &entries[nmerged - 1] : NULL;
+    if (last && last->key == entries[i].key && last->move == entries[i].move)
+    {
+      if (last->weight < UINT16_MAX)
+        last->weight++;
+      continue;
+    }
+    entries[nmerged++] = entries[i];
+  }
+
+  FILE* out = fopen(book_path, "wb");
+  if (!out)
+  {
+    ELOG("Couldn't open %s\n", book_path);
+    free(entries);
+    return -1;
+  }
+  for (size_t i = 0; i < nmerged; i++)
+  {
+    byte data[BookEntrySize];
+    write_be(data, entries[i].key, 8);
+    write_be(data + 8, entries[i].move, 2);
+    write_be(data + 10, entries[i].weight, 2);
+    write_be(data + 12, entries[i].learn, 4);
+    fwrite(data, 1, sizeof(data), out);
+  }
+  fclose(out);
+  free(entries);
+
+  ILOG("Wrote %zu book entries to %s\n", nmerged, book_path);
+  return 0;
+}
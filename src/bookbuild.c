@@ -0,0 +1,26 @@
+#include <rgl/logging.h>
+
+#include <chess/book.h>
+#include <chess/defs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Makes an opening book from lines of play, see book_build
+
+int depth = 5;
+
+int main(int argc, char* argv[])
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+
+  if (argc < 3)
+  {
+    fprintf(stderr, "Usage: %s <lines> <book.bin> [max ply]\n", argv[0]);
+    return 1;
+  }
+
+  int max_ply = argc > 3 ? atoi(argv[3]) : BookDefaultMaxPly;
+  return book_build(argv[1], argv[2], max_ply) ? 1 : 0;
+}
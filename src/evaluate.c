@@ -1,4 +1,5 @@
 #include <chess/evaluate.h>
+#include <chess/profile.h>
 
 #include <stdio.h>
 
@@ -182,6 +183,7 @@ int get_piece_value(Board board)
 
 int evaluate_board(Board board)
 {
+  PROFILE_ZONE(ProfileZoneEvaluateBoard);
   int value = 0;
 
   value += get_piece_value(board);
@@ -0,0 +1,456 @@
+#define _GNU_SOURCE // For accept4
+
+#include <rgl/logging.h>
+
+#include <chess/eventloop.h>
+#include <chess/message.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum
+{
+  EventLoopMaxEvents = 64,
+  ListenBacklog = 16,
+};
+
+// Markers so we can tell the listening sockets apart in epoll events
+static int g_listen_in_tag;
+static int g_listen_out_tag;
+
+static int listen_unix(char* path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    ELOG("socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    ELOG("Socket path too long: %s\n", path);
+    close(fd);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  // Clean up after a previous run that didn't exit cleanly
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+      listen(fd, ListenBacklog))
+  {
+    ELOG("Failed to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int epoll_set(int epoll_fd, int op, int fd, void* ptr, bool read)
+{
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLRDHUP | (read ? EPOLLIN : 0);
+  event.data.ptr = ptr;
+  return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+static int epoll_add(int epoll_fd, int fd, void* ptr)
+{
+  return epoll_set(epoll_fd, EPOLL_CTL_ADD, fd, ptr, true);
+}
+
+int eventloop_new(EventLoop* loop, char* requests_path, char* replies_path,
+                  EventLoopCallbacks callbacks)
+{
+  memset(loop, 0, sizeof(*loop));
+  loop->callbacks = callbacks;
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  loop->listen_in = listen_unix(requests_path);
+  loop->listen_out = listen_unix(replies_path);
+  if (loop->epoll_fd < 0 || loop->listen_in < 0 || loop->listen_out < 0)
+    return -1;
+
+  if (epoll_add(loop->epoll_fd, loop->listen_in, &g_listen_in_tag) ||
+      epoll_add(loop->epoll_fd, loop->listen_out, &g_listen_out_tag))
+  {
+    ELOG("epoll_ctl: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Closes the listening sockets and any connections still waiting for their
+// other half. Paired connections belong to whoever on_connect gave them to.
+void eventloop_free(EventLoop* loop)
+{
+  while (loop->pending_in)
+  {
+    Connection* conn = loop->pending_in;
+    loop->pending_in = conn->next;
+    connection_free(conn);
+  }
+  while (loop->pending_out)
+  {
+    Connection* conn = loop->pending_out;
+    loop->pending_out = conn->next;
+    connection_free(conn);
+  }
+  if (loop->listen_in >= 0)
+    close(loop->listen_in);
+  if (loop->listen_out >= 0)
+    close(loop->listen_out);
+  if (loop->epoll_fd >= 0)
+    close(loop->epoll_fd);
+  memset(loop, 0, sizeof(*loop));
+}
+
+static Connection* connection_new(EventLoop* loop)
+{
+  Connection* conn = calloc(1, sizeof(*conn));
+  conn->loop = loop;
+  conn->fd_in = conn->fd_out = -1;
+  conn->epoll_fd = loop->epoll_fd;
+  atomic_init(&conn->paused, false);
+  pthread_mutex_init(&conn->release_lock, NULL);
+  return conn;
+}
+
+void connection_free(Connection* conn)
+{
+  if (conn->fd_in >= 0)
+    close(conn->fd_in);
+  if (conn->fd_out >= 0)
+    close(conn->fd_out);
+  if (conn->ring)
+    ringbuffer_return(conn->ring);
+  pthread_mutex_destroy(&conn->release_lock);
+  free(conn->released);
+  free(conn);
+}
+
+// Start reading again if we stopped because the ring was full
+static void connection_resume(Connection* conn)
+{
+  if (atomic_exchange(&conn->paused, false) && conn->fd_in >= 0)
+    epoll_set(conn->epoll_fd, EPOLL_CTL_MOD, conn->fd_in, conn, true);
+}
+
+// Where a message handed out from the ring starts, counted like head and tail.
+// Unreleased messages all lie within size bytes after the tail so we can work
+// it out from the data pointer.
+static u64 connection_message_pos(Connection* conn, Message mess, u64 tail)
+{
+  RingBuffer* ring = conn->ring;
+  size_t data_offset = mess.data - ring->base;
+  size_t offset =
+      (data_offset + ring->size - sizeof(MessageHeader)) % ring->size;
+  return tail + (offset + ring->size - tail % ring->size) % ring->size;
+}
+
+void connection_release(Connection* conn, Message mess)
+{
+  RingBuffer* ring = conn->ring;
+  pthread_mutex_lock(&conn->release_lock);
+
+  u64 tail = atomic_load(&ring->tail);
+  RingSpan span;
+  span.start = connection_message_pos(conn, mess, tail);
+  span.end = span.start + sizeof(MessageHeader) + mess.len;
+
+  if (span.start != tail)
+  {
+    // Something before it is still being handled
+    if (conn->nreleased == conn->released_cap)
+    {
+      conn->released_cap = conn->released_cap ? conn->released_cap * 2 : 16;
+      conn->released = realloc(conn->released,
+                               conn->released_cap * sizeof(*conn->released));
+    }
+    conn->released[conn->nreleased++] = span;
+    pthread_mutex_unlock(&conn->release_lock);
+    return;
+  }
+
+  // Take in any spans this one joins up with
+  tail = span.end;
+  for (size_t i = 0; i < conn->nreleased;)
+  {
+    if (conn->released[i].start != tail)
+    {
+      i++;
+      continue;
+    }
+    tail = conn->released[i].end;
+    conn->released[i] = conn->released[--conn->nreleased];
+    i = 0;
+  }
+  atomic_store(&ring->tail, tail);
+
+  pthread_mutex_unlock(&conn->release_lock);
+  connection_resume(conn);
+}
+
+static void list_remove(Connection** list, Connection* conn)
+{
+  for (; *list; list = &(*list)->next)
+  {
+    if (*list == conn)
+    {
+      *list = conn->next;
+      return;
+    }
+  }
+}
+
+static void list_append(Connection** list, Connection* conn)
+{
+  while (*list)
+    list = &(*list)->next;
+  *list = conn;
+}
+
+// Match up the oldest requests and replies connections
+static void eventloop_pair(EventLoop* loop)
+{
+  while (loop->pending_in && loop->pending_out)
+  {
+    Connection* conn = loop->pending_in;
+    Connection* out = loop->pending_out;
+    loop->pending_in = conn->next;
+    loop->pending_out = out->next;
+    conn->next = NULL;
+
+    // Replies are written from the worker threads which should block rather
+    // than spin if the client is slow to read
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, out->fd_out, NULL);
+    fcntl(out->fd_out, F_SETFL, fcntl(out->fd_out, F_GETFL) & ~O_NONBLOCK);
+    conn->fd_out = out->fd_out;
+    out->fd_out = -1;
+    connection_free(out);
+
+    loop->callbacks.on_connect(conn);
+    epoll_set(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd_in, conn, true);
+  }
+}
+
+static void eventloop_accept(EventLoop* loop, bool requests)
+{
+  int listen_fd = requests ? loop->listen_in : loop->listen_out;
+  for (;;)
+  {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        ELOG("accept: %s\n", strerror(errno));
+      break;
+    }
+
+    Connection* conn = connection_new(loop);
+    if (requests)
+    {
+      conn->fd_in = fd;
+      conn->ring = ringbuffer_acquire();
+      if (!conn->ring)
+      {
+        connection_free(conn); // Closes fd too
+        continue;
+      }
+    }
+    else
+      conn->fd_out = fd;
+    // Only watch for hangups until we know which client this is
+    epoll_set(loop->epoll_fd, EPOLL_CTL_ADD, fd, conn, false);
+    list_append(requests ? &loop->pending_in : &loop->pending_out, conn);
+  }
+
+  eventloop_pair(loop);
+}
+
+static void eventloop_close(EventLoop* loop, Connection* conn)
+{
+  int fd = conn->fd_in >= 0 ? conn->fd_in : conn->fd_out;
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+  // Still waiting to be paired so nobody else knows about it
+  if (!conn->userdata)
+  {
+    list_remove(&loop->pending_in, conn);
+    list_remove(&loop->pending_out, conn);
+    connection_free(conn);
+    return;
+  }
+
+  // The socket is closed by connection_free. Handlers may still be running
+  // and releasing messages, so the fd mustn't be reused before then.
+  loop->callbacks.on_close(conn);
+}
+
+/// Hands every complete message in the ring to on_message
+/// @return false if the client sent something we can't handle
+static bool eventloop_dispatch(EventLoop* loop, Connection* conn)
+{
+  RingBuffer* ring = conn->ring;
+  while (ring->head - conn->parsed >= sizeof(MessageHeader))
+  {
+    MessageHeader header;
+    memcpy(&header, ringbuffer_at(ring, conn->parsed), sizeof(header));
+
+    // It would never fit so we'd wait forever
+    if (header.len > ring->size - sizeof(header))
+    {
+      ELOG("Message too large (%u bytes)\n", header.len);
+      return false;
+    }
+    if (ring->head - conn->parsed - sizeof(header) < header.len)
+      break;
+
+    byte* data = ringbuffer_at(ring, conn->parsed + sizeof(header));
+    Message mess = message_from_header(header, data);
+    conn->parsed += sizeof(header) + header.len;
+
+    message_log(mess);
+    loop->callbacks.on_message(conn, mess);
+  }
+  return true;
+}
+
+/// @return false if the connection was closed
+static bool eventloop_read(EventLoop* loop, Connection* conn)
+{
+  RingBuffer* ring = conn->ring;
+  for (;;)
+  {
+    size_t space = ringbuffer_free_space(ring);
+    if (space == 0)
+    {
+      // Stop watching the socket until a handler gives us some room back. If
+      // one did so while we were pausing then carry on.
+      atomic_store(&conn->paused, true);
+      epoll_set(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd_in, conn, false);
+      if (ringbuffer_free_space(ring) == 0)
+        break;
+      connection_resume(conn);
+      continue;
+    }
+
+    ssize_t n = read(conn->fd_in, ringbuffer_at(ring, ring->head), space);
+    if (n > 0)
+    {
+      ring->head += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+
+    if (n < 0)
+      ELOG("read: %s\n", strerror(errno));
+    return false;
+  }
+
+  return eventloop_dispatch(loop, conn);
+}
+
+/// Waits up to timeout_ms, or forever if it's -1, for something to happen and
+/// handles it
+/// @return The number of events handled, or -1 if we can't wait any more
+int eventloop_run_once(EventLoop* loop, int timeout_ms)
+{
+  struct epoll_event events[EventLoopMaxEvents];
+  int nevents =
+      epoll_wait(loop->epoll_fd, events, EventLoopMaxEvents, timeout_ms);
+  if (nevents < 0)
+  {
+    if (errno == EINTR)
+      return 0;
+    ELOG("epoll_wait: %s\n", strerror(errno));
+    return -1;
+  }
+
+  for (int i = 0; i < nevents; i++)
+  {
+    void* ptr = events[i].data.ptr;
+    if (ptr == &g_listen_in_tag || ptr == &g_listen_out_tag)
+    {
+      eventloop_accept(loop, ptr == &g_listen_in_tag);
+      continue;
+    }
+
+    Connection* conn = ptr;
+    bool open = true;
+    // Read whatever is left before looking at hangups so we don't drop the
+    // last requests a client sent
+    if (conn->fd_in >= 0 && (events[i].events & EPOLLIN))
+      open = eventloop_read(loop, conn);
+    if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+      open = false;
+
+    if (!open)
+      eventloop_close(loop, conn);
+  }
+  return nevents;
+}
+
+void eventloop_run(EventLoop* loop)
+{
+  while (eventloop_run_once(loop, -1) >= 0)
+    ;
+}
+
+/// Writes the header and data in one go
+/// @return 0 on success
+int connection_send(Connection* conn, Message mess)
+{
+  MessageHeader header = message_header(mess);
+  struct iovec iov[] = {
+      {.iov_base = &header, .iov_len = sizeof(header)},
+      {.iov_base = mess.data, .iov_len = mess.len},
+  };
+  struct msghdr msg = {
+      .msg_iov = iov,
+      .msg_iovlen = mess.len ? 2 : 1,
+  };
+
+  // The kernel can write less than we asked, keep going from where it stopped
+  while (msg.msg_iovlen > 0)
+  {
+    ssize_t n = sendmsg(conn->fd_out, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      ELOG("sendmsg: %s\n", strerror(errno));
+      return -1;
+    }
+
+    while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len)
+    {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0)
+    {
+      msg.msg_iov->iov_base = (byte*)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+
+  message_log(mess);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <chess/hash.h>
+
+// Zobrist keys. These are generated from a fixed seed so that hashes are the
+// same between runs.
+u64 zobrist_pieces[12][64];
+u64 zobrist_castle_qs[2];
+u64 zobrist_castle_ks[2];
+u64 zobrist_en_passant[64];
+u64 zobrist_white_to_move;
+
+static u64 zobrist_next(u64* state)
+{
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+__attribute__((constructor))
+void zobrist_init()
+{
+  u64 state = 0x9E3779B97F4A7C15ULL;
+  for (int i = 0; i < 12; i++)
+    for (int j = 0; j < 64; j++)
+      zobrist_pieces[i][j] = zobrist_next(&state);
+  for (int i = 0; i < 2; i++)
+  {
+    zobrist_castle_qs[i] = zobrist_next(&state);
+    zobrist_castle_ks[i] = zobrist_next(&state);
+  }
+  for (int i = 0; i < 64; i++)
+    zobrist_en_passant[i] = zobrist_next(&state);
+  zobrist_white_to_move = zobrist_next(&state);
+}
+
+// Index into zobrist_pieces, black pieces first
+static int piece_index(ChessPiece piece)
+{
+  int type = __builtin_ctz(piece & ~ChessPieceIsWhite);
+  return type + ((piece & ChessPieceIsWhite) ? 6 : 0);
+}
+
+u64 board_hash(Board board)
+{
+  u64 hash = 0;
+  for (int i = 0; i < 64; i++)
+    if (board.state[i] != ChessPieceNone)
+      hash ^= zobrist_pieces[piece_index(board.state[i])][i];
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (board.can_castle_qs[i])
+      hash ^= zobrist_castle_qs[i];
+    if (board.can_castle_ks[i])
+      hash ^= zobrist_castle_ks[i];
+  }
+
+  if (board.en_passant_tile >= 0 && board.en_passant_tile < 64)
+    hash ^= zobrist_en_passant[board.en_passant_tile];
+
+  if (board.white_to_move)
+    hash ^= zobrist_white_to_move;
+
+  return hash;
+}
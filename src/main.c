@@ -2,21 +2,26 @@
 #define _USE_MATH_DEFINES
 
 #include <rgl/logging.h>
-#include <rgl/threadpool.h>
 #include <rgl/util.h>
 
+#include <chess/book.h>
 #include <chess/defs.h>
 #include <chess/evaluate.h>
 #include <chess/matrix.h>
 #include <chess/message.h>
 #include <chess/move.h>
+#include <chess/resultcache.h>
+#include <chess/scheduler.h>
 #include <chess/search.h>
+#include <chess/server.h>
+#include <chess/tablebase.h>
 #include <chess/tree.h>
 #include <chess/util.h>
 
 #include <assert.h>
 #include <ipc/socket.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -50,191 +55,57 @@ void signal_handler(int sig)
 
 static Array g_logger_streams;
 
-typedef struct
+static Scheduler g_scheduler;
+static Book g_book;
+static Tablebase g_tb;
+static ResultCache g_results;
+static Server g_server = {
+    .scheduler = &g_scheduler,
+    .start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+};
+
+// Results since the last save would be lost otherwise
+static void save_results()
 {
-  Message mess_in;
-  Board* board;
-  Socket sock_in;
-  Socket sock_out;
-  Move* player_move; // The last move made by the player
-} MessageHandlerArgs;
+  if (g_server.results && g_results.path)
+    result_cache_save(&g_results);
+}
 
-void* message_handler(void* void_args)
+#ifndef _WIN32
+// SIGINT and SIGTERM are blocked on every other thread, so they land here
+// rather than interrupting a thread that might hold the result cache's lock
+static void* signal_thread(void* arg)
 {
-  static _Thread_local bool did_thread_setup = false;
-  if (!did_thread_setup)
-  {
-    rgl_logger_thread_setup();
-    for (int i = 0; i < g_logger_streams.capacity; i++)
-    {
-      if (!array_index_is_allocated(&g_logger_streams, i))
-        continue;
-
-      LoggerStream ls = *(LoggerStream*)array_get(&g_logger_streams, i);
-      if (ls.stream)
-        rgl_logger_thread_add_stream(ls.stream);
-      if (ls.filename)
-        rgl_logger_thread_add_file(ls.filename);
-    }
-    did_thread_setup = true;
-  }
+  sigset_t* signals = arg;
+  int sig;
+  if (sigwait(signals, &sig))
+    return NULL;
+  ILOG("Exiting on signal %d\n", sig);
+  save_results();
+  exit(0);
+}
+#endif
 
-  MessageHandlerArgs args = *(MessageHandlerArgs*)void_args;
-  Message mess_in = args.mess_in;
-  Message mess_out;
-  Board* board = args.board;
-  Socket sock_in = args.sock_in;
-  Socket sock_out = args.sock_out;
-  Move* player_move = args.player_move;
+// New threads need to inherit the logger streams set up in main
+static void logger_thread_setup()
+{
+  static _Thread_local bool did_thread_setup = false;
+  if (did_thread_setup)
+    return;
 
-  Move move;
-  Array moves;
-  memset(&moves, 0, sizeof(moves));
-  Board board_cpy = *board;
-  switch (mess_in.type)
+  rgl_logger_thread_setup();
+  for (int i = 0; i < g_logger_streams.capacity; i++)
   {
-  case MessageTypeLegalMoveRequest:
-    mess_out.type = MessageTypeLegalMoveReply;
-    mess_out.len = sizeof(int);
-    mess_out.data = malloc(sizeof(int));
-    int response = 0;
-    move = *(Move*)mess_in.data;
-    moves = board_get_moves(*board, move.from, ConsiderChecks);
-    for (int i = 0; i < moves.capacity; i++)
-    {
-      if (!array_index_is_allocated(&moves, i))
-        continue;
-      if (array_get_as(&moves, i, Move).from == move.from &&
-          array_get_as(&moves, i, Move).to == move.to)
-        response = 1;
-    }
-
-    memcpy(mess_out.data, &response, sizeof(int));
-    break;
-
-  case MessageTypeMakeMoveRequest:
-    mess_out.type = MessageTypeMakeMoveReply;
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    Move tmp = *(Move*)mess_in.data;
-    move = move_new(tmp.from, tmp.to);
-    ILOG("Client move: %s\n", move_tostring(move));
-    *player_move = move;
-    board_update(board, &move);
-    ILOG("Board Updated:\n%s\n", board_tostring(*board));
-    break;
-
-  case MessageTypeBestMoveRequest:
-    mess_out.type = MessageTypeBestMoveReply;
-    mess_out.len = sizeof(Move);
-    mess_out.data = malloc(mess_out.len);
-    Node* server_root = node_new(NULL, *player_move, false);
-    Tree* server_tree = tree_new(server_root, *board, depth);
-    move = search(server_tree);
-    tree_free(&server_tree);
-    board_update(board, &move);
-    ILOG("Server move: %s\n", move_tostring(move));
-    ILOG("Board Updated:\n%s\n", board_tostring(*board));
-    memcpy(mess_out.data, &move, mess_out.len);
-    break;
-
-  case MessageTypeBoardStateRequest:
-    mess_out.type = MessageTypeBoardStateReply;
-    mess_out.len = sizeof(board->state);
-    mess_out.data = malloc(mess_out.len);
-    memcpy(mess_out.data, board->state, mess_out.len);
-    break;
-
-  case MessageTypeGetMovesRequest:
-    mess_out.type = MessageTypeGetMovesReply;
-    int pos = *(int*)mess_in.data;
-    moves = board_get_moves(*board, pos, ConsiderChecks);
-    mess_out.len = moves.used * sizeof(Move);
-    mess_out.data = malloc(mess_out.len);
-    u64 written = 0;
-    for (int i = 0; i < moves.capacity; i++)
-    {
-      if (!array_index_is_allocated(&moves, i))
-        continue;
-      memcpy(mess_out.data + written, array_get(&moves, i), moves.data_size);
-      written += moves.data_size;
-    }
-    break;
-
-  // Sets the board from a FEN string
-  case MessageTypeSetBoardRequest:
-    mess_out.type = MessageTypeSetBoardReply;
-    char* fen = (char*)mess_in.data;
-    board_new(board, fen);
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    ILOG("Board Set:\n%s\n", board_tostring(*board));
-    break;
-
-  // @@FIXME This will mess up precomputation since promoting after move.
-  case MessageTypePromotionRequest:
-    mess_out.type = MessageTypePromotionReply;
-    ChessPiece piece = *(ChessPiece*)mess_in.data;
-    ILOG("Promoting to: %d\n", piece);
-    for (int i = 0; i < 8; i++)
-      if (board->state[i] & ChessPiecePawn)
-        board->state[i] = piece | (board->state[i] & ChessPieceIsWhite);
-    for (int i = topos64(0x70); i < 64; i++)
-      if (board->state[i] & ChessPiecePawn)
-        board->state[i] = piece | (board->state[i] & ChessPieceIsWhite);
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    ILOG("Board Promotion:\n%s\n", board_tostring(*board));
-    break;
-  case MessageTypeIsInCheckRequest:
-    mess_out.type = MessageTypeIsInCheckReply;
-    mess_out.len = 2;
-    mess_out.data = malloc(mess_out.len);
-    mess_out.data[0] = is_in_check(*board, true);
-    mess_out.data[1] = is_in_check(*board, false);
-    break;
-
-  case MessageTypeIsInCheckmateRequest:
-    if (mess_in.len != 1)
-      ELOG("MessageTypeIsInCheckmateRequest does not have length of 1.");
-    bool is_white = mess_in.data[0];
-    mess_out.type = MessageTypeIsInCheckmateReply;
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    mess_out.data[0] = is_in_checkmate(*board, is_white);
-    break;
-  case MessageTypeIsInStalemateRequest:
-    if (mess_in.len != 1)
-      ELOG("MessageTypeIsInCheckmateRequest does not have length of 1.");
-    is_white = mess_in.data[0];
-    mess_out.type = MessageTypeIsInStalemateReply;
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    mess_out.data[0] = is_in_stalemate(*board, is_white);
-    break;
-
-  case MessageTypeCheckInfoRequest:
-    if (mess_in.len != 1)
-      ELOG("MessageTypeCheckInfoRequest does not have length of 1.");
-    is_white = mess_in.data[0];
-    mess_out.type = MessageTypeCheckInfoReply;
-    mess_out.len = 1;
-    mess_out.data = malloc(mess_out.len);
-    mess_out.data[0] = get_check_info(*board, is_white);
-    break;
+    if (!array_index_is_allocated(&g_logger_streams, i))
+      continue;
 
-  default:
-    WLOG("Unknown message type %d\n", mess_in.type);
-    break;
+    LoggerStream ls = *(LoggerStream*)array_get(&g_logger_streams, i);
+    if (ls.stream)
+      rgl_logger_thread_add_stream(ls.stream);
+    if (ls.filename)
+      rgl_logger_thread_add_file(ls.filename);
   }
-
-  memcpy(mess_out.guid, mess_in.guid, sizeof(mess_in.guid));
-  message_send(mess_out, &sock_out);
-  free(mess_out.data);
-  free(mess_in.data);
-  array_free(&moves);
-  free(void_args);
-  return NULL;
+  did_thread_setup = true;
 }
 
 int main(int argc, char* argv[])
@@ -268,56 +139,83 @@ int main(int argc, char* argv[])
   }
   // }}}
 
-  ThreadPool pool;
-  threadpool_new(&pool, 4);
-
-  ipcError err = 0;
-  Socket sock_in;
-  Socket sock_out;
-  socket_init(&sock_in, get_dotnet_pipe_name("ChessIPC_Requests"), SocketServer);
-  socket_init(&sock_out, get_dotnet_pipe_name("ChessIPC_Replies"), SocketServer);
-
-  Board board;
-  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-
-  DLOG("\n%s\n", board_tostring(board));
-  bool isWhitesTurn = true;
-
-  for (;;)
+  char* book_path = NULL;
+  int book_depth = BookDefaultMaxPly;
+  int book_variety = BookDefaultVariety;
+  char* tb_path = NULL;
+  int tb_max_pieces = TablebaseMaxPieces;
+  int results_mb = ResultCacheDefaultMb;
+  char* results_path = NULL;
+  int nworkers = SchedulerDefaultWorkers;
+  int nsearch = SchedulerDefaultWorkers - 1;
+  for (int i = 1; i + 1 < argc; i += 2)
   {
-    while (socket_connect(&sock_in))
-      sleep_ms(200);
-    while (socket_connect(&sock_out))
-      sleep_ms(200);
-
-    board_new(&board,
-              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-    Move player_move;
-
-    for (;;)
-    {
-      if (!socket_is_connected(&sock_in) || !socket_is_connected(&sock_out))
-      {
-        ELOG("Socket lost connection\n");
-        break;
-      }
-
-      Message mess_in, mess_out;
-      message_receive(&mess_in, &sock_in);
-
-      MessageHandlerArgs* args = calloc(1, sizeof(*args));
-      args->board = &board;
-      args->mess_in = mess_in;
-      args->player_move = &player_move;
-      args->sock_in = sock_in;
-      args->sock_out = sock_out;
-
-      Task* handle_message = task_new(NULL, message_handler, args);
-      handle_message->free_on_complete = true;
-
-      threadpool_queue_task(&pool, handle_message);
-    }
+    if (strcmp(argv[i], "--book") == 0)
+      book_path = argv[i + 1];
+    else if (strcmp(argv[i], "--book-depth") == 0)
+      book_depth = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--book-variety") == 0)
+      book_variety = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--tb-path") == 0)
+      tb_path = argv[i + 1];
+    else if (strcmp(argv[i], "--tb-pieces") == 0)
+      tb_max_pieces = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--result-cache") == 0)
+      results_mb = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--result-cache-file") == 0)
+      results_path = argv[i + 1];
+    else if (strcmp(argv[i], "--workers") == 0)
+      nworkers = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--search-workers") == 0)
+      nsearch = atoi(argv[i + 1]);
+    else
+      WLOG("Unknown argument %s\n", argv[i]);
+  }
+  if (book_path && !book_open(&g_book, book_path))
+  {
+    g_server.book = &g_book;
+    g_book.max_ply = book_depth;
+    g_book.variety = book_variety;
+  }
+  // Tables are only mapped once a game gets down to them
+  if (tb_path)
+  {
+    tablebase_new(&g_tb, tb_path);
+    g_tb.max_pieces = tb_max_pieces;
+    g_server.tb = &g_tb;
+  }
+  // Sized 0 turns it off
+  if (results_mb > 0)
+  {
+    result_cache_new(&g_results, results_mb);
+    if (results_path)
+      result_cache_load(&g_results, results_path);
+    g_server.results = &g_results;
   }
 
-  return 0;
+#ifndef _WIN32
+  // Threads inherit the mask, so this has to come before any are started
+  static sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  pthread_t signal_waiter;
+  pthread_create(&signal_waiter, NULL, signal_thread, &signals);
+  pthread_detach(signal_waiter);
+#endif
+
+  scheduler_new(&g_scheduler, nworkers, nsearch);
+  g_server.depth = depth;
+  g_server.thread_setup = logger_thread_setup;
+
+  // Every client that connects gets its own session
+  char* requests_name = get_dotnet_pipe_name("ChessIPC_Requests");
+  char* replies_name = get_dotnet_pipe_name("ChessIPC_Replies");
+  int rv = server_run(&g_server, requests_name, replies_name) ? 1 : 0;
+
+  save_results();
+  if (g_server.results)
+    result_cache_free(&g_results);
+  return rv;
 }
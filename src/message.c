@@ -3,32 +3,53 @@
 
 #include <chess/defs.h>
 #include <chess/message.h>
+#include <chess/move.h>
 #include <chess/util.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 enum
 {
   MessageSleepMs = 1
 };
 
+MessageHeader message_header(Message mess)
+{
+  MessageHeader header = {
+      .len = mess.len,
+      .type = mess.type,
+  };
+  memcpy(header.guid, mess.guid, sizeof(header.guid));
+  return header;
+}
+
+Message message_from_header(MessageHeader header, byte* data)
+{
+  Message mess = {
+      .len = header.len,
+      .type = header.type,
+      .data = data,
+  };
+  memcpy(mess.guid, header.guid, sizeof(mess.guid));
+  return mess;
+}
+
 ipcError message_receive(Message* mess, Socket* sock)
 {
   ipcError more_data = ipcErrorSocketHasMoreData;
 
-  int bytes_to_read = sizeof(*mess) - sizeof(mess->data);
-  while (socket_read_bytes(sock, mess, bytes_to_read) == more_data)
+  MessageHeader header;
+  while (socket_read_bytes(sock, &header, sizeof(header)) == more_data)
     sleep_ms(MessageSleepMs);
 
-  mess->data = calloc(mess->len, 1);
+  *mess = message_from_header(header, calloc(header.len, 1));
 
   if (mess->len > 0)
     while (socket_read_bytes(sock, mess->data, mess->len) == more_data)
       sleep_ms(MessageSleepMs);
 
-  DLOG("Message data (%s) (len: %d): ", messagetype_tostring(mess->type),
-       mess->len);
-  for (int i = 0; i < mess->len; i++)
-    DPRINT("%d ", mess->data[i]);
-  DPRINT("\n");
+  message_log(*mess);
   return ipcErrorNone;
 }
 
@@ -36,21 +57,26 @@ ipcError message_send(Message mess, Socket* sock)
 {
   ipcError more_data = ipcErrorSocketHasMoreData;
 
-  int bytes_to_write = sizeof(mess) - sizeof(mess.data);
-  while (socket_write_bytes(sock, &mess, bytes_to_write) == more_data)
+  MessageHeader header = message_header(mess);
+  while (socket_write_bytes(sock, &header, sizeof(header)) == more_data)
     sleep_ms(MessageSleepMs);
 
   if (mess.len > 0)
     while (socket_write_bytes(sock, mess.data, mess.len) == more_data)
       sleep_ms(MessageSleepMs);
 
+  message_log(mess);
+
+  return ipcErrorNone;
+}
+
+void message_log(Message mess)
+{
   DLOG("Message data (%s) (len: %d): ", messagetype_tostring(mess.type),
        mess.len);
   for (int i = 0; i < mess.len; i++)
     DPRINT("%d ", mess.data[i]);
   DPRINT("\n");
-
-  return ipcErrorNone;
 }
 
 char* messagetype_tostring(MessageType type)
@@ -101,6 +127,40 @@ char* messagetype_tostring(MessageType type)
       return "CheckInfoRequest";
     case MessageTypeCheckInfoReply:
       return "CheckInfoReply";
+    case MessageTypeGetAllMovesRequest:
+      return "GetAllMovesRequest";
+    case MessageTypeGetAllMovesReply:
+      return "GetAllMovesReply";
+    case MessageTypeCheckInfoBothRequest:
+      return "CheckInfoBothRequest";
+    case MessageTypeCheckInfoBothReply:
+      return "CheckInfoBothReply";
+    case MessageTypeEvaluateRequest:
+      return "EvaluateRequest";
+    case MessageTypeEvaluateReply:
+      return "EvaluateReply";
+    case MessageTypeSearchStatsRequest:
+      return "SearchStatsRequest";
+    case MessageTypeSearchStatsReply:
+      return "SearchStatsReply";
+    case MessageTypeProfileReportRequest:
+      return "ProfileReportRequest";
+    case MessageTypeProfileReportReply:
+      return "ProfileReportReply";
+    case MessageTypeResultCacheStatsRequest:
+      return "ResultCacheStatsRequest";
+    case MessageTypeResultCacheStatsReply:
+      return "ResultCacheStatsReply";
+    case MessageTypeSchedulerStatsRequest:
+      return "SchedulerStatsRequest";
+    case MessageTypeSchedulerStatsReply:
+      return "SchedulerStatsReply";
+    case MessageTypeStopSearchRequest:
+      return "StopSearchRequest";
+    case MessageTypeStopSearchReply:
+      return "StopSearchReply";
+    case MessageTypeSearchInfo:
+      return "SearchInfo";
 
     default:
       break;
@@ -108,3 +168,62 @@ char* messagetype_tostring(MessageType type)
 
   return "Unknown MessageType";
 }
+
+WireMove message_move_to_wire(Move move)
+{
+  WireMove wire = {0};
+  wire.from = move_is_null(move) ? 255 : move.from;
+  wire.to = move_is_null(move) ? 255 : move.to;
+  wire.promotion = move_promotion(move);
+  return wire;
+}
+
+// data may not be aligned
+/// @return The null move if the promotion isn't a single piece a pawn can
+/// become
+Move message_move_from_wire(byte* data)
+{
+  WireMove wire;
+  memcpy(&wire, data, sizeof(wire));
+  s32 promotion = wire.promotion & ~ChessPieceIsWhite;
+  if ((promotion & ~(ChessPieceKnight | ChessPieceBishop | ChessPieceCastle |
+                     ChessPieceQueen)) ||
+      (promotion & (promotion - 1)))
+    return move_new(-1, -1);
+
+  Move move = move_new(wire.from, wire.to);
+  move_set_promotion(&move, wire.promotion);
+  return move;
+}
+
+// A whole int for each square like Board used to have, sizeof(s32) * 64 bytes
+void message_board_state_to_wire(Board board, byte* data)
+{
+  for (int i = 0; i < 64; i++)
+  {
+    s32 piece = board.state[i];
+    memcpy(data + i * sizeof(piece), &piece, sizeof(piece));
+  }
+}
+
+// data needs room for a WireSearchInfo and SearchMaxPly WireMoves
+/// @return The number of bytes written
+u32 message_search_info_to_wire(SearchInfo* info, byte* data)
+{
+  WireSearchInfo wire = {
+      .depth = info->depth,
+      .value = info->value,
+      .nodes = info->nodes,
+      .nps = info->nodes * 1000 / (info->time_ms ? info->time_ms : 1),
+      .time_ms = info->time_ms,
+      .pv_len = info->pv_len,
+  };
+  memcpy(data, &wire, sizeof(wire));
+  u32 len = sizeof(wire);
+  for (int i = 0; i < info->pv_len; i++, len += sizeof(WireMove))
+  {
+    WireMove move = message_move_to_wire(info->pv[i]);
+    memcpy(data + len, &move, sizeof(move));
+  }
+  return len;
+}
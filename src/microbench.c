@@ -0,0 +1,387 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/defs.h>
+#include <chess/evaluate.h>
+#include <chess/move.h>
+#include <chess/positions.h>
+#include <chess/util.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times the board primitives one at a time over the bench positions.
+//
+// Each repetition runs a primitive over every position and gives one sample,
+// the average time per call. After the warm-up repetitions are thrown away
+// we report percentiles of the samples as JSON, one benchmark per line. Given
+// the JSON from an earlier run as a baseline, any benchmark whose median got
+// slower by more than the threshold makes us exit with 1 so CI can flag it.
+
+int depth = 5;
+
+enum
+{
+  MicroDefaultReps = 30,
+  MicroDefaultWarmup = 3,
+  MicroDefaultThresholdPercent = 10,
+};
+
+typedef struct
+{
+  char* fen;
+  Board board;
+  Move* moves; // Legal moves for the side to move
+  int nmoves;
+} MicroPosition;
+
+typedef struct
+{
+  char* name;
+  // Runs the primitive over every position
+  /// @return The number of calls made
+  u64 (*run)(MicroPosition* positions, int npositions, ChessPiece piece);
+  ChessPiece piece; // For board_get_moves, which piece to ask about
+} MicroBench;
+
+typedef struct
+{
+  u64 ops; // Calls per repetition
+  double min, median, p90, p99, mean;
+} MicroResult;
+
+// Results go in here so the compiler can't throw the calls away
+static volatile u64 g_sink;
+
+static u64 micro_board_update(MicroPosition* positions, int npositions,
+                              ChessPiece piece)
+{
+  u64 ops = 0;
+  for (int i = 0; i < npositions; i++)
+  {
+    for (int j = 0; j < positions[i].nmoves; j++)
+    {
+      Board board = positions[i].board;
+      board_update(&board, &positions[i].moves[j]);
+      g_sink += board.white_to_move;
+      ops++;
+    }
+  }
+  return ops;
+}
+
+static u64 micro_board_get_moves(MicroPosition* positions, int npositions,
+                                 ChessPiece piece)
+{
+  u64 ops = 0;
+  for (int i = 0; i < npositions; i++)
+  {
+    for (int pos = 0; pos < 64; pos++)
+    {
+      if (!(positions[i].board.state[pos] & piece))
+        continue;
+      Array moves = board_get_moves(positions[i].board, pos, ConsiderChecks);
+      g_sink += moves.used;
+      array_free(&moves);
+      ops++;
+    }
+  }
+  return ops;
+}
+
+static u64 micro_board_get_moves_all(MicroPosition* positions,
+                                     int npositions, ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+  {
+    Board board = positions[i].board;
+    Array moves = board_get_moves_all(
+        board, board.white_to_move ? GetMovesWhite : GetMovesBlack);
+    g_sink += moves.used;
+    array_free(&moves);
+  }
+  return npositions;
+}
+
+static u64 micro_is_in_check(MicroPosition* positions, int npositions,
+                             ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+    g_sink += is_in_check(positions[i].board,
+                          positions[i].board.white_to_move);
+  return npositions;
+}
+
+static u64 micro_get_check_info(MicroPosition* positions, int npositions,
+                                ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+    g_sink += get_check_info(positions[i].board,
+                             positions[i].board.white_to_move);
+  return npositions;
+}
+
+static u64 micro_evaluate_board(MicroPosition* positions, int npositions,
+                                ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+    g_sink += evaluate_board(positions[i].board);
+  return npositions;
+}
+
+// parse_fen is only reachable through board_new
+static u64 micro_parse_fen(MicroPosition* positions, int npositions,
+                           ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+  {
+    Board board;
+    board_new(&board, positions[i].fen);
+    g_sink += board.white_to_move;
+  }
+  return npositions;
+}
+
+static u64 micro_board_tostring(MicroPosition* positions, int npositions,
+                                ChessPiece piece)
+{
+  for (int i = 0; i < npositions; i++)
+  {
+    char* str = board_tostring(positions[i].board);
+    g_sink += str[0];
+    free(str);
+  }
+  return npositions;
+}
+
+static MicroBench micro_benches[] = {
+    {"board_update", micro_board_update},
+    {"board_get_moves_pawn", micro_board_get_moves, ChessPiecePawn},
+    {"board_get_moves_knight", micro_board_get_moves, ChessPieceKnight},
+    {"board_get_moves_bishop", micro_board_get_moves, ChessPieceBishop},
+    {"board_get_moves_castle", micro_board_get_moves, ChessPieceCastle},
+    {"board_get_moves_queen", micro_board_get_moves, ChessPieceQueen},
+    {"board_get_moves_king", micro_board_get_moves, ChessPieceKing},
+    {"board_get_moves_all", micro_board_get_moves_all},
+    {"is_in_check", micro_is_in_check},
+    {"get_check_info", micro_get_check_info},
+    {"evaluate_board", micro_evaluate_board},
+    {"parse_fen", micro_parse_fen},
+    {"board_tostring", micro_board_tostring},
+};
+
+enum
+{
+  MicroBenchCount = sizeof(micro_benches) / sizeof(*micro_benches),
+};
+
+static void usage(char* name)
+{
+  fprintf(stderr,
+          "Usage: %s [-o output] [--reps n] [--warmup n]\n"
+          "          [--baseline file] [--threshold percent]\n",
+          name);
+}
+
+static int micro_compare_doubles(const void* a, const void* b)
+{
+  double x = *(double*)a;
+  double y = *(double*)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest rank on sorted samples
+static double micro_percentile(double* samples, int n, double p)
+{
+  int rank = (int)ceil(p * n);
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static MicroResult micro_run(MicroBench* bench, MicroPosition* positions,
+                             int npositions, int reps, int warmup)
+{
+  MicroResult result = {0};
+  double* samples = malloc(reps * sizeof(*samples));
+  for (int i = 0; i < warmup + reps; i++)
+  {
+    u64 start = get_time_ns();
+    u64 ops = bench->run(positions, npositions, bench->piece);
+    u64 ns = get_time_ns() - start;
+    if (i < warmup)
+      continue;
+    result.ops = ops;
+    samples[i - warmup] = ops ? (double)ns / ops : 0;
+  }
+
+  qsort(samples, reps, sizeof(*samples), micro_compare_doubles);
+  for (int i = 0; i < reps; i++)
+    result.mean += samples[i] / reps;
+  result.min = samples[0];
+  result.median = micro_percentile(samples, reps, 0.5);
+  result.p90 = micro_percentile(samples, reps, 0.9);
+  result.p99 = micro_percentile(samples, reps, 0.99);
+  free(samples);
+  return result;
+}
+
+static void micro_write_json(FILE* out, MicroResult* results, int reps,
+                             int warmup)
+{
+  fprintf(out, "{\"reps\":%d,\"warmup\":%d,\"positions\":%d,\"benchmarks\":[\n",
+          reps, warmup, bench_npositions);
+  for (int i = 0; i < MicroBenchCount; i++)
+  {
+    MicroResult* r = &results[i];
+    fprintf(out,
+            "{\"name\":\"%s\",\"ops\":%llu,\"min_ns\":%.1f,\"median_ns\":%.1f,"
+            "\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"mean_ns\":%.1f}%s\n",
+            micro_benches[i].name, (unsigned long long)r->ops, r->min,
+            r->median, r->p90, r->p99, r->mean,
+            i == MicroBenchCount - 1 ? "" : ",");
+  }
+  fprintf(out, "]}\n");
+}
+
+// Only reads back what micro_write_json writes
+/// @return false if the baseline doesn't have the benchmark
+static bool micro_baseline_median(char* baseline, char* name, double* median)
+{
+  char key[128];
+  snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+  char* entry = strstr(baseline, key);
+  if (!entry)
+    return false;
+  char* field = strstr(entry, "\"median_ns\":");
+  char* end = strchr(entry, '}');
+  if (!field || (end && field > end))
+    return false;
+  *median = strtod(field + strlen("\"median_ns\":"), NULL);
+  return *median > 0;
+}
+
+/// @return The number of benchmarks that got slower than the threshold
+static int micro_compare(char* baseline, MicroResult* results,
+                         double threshold)
+{
+  int slower = 0;
+  fprintf(stderr, "%-24s %12s %12s %8s\n", "benchmark", "baseline ns",
+          "now ns", "change");
+  for (int i = 0; i < MicroBenchCount; i++)
+  {
+    double base;
+    if (!micro_baseline_median(baseline, micro_benches[i].name, &base))
+    {
+      fprintf(stderr, "%-24s %12s %12.1f\n", micro_benches[i].name, "-",
+              results[i].median);
+      continue;
+    }
+    double change = (results[i].median / base - 1) * 100;
+    bool regressed = change > threshold;
+    slower += regressed;
+    fprintf(stderr, "%-24s %12.1f %12.1f %+7.1f%%%s\n", micro_benches[i].name,
+            base, results[i].median, change, regressed ? "  SLOWER" : "");
+  }
+  return slower;
+}
+
+int main(int argc, char* argv[])
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+
+  char* output = NULL;
+  char* baseline_path = NULL;
+  int reps = MicroDefaultReps;
+  int warmup = MicroDefaultWarmup;
+  double threshold = MicroDefaultThresholdPercent;
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-o") == 0 && has_value)
+      output = argv[++i];
+    else if (strcmp(argv[i], "--reps") == 0 && has_value)
+      reps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+      warmup = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+      baseline_path = argv[++i];
+    else if (strcmp(argv[i], "--threshold") == 0 && has_value)
+      threshold = atof(argv[++i]);
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (reps < 1)
+    reps = 1;
+  if (warmup < 0)
+    warmup = 0;
+
+  // Read the baseline first, it might be the file we're about to overwrite
+  char* baseline = NULL;
+  size_t baseline_size = 0;
+  if (baseline_path)
+  {
+    char* data = map_file(baseline_path, &baseline_size);
+    if (!data)
+    {
+      ELOG("Couldn't read %s\n", baseline_path);
+      return 1;
+    }
+    baseline = strndup(data, baseline_size);
+    unmap_file(data, baseline_size);
+  }
+
+  MicroPosition* positions = calloc(bench_npositions, sizeof(*positions));
+  for (int i = 0; i < bench_npositions; i++)
+  {
+    MicroPosition* p = &positions[i];
+    p->fen = bench_positions[i];
+    board_new(&p->board, p->fen);
+    Array moves = board_get_moves_all(
+        p->board, p->board.white_to_move ? GetMovesWhite : GetMovesBlack);
+    p->nmoves = moves.used;
+    p->moves = malloc(moves.used * sizeof(Move));
+    for (int j = 0; j < moves.used; j++)
+      p->moves[j] = *(Move*)array_get(&moves, j);
+    array_free(&moves);
+  }
+
+  MicroResult results[MicroBenchCount];
+  for (int i = 0; i < MicroBenchCount; i++)
+  {
+    results[i] = micro_run(&micro_benches[i], positions, bench_npositions,
+                           reps, warmup);
+    fprintf(stderr, "%-24s %10.1f ns median\n", micro_benches[i].name,
+            results[i].median);
+  }
+
+  FILE* out = output ? fopen(output, "w") : stdout;
+  if (!out)
+  {
+    ELOG("Couldn't open %s\n", output);
+    return 1;
+  }
+  micro_write_json(out, results, reps, warmup);
+  if (out != stdout)
+    fclose(out);
+
+  int slower = 0;
+  if (baseline)
+  {
+    slower = micro_compare(baseline, results, threshold);
+    if (slower)
+      fprintf(stderr, "%d benchmarks slower than the baseline by over %.1f%%\n",
+              slower, threshold);
+    free(baseline);
+  }
+
+  for (int i = 0; i < bench_npositions; i++)
+    free(positions[i].moves);
+  free(positions);
+  return slower ? 1 : 0;
+}
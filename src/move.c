@@ -7,16 +7,14 @@
 #include <stdlib.h>
 #include <string.h>
 
-// New move from 0x88 positions
+// New move from 0x88 positions. move_new(-1, -1) is the null move.
 Move move_new(int from, int to)
 {
-  // We need to use memset here so that the struct padding garbage doesn't break
-  // move_equals
-  Move move;
-  memset(&move, 0, sizeof(move));
+  if (from < 0 || from > 63 || to < 0 || to > 63)
+    from = to = 63;
+  Move move = {.bits = 0};
   move.from = from;
   move.to = to;
-  move.promotion = ChessPieceNone;
   return move;
 }
 
@@ -28,7 +26,61 @@ char* move_tostring(Move move)
   return str;
 }
 
+// Long algebraic notation as used by UCI, e.g. e2e4 or e7e8q
+char* move_to_uci(Move move)
+{
+  char* str = calloc(1, 6);
+  if (move_is_null(move))
+  {
+    strcpy(str, "0000"); // UCI's null move
+    return str;
+  }
+
+  str[0] = 'a' + tofile64(move.from);
+  str[1] = '8' - torank64(move.from);
+  str[2] = 'a' + tofile64(move.to);
+  str[3] = '8' - torank64(move.to);
+  if (move.promo)
+    str[4] = piece_to_char(move_promotion(move));
+  return str;
+}
+
+/// @return The null move if str isn't a move
+Move move_from_uci(char* str)
+{
+  if (strlen(str) < 4 || str[0] < 'a' || str[0] > 'h' || str[1] < '1' ||
+      str[1] > '8' || str[2] < 'a' || str[2] > 'h' || str[3] < '1' ||
+      str[3] > '8')
+    return move_new(-1, -1);
+
+  Move move = move_new(topos64fr(str[0] - 'a', '8' - str[1]),
+                       topos64fr(str[2] - 'a', '8' - str[3]));
+  if (str[4] && strchr("qrbn", str[4]))
+    move_set_promotion(&move, piece_from_char(str[4]));
+  return move;
+}
+
 bool move_equals(Move move, Move other)
 {
-  return memcmp(&move, &other, sizeof(Move)) == 0;
+  return move.bits == other.bits;
+}
+
+// A piece can't move to where it already is, so from == to is free to mean
+// no move
+bool move_is_null(Move move)
+{
+  return move.from == move.to;
+}
+
+/// @return The uncoloured piece a pawn promotes to, or ChessPieceNone
+ChessPiece move_promotion(Move move)
+{
+  return move.promo << 1;
+}
+
+// Knight through queen are bits 1 to 4 of ChessPiece, which is why promo only
+// needs four bits
+void move_set_promotion(Move* move, ChessPiece piece)
+{
+  move->promo = (piece & ~ChessPieceIsWhite) >> 1;
 }
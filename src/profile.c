@@ -0,0 +1,262 @@
+#include <rgl/logging.h>
+
+#include <chess/profile.h>
+#include <chess/util.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef CHESS_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char* profile_zone_names[ProfileZoneCount] = {
+    "board_get_moves", "position_of_checker", "board_update",
+    "evaluate_board",  "node_new",
+};
+
+enum
+{
+  // Per thread, after that we keep counting but stop recording the trace
+  ProfileMaxEvents = 1 << 20,
+};
+
+typedef struct
+{
+  u8 zone;
+  u64 start;
+  u64 ticks;
+} ProfileEvent;
+
+typedef struct ProfileThread ProfileThread;
+struct ProfileThread
+{
+  int id;
+  // Only written by the owning thread. Reports read them while they're
+  // being written to, which can be out by a call or two.
+  u64 calls[ProfileZoneCount];
+  u64 ticks[ProfileZoneCount];
+  ProfileEvent* events;
+  size_t nevents;
+  ProfileThread* next;
+};
+
+static _Thread_local ProfileThread* t_profile;
+static ProfileThread* g_profile_threads;
+static int g_profile_nthreads;
+static pthread_mutex_t g_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool g_profile_trace;
+
+// Where we started, for turning ticks into time
+static u64 g_profile_start_ticks;
+static u64 g_profile_start_ns;
+
+static u64 profile_ns()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The time stamp counter is far cheaper to read than the clock and ticks at a
+// constant rate on anything recent
+static inline u64 profile_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return profile_ns();
+#endif
+}
+
+static double profile_ns_per_tick()
+{
+  u64 ticks = profile_ticks() - g_profile_start_ticks;
+  u64 ns = profile_ns() - g_profile_start_ns;
+  return ticks ? (double)ns / ticks : 1;
+}
+
+static ProfileThread* profile_thread()
+{
+  if (t_profile)
+    return t_profile;
+
+  ProfileThread* thread = calloc(1, sizeof(*thread));
+  pthread_mutex_lock(&g_profile_lock);
+  thread->id = ++g_profile_nthreads;
+  thread->next = g_profile_threads;
+  g_profile_threads = thread;
+  pthread_mutex_unlock(&g_profile_lock);
+  // Threads are never removed from the list, so what they did still shows up
+  // in the report after they exit
+  t_profile = thread;
+  return thread;
+}
+
+ProfileScope profile_scope_begin(ProfileZone zone)
+{
+  return (ProfileScope){zone, profile_ticks()};
+}
+
+void profile_scope_end(ProfileScope* scope)
+{
+  u64 ticks = profile_ticks() - scope->start;
+  ProfileThread* thread = profile_thread();
+  thread->calls[scope->zone]++;
+  thread->ticks[scope->zone] += ticks;
+
+  if (!atomic_load_explicit(&g_profile_trace, memory_order_relaxed))
+    return;
+  if (!thread->events)
+    thread->events = malloc(ProfileMaxEvents * sizeof(*thread->events));
+  if (thread->nevents < ProfileMaxEvents)
+    thread->events[thread->nevents++] =
+        (ProfileEvent){scope->zone, scope->start, ticks};
+}
+
+// Recording every call adds up quickly so the trace is opt in
+void profile_set_trace(bool enabled)
+{
+  atomic_store(&g_profile_trace, enabled);
+}
+
+static void profile_report_text(FILE* out)
+{
+  u64 calls[ProfileZoneCount] = {0};
+  u64 ticks[ProfileZoneCount] = {0};
+  pthread_mutex_lock(&g_profile_lock);
+  for (ProfileThread* t = g_profile_threads; t; t = t->next)
+  {
+    for (int z = 0; z < ProfileZoneCount; z++)
+    {
+      calls[z] += t->calls[z];
+      ticks[z] += t->ticks[z];
+    }
+  }
+  int nthreads = g_profile_nthreads;
+  pthread_mutex_unlock(&g_profile_lock);
+
+  double ns_per_tick = profile_ns_per_tick();
+  double wall_ms = (profile_ns() - g_profile_start_ns) / 1e6;
+  fprintf(out, "%d threads, %.0fms since start. Times include nested zones.\n",
+          nthreads, wall_ms);
+  fprintf(out, "%-20s %14s %12s %10s\n", "zone", "calls", "total ms",
+          "ns/call");
+  for (int z = 0; z < ProfileZoneCount; z++)
+  {
+    double ms = ticks[z] * ns_per_tick / 1e6;
+    double per_call = calls[z] ? ticks[z] * ns_per_tick / calls[z] : 0;
+    fprintf(out, "%-20s %14llu %12.1f %10.1f\n", profile_zone_names[z],
+            (unsigned long long)calls[z], ms, per_call);
+  }
+}
+
+static void profile_report_chrome(FILE* out)
+{
+  double us_per_tick = profile_ns_per_tick() / 1000;
+  fprintf(out, "{\"traceEvents\":[");
+  bool first = true;
+  pthread_mutex_lock(&g_profile_lock);
+  for (ProfileThread* t = g_profile_threads; t; t = t->next)
+  {
+    for (size_t i = 0; i < t->nevents; i++)
+    {
+      ProfileEvent* e = &t->events[i];
+      fprintf(out,
+              "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",", profile_zone_names[e->zone], t->id,
+              (e->start - g_profile_start_ticks) * us_per_tick,
+              e->ticks * us_per_tick);
+      first = false;
+    }
+  }
+  pthread_mutex_unlock(&g_profile_lock);
+  fprintf(out, "\n]}\n");
+}
+
+void profile_report(FILE* out, ProfileFormat format)
+{
+  if (format == ProfileFormatChrome)
+    profile_report_chrome(out);
+  else
+    profile_report_text(out);
+}
+
+static char* g_profile_out;
+
+static void profile_write_at_exit()
+{
+  char* ext = strrchr(g_profile_out, '.');
+  bool json = ext && strcmp(ext, ".json") == 0;
+  FILE* out = fopen(g_profile_out, "w");
+  if (!out)
+  {
+    ELOG("Couldn't write profile to %s\n", g_profile_out);
+    return;
+  }
+  profile_report(out, json ? ProfileFormatChrome : ProfileFormatText);
+  fclose(out);
+}
+
+__attribute__((constructor))
+static void profile_init()
+{
+  g_profile_start_ticks = profile_ticks();
+  g_profile_start_ns = profile_ns();
+  atomic_init(&g_profile_trace, false);
+
+  g_profile_out = getenv("CHESS_PROFILE_OUT");
+  if (g_profile_out && *g_profile_out)
+  {
+    char* ext = strrchr(g_profile_out, '.');
+    profile_set_trace(ext && strcmp(ext, ".json") == 0);
+    atexit(profile_write_at_exit);
+  }
+}
+
+#else
+
+ProfileScope profile_scope_begin(ProfileZone zone)
+{
+  return (ProfileScope){zone, 0};
+}
+
+void profile_scope_end(ProfileScope* scope)
+{
+}
+
+void profile_set_trace(bool enabled)
+{
+}
+
+void profile_report(FILE* out, ProfileFormat format)
+{
+  if (format == ProfileFormatChrome)
+    fprintf(out, "{\"traceEvents\":[]}\n");
+  else
+    fprintf(out, "Built without CHESS_PROFILE\n");
+}
+
+#endif
+
+// For sending over IPC. Free it with free.
+char* profile_report_string(ProfileFormat format)
+{
+  FILE* tmp = tmpfile();
+  if (!tmp)
+    return NULL;
+  profile_report(tmp, format);
+  long size = ftell(tmp);
+  rewind(tmp);
+  char* str = malloc(size + 1);
+  size_t nread = fread(str, 1, size, tmp);
+  str[nread] = '\0';
+  fclose(tmp);
+  return str;
+}
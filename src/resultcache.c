@@ -0,0 +1,274 @@
+#include <rgl/logging.h>
+
+#include <chess/hash.h>
+#include <chess/move.h>
+#include <chess/resultcache.h>
+#include <chess/util.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char result_cache_magic[4] = {'C', 'R', 'C', '1'};
+
+void result_cache_new(ResultCache* cache, size_t size_mb)
+{
+  memset(cache, 0, sizeof(*cache));
+  size_t max_entries = (size_mb << 20) /
+                       (sizeof(ResultCacheNode) + sizeof(ResultCacheNode*));
+  if (max_entries < 1)
+    max_entries = 1;
+  cache->nbuckets = 1;
+  while (cache->nbuckets * 2 <= max_entries)
+    cache->nbuckets *= 2;
+
+  cache->nodes = calloc(max_entries, sizeof(ResultCacheNode));
+  cache->buckets = calloc(cache->nbuckets, sizeof(ResultCacheNode*));
+  for (size_t i = 0; i + 1 < max_entries; i++)
+    cache->nodes[i].chain = &cache->nodes[i + 1];
+  cache->unused = cache->nodes;
+
+  cache->stats.capacity = max_entries;
+  cache->stats.bytes = max_entries * sizeof(ResultCacheNode) +
+                       cache->nbuckets * sizeof(ResultCacheNode*);
+  pthread_mutex_init(&cache->lock, NULL);
+  pthread_mutex_init(&cache->save_lock, NULL);
+}
+
+void result_cache_free(ResultCache* cache)
+{
+  free(cache->nodes);
+  free(cache->buckets);
+  free(cache->path);
+  pthread_mutex_destroy(&cache->lock);
+  pthread_mutex_destroy(&cache->save_lock);
+  memset(cache, 0, sizeof(*cache));
+}
+
+static ResultCacheNode** result_cache_bucket(ResultCache* cache, u64 key,
+                                             u32 depth)
+{
+  // The depth only changes the low bits of the key a little, so it's spread
+  // out before picking the bucket
+  u64 mixed = key ^ (depth * 0x9E3779B97F4A7C15ULL);
+  return &cache->buckets[mixed & (cache->nbuckets - 1)];
+}
+
+static ResultCacheNode* result_cache_find(ResultCache* cache, u64 key,
+                                          u32 depth)
+{
+  for (ResultCacheNode* node = *result_cache_bucket(cache, key, depth); node;
+       node = node->chain)
+    if (node->entry.key == key && node->entry.depth == depth)
+      return node;
+  return NULL;
+}
+
+static void result_cache_unlink(ResultCache* cache, ResultCacheNode* node)
+{
+  if (node->newer)
+    node->newer->older = node->older;
+  else
+    cache->newest = node->older;
+  if (node->older)
+    node->older->newer = node->newer;
+  else
+    cache->oldest = node->newer;
+  node->newer = node->older = NULL;
+}
+
+static void result_cache_push_newest(ResultCache* cache, ResultCacheNode* node)
+{
+  node->older = cache->newest;
+  node->newer = NULL;
+  if (cache->newest)
+    cache->newest->newer = node;
+  cache->newest = node;
+  if (!cache->oldest)
+    cache->oldest = node;
+}
+
+// Takes the oldest result out of the table so its node can be reused
+static ResultCacheNode* result_cache_evict(ResultCache* cache)
+{
+  ResultCacheNode* node = cache->oldest;
+  result_cache_unlink(cache, node);
+  ResultCacheNode** link =
+      result_cache_bucket(cache, node->entry.key, node->entry.depth);
+  while (*link != node)
+    link = &(*link)->chain;
+  *link = node->chain;
+  cache->stats.evictions++;
+  cache->stats.entries--;
+  return node;
+}
+
+// Must be called with the lock held
+static void result_cache_insert(ResultCache* cache, ResultEntry entry)
+{
+  ResultCacheNode* node = result_cache_find(cache, entry.key, entry.depth);
+  if (node)
+  {
+    result_cache_unlink(cache, node);
+  }
+  else
+  {
+    node = cache->unused;
+    if (node)
+      cache->unused = node->chain;
+    else
+      node = result_cache_evict(cache);
+    ResultCacheNode** bucket =
+        result_cache_bucket(cache, entry.key, entry.depth);
+    node->chain = *bucket;
+    *bucket = node;
+    cache->stats.entries++;
+  }
+  node->entry = entry;
+  result_cache_push_newest(cache, node);
+}
+
+// Loads the results saved at path and saves there from now on. There being no
+// file yet isn't an error, it'll be made on the first save.
+/// @return 0 on success
+int result_cache_load(ResultCache* cache, char* path)
+{
+  pthread_mutex_lock(&cache->lock);
+  free(cache->path);
+  cache->path = strdup(path);
+
+  size_t size;
+  char* data = map_file(path, &size);
+  if (!data)
+  {
+    ILOG("Starting a new result cache at %s\n", path);
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+  }
+
+  ResultCacheHeader* header = (ResultCacheHeader*)data;
+  bool valid = size >= sizeof(*header) &&
+               memcmp(header->magic, result_cache_magic, 4) == 0 &&
+               size == sizeof(*header) + header->nentries * sizeof(ResultEntry);
+  if (valid)
+  {
+    ResultEntry* entries = (ResultEntry*)(data + sizeof(*header));
+    for (u64 i = 0; i < header->nentries; i++)
+      result_cache_insert(cache, entries[i]);
+    ILOG("Loaded %llu results from %s\n",
+         (unsigned long long)header->nentries, path);
+  }
+  else
+  {
+    ELOG("Ignoring broken result cache %s\n", path);
+  }
+  unmap_file(data, size);
+  pthread_mutex_unlock(&cache->lock);
+  return valid ? 0 : -1;
+}
+
+// The entries are copied out under the lock and written without it, so probes
+// and stores carry on while the file's written. It's written to a temporary
+// file first so a crash part way through doesn't lose the last save.
+/// @return 0 on success
+int result_cache_save(ResultCache* cache)
+{
+  // Only one save at a time, they'd share the temporary file
+  pthread_mutex_lock(&cache->save_lock);
+  pthread_mutex_lock(&cache->lock);
+  if (!cache->path)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    pthread_mutex_unlock(&cache->save_lock);
+    return -1;
+  }
+  char path[1024];
+  snprintf(path, sizeof(path), "%s", cache->path);
+  ResultCacheHeader header = {.nentries = cache->stats.entries};
+  memcpy(header.magic, result_cache_magic, sizeof(header.magic));
+  ResultEntry* entries = malloc(header.nentries * sizeof(ResultEntry) + 1);
+  u64 n = 0;
+  for (ResultCacheNode* node = cache->oldest; node; node = node->newer)
+    entries[n++] = node->entry;
+  cache->unsaved = 0;
+  pthread_mutex_unlock(&cache->lock);
+
+  char tmp_path[1040];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE* f = fopen(tmp_path, "wb");
+  int rv = 0;
+  if (!f)
+  {
+    ELOG("Couldn't open %s\n", tmp_path);
+    rv = -1;
+  }
+  else
+  {
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(entries, sizeof(ResultEntry), n, f) == n;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path))
+    {
+      ELOG("Couldn't write %s\n", path);
+      remove(tmp_path);
+      rv = -1;
+    }
+  }
+  free(entries);
+  pthread_mutex_unlock(&cache->save_lock);
+  return rv;
+}
+
+/// @return Whether there's a result for board searched to depth, which goes in
+///         entry if there is
+bool result_cache_probe(ResultCache* cache, Board board, int depth,
+                        ResultEntry* entry)
+{
+  if (!cache)
+    return false;
+  u64 key = board_hash(board);
+
+  pthread_mutex_lock(&cache->lock);
+  cache->stats.probes++;
+  ResultCacheNode* node = result_cache_find(cache, key, depth);
+  if (node)
+  {
+    cache->stats.hits++;
+    *entry = node->entry;
+    result_cache_unlink(cache, node);
+    result_cache_push_newest(cache, node);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return node != NULL;
+}
+
+void result_cache_store(ResultCache* cache, Board board, int depth, Move move,
+                        int value, int depth_reached)
+{
+  if (!cache || move_is_null(move))
+    return;
+  ResultEntry entry = {
+      .key = board_hash(board),
+      .depth = depth,
+      .depth_reached = depth_reached,
+      .value = value,
+      .move = move,
+  };
+
+  pthread_mutex_lock(&cache->lock);
+  result_cache_insert(cache, entry);
+  cache->stats.stores++;
+  bool save = cache->path && ++cache->unsaved >= ResultCacheSaveEvery;
+  pthread_mutex_unlock(&cache->lock);
+
+  if (save)
+    result_cache_save(cache);
+}
+
+ResultCacheStats result_cache_stats(ResultCache* cache)
+{
+  pthread_mutex_lock(&cache->lock);
+  ResultCacheStats stats = cache->stats;
+  pthread_mutex_unlock(&cache->lock);
+  return stats;
+}
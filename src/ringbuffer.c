@@ -0,0 +1,90 @@
+#define _GNU_SOURCE // For memfd_create
+
+#include <rgl/logging.h>
+
+#include <chess/ringbuffer.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Buffers are handed back here when a connection closes rather than being
+// unmapped, setting up the mappings costs a few syscalls.
+static RingBuffer* g_pool;
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static RingBuffer* ringbuffer_new(size_t size)
+{
+  int fd = memfd_create("chess-ring", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, size))
+  {
+    ELOG("Couldn't create ring buffer: %s\n", strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  // Reserve space for both copies then map the file over each half
+  byte* base =
+      mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  bool ok = base != MAP_FAILED;
+  ok = ok && mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                  fd, 0) != MAP_FAILED;
+  ok = ok && mmap(base + size, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+  close(fd);
+
+  if (!ok)
+  {
+    ELOG("Couldn't map ring buffer: %s\n", strerror(errno));
+    if (base != MAP_FAILED)
+      munmap(base, 2 * size);
+    return NULL;
+  }
+
+  RingBuffer* ring = calloc(1, sizeof(*ring));
+  ring->base = base;
+  ring->size = size;
+  return ring;
+}
+
+RingBuffer* ringbuffer_acquire()
+{
+  pthread_mutex_lock(&g_pool_lock);
+  RingBuffer* ring = g_pool;
+  if (ring)
+    g_pool = ring->next;
+  pthread_mutex_unlock(&g_pool_lock);
+
+  if (!ring)
+    ring = ringbuffer_new(RingBufferSize);
+  if (!ring)
+    return NULL;
+
+  ring->head = 0;
+  atomic_store(&ring->tail, 0);
+  ring->next = NULL;
+  return ring;
+}
+
+void ringbuffer_return(RingBuffer* ring)
+{
+  pthread_mutex_lock(&g_pool_lock);
+  ring->next = g_pool;
+  g_pool = ring;
+  pthread_mutex_unlock(&g_pool_lock);
+}
+
+/// @return pointer to pos, valid for up to ring->size bytes
+byte* ringbuffer_at(RingBuffer* ring, u64 pos)
+{
+  return ring->base + pos % ring->size;
+}
+
+size_t ringbuffer_free_space(RingBuffer* ring)
+{
+  return ring->size - (ring->head - atomic_load(&ring->tail));
+}
@@ -0,0 +1,225 @@
+#include <rgl/logging.h>
+
+#include <chess/scheduler.h>
+#include <chess/util.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// The worker running on this thread, so tasks queued from a task go on the
+// same worker's queue
+static _Thread_local SchedulerWorker* t_worker;
+
+static void deque_push(SchedulerDeque* queue, SchedulerTask task)
+{
+  if (queue->count == queue->capacity)
+  {
+    u32 capacity = queue->capacity ? queue->capacity * 2 : 16;
+    SchedulerTask* tasks = malloc(capacity * sizeof(*tasks));
+    for (u32 i = 0; i < queue->count; i++)
+      tasks[i] = queue->tasks[(queue->head + i) & (queue->capacity - 1)];
+    free(queue->tasks);
+    queue->tasks = tasks;
+    queue->capacity = capacity;
+    queue->head = 0;
+  }
+  queue->tasks[(queue->head + queue->count) & (queue->capacity - 1)] = task;
+  queue->count++;
+}
+
+static bool deque_pop_front(SchedulerDeque* queue, SchedulerTask* task)
+{
+  if (queue->count == 0)
+    return false;
+  *task = queue->tasks[queue->head];
+  queue->head = (queue->head + 1) & (queue->capacity - 1);
+  queue->count--;
+  return true;
+}
+
+static bool deque_pop_back(SchedulerDeque* queue, SchedulerTask* task)
+{
+  if (queue->count == 0)
+    return false;
+  queue->count--;
+  *task = queue->tasks[(queue->head + queue->count) & (queue->capacity - 1)];
+  return true;
+}
+
+/// @return Whether there was a task of this priority for worker to run
+static bool scheduler_take(SchedulerWorker* worker, SchedulerPriority priority,
+                           SchedulerTask* task, bool* stolen)
+{
+  Scheduler* scheduler = worker->scheduler;
+  pthread_mutex_lock(&worker->lock);
+  bool found = deque_pop_front(&worker->queues[priority], task);
+  pthread_mutex_unlock(&worker->lock);
+  *stolen = false;
+
+  for (int i = 1; !found && i < scheduler->nworkers; i++)
+  {
+    SchedulerWorker* victim =
+        &scheduler->workers[(worker->index + i) % scheduler->nworkers];
+    pthread_mutex_lock(&victim->lock);
+    found = deque_pop_back(&victim->queues[priority], task);
+    pthread_mutex_unlock(&victim->lock);
+    *stolen = found;
+  }
+  return found;
+}
+
+static void* scheduler_worker_run(void* void_worker)
+{
+  SchedulerWorker* worker = void_worker;
+  Scheduler* scheduler = worker->scheduler;
+  bool can_search = worker->index < scheduler->nsearch;
+  t_worker = worker;
+
+  for (;;)
+  {
+    SchedulerTask task;
+    bool stolen;
+    SchedulerPriority priority = SchedulerPriorityInteractive;
+    bool found = scheduler_take(worker, priority, &task, &stolen);
+    if (!found && can_search)
+    {
+      priority = SchedulerPrioritySearch;
+      found = scheduler_take(worker, priority, &task, &stolen);
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (!found)
+    {
+      // Queued tasks are counted as pending once they're in a queue, so if
+      // there's nothing pending here there's nothing we missed
+      while (!scheduler->stopping &&
+             scheduler->pending[SchedulerPriorityInteractive] == 0 &&
+             (!can_search || scheduler->pending[SchedulerPrioritySearch] == 0))
+        pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+      bool stopping = scheduler->stopping &&
+                      scheduler->pending[SchedulerPriorityInteractive] == 0 &&
+                      (!can_search ||
+                       scheduler->pending[SchedulerPrioritySearch] == 0);
+      pthread_mutex_unlock(&scheduler->lock);
+      if (stopping)
+        break;
+      continue;
+    }
+
+    SchedulerStats* stats = &scheduler->stats[priority];
+    u64 wait_ns = get_time_ns() - task.queued_ns;
+    scheduler->pending[priority]--;
+    stats->queued--;
+    stats->stolen += stolen;
+    stats->total_wait_ns += wait_ns;
+    if (wait_ns > stats->max_wait_ns)
+      stats->max_wait_ns = wait_ns;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    task.fn(task.arg);
+
+    pthread_mutex_lock(&scheduler->lock);
+    stats->completed++;
+    pthread_mutex_unlock(&scheduler->lock);
+  }
+
+  t_worker = NULL;
+  return NULL;
+}
+
+// At least one worker takes searches and, when there's more than one worker,
+// at least one doesn't
+void scheduler_new(Scheduler* scheduler, int nworkers, int nsearch)
+{
+  memset(scheduler, 0, sizeof(*scheduler));
+  if (nworkers < 1)
+    nworkers = 1;
+  if (nworkers > SchedulerMaxWorkers)
+    nworkers = SchedulerMaxWorkers;
+  if (nsearch >= nworkers)
+    nsearch = nworkers - 1;
+  if (nsearch < 1)
+    nsearch = 1;
+  scheduler->nworkers = nworkers;
+  scheduler->nsearch = nsearch;
+  atomic_init(&scheduler->next_worker, 0);
+  pthread_mutex_init(&scheduler->lock, NULL);
+  pthread_cond_init(&scheduler->wake, NULL);
+
+  for (int i = 0; i < nworkers; i++)
+  {
+    SchedulerWorker* worker = &scheduler->workers[i];
+    worker->scheduler = scheduler;
+    worker->index = i;
+    pthread_mutex_init(&worker->lock, NULL);
+  }
+  for (int i = 0; i < nworkers; i++)
+  {
+    SchedulerWorker* worker = &scheduler->workers[i];
+    pthread_create(&worker->thread, NULL, scheduler_worker_run, worker);
+  }
+}
+
+// Waits for everything already queued to finish
+void scheduler_free(Scheduler* scheduler)
+{
+  pthread_mutex_lock(&scheduler->lock);
+  scheduler->stopping = true;
+  pthread_cond_broadcast(&scheduler->wake);
+  pthread_mutex_unlock(&scheduler->lock);
+
+  for (int i = 0; i < scheduler->nworkers; i++)
+    pthread_join(scheduler->workers[i].thread, NULL);
+  for (int i = 0; i < scheduler->nworkers; i++)
+  {
+    SchedulerWorker* worker = &scheduler->workers[i];
+    for (int j = 0; j < SchedulerPriorityCount; j++)
+      free(worker->queues[j].tasks);
+    pthread_mutex_destroy(&worker->lock);
+  }
+  pthread_cond_destroy(&scheduler->wake);
+  pthread_mutex_destroy(&scheduler->lock);
+}
+
+void scheduler_queue(Scheduler* scheduler, SchedulerPriority priority,
+                     void* (*fn)(void* arg), void* arg)
+{
+  SchedulerTask task = {fn, arg, get_time_ns()};
+
+  // Searches go to a worker that can run them, anything else queued by a task
+  // stays on that task's worker
+  SchedulerWorker* worker = t_worker;
+  bool can_run = worker && worker->scheduler == scheduler &&
+                 (priority != SchedulerPrioritySearch ||
+                  worker->index < scheduler->nsearch);
+  if (!can_run)
+  {
+    unsigned n = atomic_fetch_add(&scheduler->next_worker, 1);
+    int nworkers = priority == SchedulerPrioritySearch ? scheduler->nsearch
+                                                       : scheduler->nworkers;
+    worker = &scheduler->workers[n % nworkers];
+  }
+
+  // The task is counted before the worker's lock is let go, otherwise another
+  // worker could steal and uncount it first. Workers never hold their own lock
+  // while taking the scheduler's, so taking both here can't deadlock.
+  pthread_mutex_lock(&worker->lock);
+  deque_push(&worker->queues[priority], task);
+  pthread_mutex_lock(&scheduler->lock);
+  SchedulerStats* stats = &scheduler->stats[priority];
+  scheduler->pending[priority]++;
+  stats->queued++;
+  if (stats->queued > stats->max_queued)
+    stats->max_queued = stats->queued;
+  pthread_cond_broadcast(&scheduler->wake);
+  pthread_mutex_unlock(&scheduler->lock);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+void scheduler_get_stats(Scheduler* scheduler,
+                         SchedulerStats stats[SchedulerPriorityCount])
+{
+  pthread_mutex_lock(&scheduler->lock);
+  memcpy(stats, scheduler->stats, sizeof(scheduler->stats));
+  pthread_mutex_unlock(&scheduler->lock);
+}
@@ -2,41 +2,273 @@
 
 #include <chess/board.h>
 #include <chess/evaluate.h>
+#include <chess/hash.h>
 #include <chess/move.h>
 #include <chess/search.h>
 #include <chess/tree.h>
+#include <chess/util.h>
 
 #include <inttypes.h>
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Selection sort
-void node_order_children(Node* node)
+void search_context_new(SearchContext* ctx, size_t hash_mb)
 {
-  if (node->nchilds == 0)
+  memset(ctx, 0, sizeof(*ctx));
+  transtable_new(&ctx->tt, hash_mb);
+  for (int i = 0; i < SearchMaxPly; i++)
+    ctx->killers[i][0] = ctx->killers[i][1] = move_new(-1, -1);
+  atomic_init(&ctx->stop, false);
+  atomic_init(&ctx->nodes, 0);
+  ctx->owns_tt = true;
+}
+
+// For lazy SMP. Each helper thread searches the same position with its own
+// tree, killers and history while sharing main's transposition table, so the
+// threads mostly speed each other up through the table. Entries can be torn
+// by concurrent writes, which only costs us a bad move ordering or a wrong
+// value now and then.
+void search_context_new_helper(SearchContext* ctx, SearchContext* main)
+{
+  search_context_new(ctx, 0);
+  transtable_free(&ctx->tt);
+  ctx->tt = main->tt;
+  ctx->owns_tt = false;
+  ctx->tb = main->tb;
+}
+
+void search_context_free(SearchContext* ctx)
+{
+  if (ctx->owns_tt)
+    transtable_free(&ctx->tt);
+}
+
+// Forgets everything learnt from earlier searches
+void search_context_clear(SearchContext* ctx)
+{
+  if (ctx->owns_tt)
+    transtable_clear(&ctx->tt);
+  for (int i = 0; i < SearchMaxPly; i++)
+    ctx->killers[i][0] = ctx->killers[i][1] = move_new(-1, -1);
+  memset(ctx->history, 0, sizeof(ctx->history));
+}
+
+static bool search_is_limited(SearchContext* ctx)
+{
+  return ctx->limits.nodes || ctx->limits.time_ms || ctx->limits.infinite;
+}
+
+// Checking the clock is relatively slow so we only do it every so often
+static void search_check_limits(SearchContext* ctx, u64 nodes)
+{
+  if (ctx->limits.nodes && nodes >= ctx->limits.nodes)
+    atomic_store(&ctx->stop, true);
+  if (ctx->limits.time_ms && (nodes & 1023) == 0 &&
+      get_time_ms() - ctx->start_ms >= ctx->limits.time_ms)
+    atomic_store(&ctx->stop, true);
+}
+
+// Follows the best children down from the root
+static int search_get_pv(Node* root, Move* pv, int max)
+{
+  int len = 0;
+  Node* node = root;
+  while (len < max && node->nchilds > 0 && node->best_child >= 0 &&
+         node->best_child < node->nchilds)
+  {
+    node = node->children[node->best_child];
+    pv[len++] = node->move;
+  }
+  return len;
+}
+
+// Called between searches once plies moves have been made on the board. The
+// killers are shifted so they line up with the new root and the history
+// scores are decayed so that old cutoffs count for less.
+void search_context_age(SearchContext* ctx, int plies)
+{
+  for (int i = 0; i < SearchMaxPly; i++)
+  {
+    for (int j = 0; j < 2; j++)
+    {
+      if (i + plies < SearchMaxPly)
+        ctx->killers[i][j] = ctx->killers[i + plies][j];
+      else
+        ctx->killers[i][j] = move_new(-1, -1);
+    }
+  }
+
+  for (int i = 0; i < 64; i++)
+    for (int j = 0; j < 64; j++)
+      ctx->history[i][j] /= 2;
+}
+
+// Records a position from the game, call this with the board before each move
+// is made
+void search_context_push_position(SearchContext* ctx, Board board)
+{
+  if (ctx->nkeys == SearchMaxGamePly)
+  {
+    // Anything older than the fifty move rule can't be repeated any more
+    memmove(ctx->keys, ctx->keys + ctx->nkeys - SearchFiftyMovePly,
+            SearchFiftyMovePly * sizeof(*ctx->keys));
+    ctx->nkeys = SearchFiftyMovePly;
+  }
+  ctx->keys[ctx->nkeys++] = board_hash(board);
+}
+
+void search_context_pop_position(SearchContext* ctx)
+{
+  if (ctx->nkeys > 0)
+    ctx->nkeys--;
+}
+
+void search_context_clear_positions(SearchContext* ctx)
+{
+  ctx->nkeys = 0;
+}
+
+// Has the position at index in ctx->keys been seen before, or has the fifty
+// move rule kicked in? We count a single repetition as a draw since if it's
+// worth repeating once it's worth repeating again.
+static bool search_is_draw(SearchContext* ctx, Board board, int index)
+{
+  // Checkmate on the hundredth ply still counts, it's only worth looking for
+  // a legal move once we know the king's in check
+  if (board.halfmove_clock >= SearchFiftyMovePly)
+    return !is_in_check(board, board.white_to_move) ||
+           board_has_legal_move(board, board.white_to_move);
+
+  // Nothing from before the last capture or pawn move can come round again,
+  // and the same side has to be to move so we only look at every other ply
+  int oldest = index - board.halfmove_clock;
+  if (oldest < 0)
+    oldest = 0;
+  for (int i = index - 4; i >= oldest; i -= 2)
+    if (ctx->keys[i] == ctx->keys[index])
+      return true;
+  return false;
+}
+
+static bool is_killer(SearchContext* ctx, int ply, Move move)
+{
+  if (ply >= SearchMaxPly)
+    return false;
+  return move_equals(ctx->killers[ply][0], move) ||
+         move_equals(ctx->killers[ply][1], move);
+}
+
+// Should child a be searched before child b?
+static bool node_child_before(Node* node, Node* a, Node* b,
+                              SearchContext* ctx, Move tt_move, int ply)
+{
+  bool a_tt = move_equals(a->move, tt_move);
+  bool b_tt = move_equals(b->move, tt_move);
+  if (a_tt != b_tt)
+    return a_tt;
+
+  // Values from the previous iteration come first
+  if (a->value != b->value)
+    return node->isWhite ? a->value > b->value : a->value < b->value;
+
+  bool a_killer = is_killer(ctx, ply, a->move);
+  bool b_killer = is_killer(ctx, ply, b->move);
+  if (a_killer != b_killer)
+    return a_killer;
+
+  return ctx->history[a->move.from][a->move.to] >
+         ctx->history[b->move.from][b->move.to];
+}
+
+// Insertion sort of the children from first on, the ones before it are left
+// where they are. This is stable so ties keep their move generation order.
+static void node_order_children_from(Node* node, size_t first,
+                                     SearchContext* ctx, Move tt_move, int ply)
+{
+  if (node->nchilds <= first)
     return;
 
-  bool order_descending = node->isWhite;
-  int i, j, next;
-  for (i = 0; i < node->nchilds - 1; i++)
+  Node* best = NULL;
+  if (node->best_child >= 0 && node->best_child < node->nchilds)
+    best = node->children[node->best_child];
+
+  for (size_t i = first + 1; i < node->nchilds; i++)
   {
-    next = i;
-    for (j = i + 1; j < node->nchilds; j++)
+    Node* child = node->children[i];
+    size_t j = i;
+    for (; j > first; j--)
     {
-      int a = order_descending ? j : next;
-      int b = order_descending ? next : j;
-      if (node->children[a]->value > node->children[b]->value)
-        next = j;
+      if (!node_child_before(node, child, node->children[j - 1], ctx, tt_move,
+                             ply))
+        break;
+      node->children[j] = node->children[j - 1];
     }
-    Node* temp = node->children[i];
-    node->children[i] = node->children[next];
-    node->children[next] = temp;
-    if (node->best_child == i)
-      node->best_child = next;
-    if (node->best_child == next)
+    node->children[j] = child;
+  }
+
+  for (size_t i = 0; best && i < node->nchilds; i++)
+    if (node->children[i] == best)
       node->best_child = i;
+}
+
+void node_order_children(Node* node, SearchContext* ctx, Move tt_move,
+                         int ply)
+{
+  node_order_children_from(node, 0, ctx, tt_move, ply);
+}
+
+// Adds a child for each move of the given stages that the node doesn't
+// already have
+static void node_add_moves(Node* node, Board board, bool isWhite,
+                           GetMovesFlags stages)
+{
+  Array moves = board_get_moves_stage(board, isWhite, stages);
+  for (int i = 0; i < moves.used; i++)
+  {
+    Move move = *(Move*)array_get(&moves, i);
+    bool move_in_tree = false;
+    for (int j = 0; j < node->nchilds; j++)
+    {
+      if (move_equals(move, node->children[j]->move))
+      {
+        move_in_tree = true;
+        break;
+      }
+    }
+
+    if (!move_in_tree)
+      node_new(node, move, !isWhite);
   }
+  array_free(&moves);
+}
+
+// Mate and tablebase scores count the plies from the root, but a position can
+// come up at any ply so the table keeps them counted from the position itself
+static int score_to_tt(int value, int ply)
+{
+  if (value > TablebaseWinScore / 2)
+    return value + ply;
+  if (value < -TablebaseWinScore / 2)
+    return value - ply;
+  return value;
+}
+
+static int score_from_tt(int value, int ply)
+{
+  if (value > TablebaseWinScore / 2)
+    return value - ply;
+  if (value < -TablebaseWinScore / 2)
+    return value + ply;
+  return value;
+}
+
+int search_mate_plies(int value)
+{
+  if (abs(value) > TablebaseWinScore)
+    return SearchMateScore - abs(value);
+  if (abs(value) > TablebaseWinScore / 2)
+    return TablebaseWinScore - abs(value);
+  return -1;
 }
 
 // @@Rework Change the rest of search/minimax to use MinimaxOutput rather than
@@ -51,11 +283,22 @@ typedef struct
   s64 alpha, beta;
   u64 max_depth;
   bool prune;
+  int ply;
+  SearchContext* ctx;
 } MinimaxArgs;
 
+static int minimax_white(Board board, u64 depth, Node* node,
+                         MinimaxArgs args, MinimaxOutput* output);
+static int minimax_black(Board board, u64 depth, Node* node,
+                         MinimaxArgs args, MinimaxOutput* output);
+
+// Instantiated for each side as minimax_white and minimax_black, so every
+// maximising_player check is on a constant and folds away.
 /// @param node non-null
-int minimax(Board board, u64 depth, bool maximising_player, Node* node,
-            MinimaxArgs args, MinimaxOutput* output)
+static FORCE_INLINE int minimax_colour(Board board, u64 depth,
+                                       const bool maximising_player,
+                                       Node* node, MinimaxArgs args,
+                                       MinimaxOutput* output)
 {
   // We don't want to print anything inside minimax
   t_debug_level_push(DebugLevelWarning);
@@ -64,81 +307,197 @@ int minimax(Board board, u64 depth, bool maximising_player, Node* node,
   int rv = best_eval;
   int best_eval_i = 0;
 
+  SearchContext* ctx = args.ctx;
+  s64 alpha_orig = args.alpha;
+  s64 beta_orig = args.beta;
+
+  // The caller tells us whose turn it is so make sure the hash agrees
+  board.white_to_move = maximising_player;
+  u64 key = board_hash(board);
+
+  // The result of an aborted search is thrown away so it doesn't matter what
+  // we return here
+  if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+    goto end;
+
+  u64 nodes =
+      atomic_fetch_add_explicit(&ctx->nodes, 1, memory_order_relaxed) + 1;
+  search_check_limits(ctx, nodes);
+
+  int key_index = ctx->nkeys + args.ply;
+  if (args.ply < SearchMaxPly)
+  {
+    ctx->keys[key_index] = key;
+    // The root has to be searched even if it's a repeat, we need a move
+    if (args.ply > 0 && search_is_draw(ctx, board, key_index))
+    {
+      best_eval = 0;
+      goto end;
+    }
+  }
+
+  // The tables give the exact result so there's nothing left to search
+  TablebaseResult tb_result;
+  if (args.ply > 0 && ctx->tb &&
+      tablebase_count_pieces(board) <= ctx->tb->max_pieces &&
+      tablebase_probe(ctx->tb, board, &tb_result))
+  {
+    // Count from the root so that quicker wins are preferred
+    tb_result.plies += args.ply;
+    best_eval = tablebase_score(tb_result, maximising_player);
+    goto end;
+  }
+
   if (depth == 0)
   {
+    ctx->stats.qnodes++;
     best_eval = evaluate_board(board);
     goto end;
   }
 
-  Array moves = board_get_moves_all(board, maximising_player ? GetMovesWhite
-                                                             : GetMovesBlack);
+  Move tt_move = move_new(-1, -1);
+  TTEntry* entry = transtable_probe(&ctx->tt, key);
+  ctx->stats.tt_probes++;
+  if (entry)
+  {
+    ctx->stats.tt_hits++;
+    tt_move = entry->move;
+    // The root always needs to be searched so that best_child is set
+    if (args.ply > 0 && entry->depth >= depth)
+    {
+      int value = score_from_tt(entry->value, args.ply);
+      if (entry->bound == TTBoundExact)
+      {
+        ctx->stats.tt_cutoffs++;
+        best_eval = value;
+        goto end;
+      }
+      if (entry->bound == TTBoundLower && value > args.alpha)
+        args.alpha = value;
+      else if (entry->bound == TTBoundUpper && value < args.beta)
+        args.beta = value;
+      if (args.beta <= args.alpha)
+      {
+        ctx->stats.tt_cutoffs++;
+        best_eval = value;
+        goto end;
+      }
+    }
+  }
 
-  // foreach move in board_get_moves_all:
-  //  if move not in out_node.moves:
-  //    out_node.moves.append(move)
-  // @@Speed Maybe profile this and see if we can speed it up
-  for (int i = 0; i < moves.used; i++)
+  // Captures are generated and searched first so that when one of them fails
+  // high we never generate the quiets. In check only the evasions can be legal
+  // and they're far quicker to find in one go. A node that's been expanded
+  // before or whose hash move is quiet gets everything at once too, so its
+  // best move still goes first.
+  bool in_check = is_in_check(board, maximising_player);
+  bool tt_quiet = !move_is_null(tt_move) &&
+                  board.state[tt_move.to] == ChessPieceNone && !tt_move.promo;
+  GetMovesFlags stage = 0;
+  if (in_check)
+    stage = GetMovesEvasions;
+  else if (node->nchilds == 0 && !tt_quiet)
+    stage = GetMovesCaptures;
+
+  // Nodes near the root are kept in the final iteration, further down we free
+  // each child once it's been searched
+  bool keep_children = !args.prune || args.ply < SearchKeepPly;
+  Move best_move = move_new(-1, -1);
+  bool cutoff = false;
+  size_t nmoves = 0;
+  size_t i = 0;
+  for (;;)
   {
-    bool move_in_tree = false;
-    for (int j = 0; j < node->nchilds; j++)
+    // The captures have already been ordered and searched, and with
+    // keep_children they're still in front of the quiets
+    size_t first = stage == GetMovesQuiets ? node->nchilds : 0;
+    node_add_moves(node, board, maximising_player, stage);
+    node_order_children_from(node, first, ctx, tt_move, args.ply);
+
+    nmoves = i + (node->nchilds - first);
+    for (; node->nchilds > 0 && i < nmoves; i++)
     {
-      if (move_equals(*(Move*)array_get(&moves, i), node->children[j]->move))
+      Node* current_node = node->children[0];
+      if (keep_children)
+        current_node = node->children[i];
+
+      Move move = current_node->move;
+      if (i == 0)
+        best_move = move;
+
+      Board new_board = board;
+      board_update(&new_board, &move);
+      MinimaxArgs child_args = args;
+      child_args.ply++;
+      int eval = maximising_player
+                     ? minimax_black(new_board, depth - 1, current_node,
+                                     child_args, output)
+                     : minimax_white(new_board, depth - 1, current_node,
+                                     child_args, output);
+      new_board = board; // Restore board state after trying a move
+
+      if (!keep_children)
+        node_free(&current_node);
+
+      if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+        break;
+
+      if (maximising_player ? eval > best_eval : eval < best_eval)
       {
-        move_in_tree = true;
+        best_eval = eval;
+        best_eval_i = i;
+        best_move = move;
+      }
+
+      if (maximising_player && eval > args.alpha)
+        args.alpha = eval;
+      else if (!maximising_player && eval < args.beta)
+        args.beta = eval;
+
+      if (args.beta <= args.alpha) // Prune
+      {
+        ctx->stats.fail_highs++;
+        if (i == 0)
+          ctx->stats.fail_highs_first++;
+        bool is_quiet = board.state[move.to] == ChessPieceNone && !move.promo;
+        if (is_quiet && args.ply < SearchMaxPly &&
+            !move_equals(ctx->killers[args.ply][0], move))
+        {
+          ctx->killers[args.ply][1] = ctx->killers[args.ply][0];
+          ctx->killers[args.ply][0] = move;
+        }
+        if (is_quiet)
+          ctx->history[move.from][move.to] += depth * depth;
+        cutoff = true;
         break;
       }
     }
 
-    if (!move_in_tree)
-      node_new(node, *(Move*)array_get(&moves, i), !maximising_player);
+    if (cutoff || stage != GetMovesCaptures ||
+        atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+      break;
+    stage = GetMovesQuiets;
   }
 
-  array_free(&moves);
-
-  node_order_children(node);
-
-  if (node->nchilds == 0) // Either checkmate or stalemate
+  if (nmoves == 0) // Either checkmate or stalemate
   {
-    if (!is_in_check(board, maximising_player)) // Stalemate
+    if (!in_check) // Stalemate
       best_eval = 0;
+    else // Count from the root so that quicker mates are preferred
+      best_eval = (maximising_player ? -1 : 1) * (SearchMateScore - args.ply);
 
     goto end;
   }
 
-  // If moves in tree for current depth, loop over tree moves
-
-  u64 cached_nchilds = node->nchilds;
-  for (size_t i = 0; node->nchilds > 0 && i < cached_nchilds; i++)
+  if (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
   {
-    Node* current_node = node->children[0];
-    if (!args.prune || depth == args.max_depth)
-      current_node = node->children[i];
-
-    Move move = current_node->move;
-
-    Board new_board = board;
-    board_update(&new_board, &move);
-    int eval =
-        minimax(new_board, depth - 1, !maximising_player, current_node, args, output);
-    new_board = board; // Restore board state after trying a move
-
-    if (args.prune && depth != args.max_depth)
-      node_free(&current_node);
-
-    int last_best_eval = best_eval;
-    best_eval =
-        maximising_player ? fmax(best_eval, eval) : fmin(best_eval, eval);
-
-    if (best_eval != last_best_eval)
-      best_eval_i = i;
-
-    if (maximising_player)
-      args.alpha = fmax(args.alpha, eval);
-    else
-      args.beta = fmin(args.beta, eval);
-
-    if (args.beta <= args.alpha) // Prune
-      break;
+    TTBound bound = TTBoundExact;
+    if (best_eval <= alpha_orig)
+      bound = TTBoundUpper;
+    else if (best_eval >= beta_orig)
+      bound = TTBoundLower;
+    transtable_store(&ctx->tt, key, best_move, score_to_tt(best_eval, args.ply),
+                     depth, bound);
   }
 
 end:
@@ -149,20 +508,109 @@ end:
   return best_eval;
 }
 
+static int minimax_white(Board board, u64 depth, Node* node,
+                         MinimaxArgs args, MinimaxOutput* output)
+{
+  return minimax_colour(board, depth, true, node, args, output);
+}
+
+static int minimax_black(Board board, u64 depth, Node* node,
+                         MinimaxArgs args, MinimaxOutput* output)
+{
+  return minimax_colour(board, depth, false, node, args, output);
+}
+
+/// @param node non-null
+int minimax(Board board, u64 depth, bool maximising_player, Node* node,
+            MinimaxArgs args, MinimaxOutput* output)
+{
+  if (maximising_player)
+    return minimax_white(board, depth, node, args, output);
+  return minimax_black(board, depth, node, args, output);
+}
+
+// Effective branching factor, how many times more nodes the iteration at depth
+// took than the one before it
+double search_stats_branching(SearchStats* stats, int depth)
+{
+  if (depth < 2 || depth > stats->depth || !stats->iteration_nodes[depth - 2])
+    return 0;
+  return (double)stats->iteration_nodes[depth - 1] /
+         stats->iteration_nodes[depth - 2];
+}
+
+void search_stats_log(SearchStats* stats)
+{
+  double tt_hit_rate =
+      stats->tt_probes ? 100.0 * stats->tt_hits / stats->tt_probes : 0;
+  double first_rate =
+      stats->fail_highs ? 100.0 * stats->fail_highs_first / stats->fail_highs
+                        : 0;
+  ILOG("Searched %" PRIu64 " nodes (%" PRIu64 " at the horizon) to depth %u "
+       "in %" PRIu64 "ms, %" PRIu64 " nps\n",
+       stats->nodes, stats->qnodes, stats->depth, stats->time_ms, stats->nps);
+  ILOG("TT %" PRIu64 " probes, %.1f%% hits, %" PRIu64 " cutoffs. "
+       "%.1f%% of %" PRIu64 " fail highs on the first move\n",
+       stats->tt_probes, tt_hit_rate, stats->tt_cutoffs, first_rate,
+       stats->fail_highs);
+  for (int d = 1; d <= stats->depth; d++)
+    DLOG("Depth %d: %" PRIu64 " nodes in %" PRIu64 "ms, branching %.2f\n", d,
+         stats->iteration_nodes[d - 1], stats->iteration_ms[d - 1],
+         search_stats_branching(stats, d));
+}
+
+// Plays straight from the tables when the whole game's left in them
+static bool search_probe_root(SearchContext* ctx, Tree* tree, Move* move)
+{
+  Board board = tree->board;
+  board.white_to_move = tree->root->isWhite;
+  TablebaseResult result;
+  if (!ctx->tb || tablebase_count_pieces(board) > ctx->tb->max_pieces ||
+      !tablebase_root_move(ctx->tb, board, move, &result))
+    return false;
+
+  ctx->info.value = tablebase_score(result, board.white_to_move);
+  ctx->info.time_ms = get_time_ms() - ctx->start_ms;
+  ctx->info.pv[0] = *move;
+  ctx->info.pv_len = 1;
+  if (ctx->on_info)
+    ctx->on_info(&ctx->info, ctx->userdata);
+  return true;
+}
+
 // @@Rework merging precomputation may cause this to break. Consider taking a
 // struct as an argument to handle that. or _Thread_local :D
 Move search(Tree* tree)
 {
-  Move best_move;
+  SearchContext local_context;
+  SearchContext* ctx = tree->context;
+  if (!ctx)
+  {
+    search_context_new(&local_context, SearchDefaultHashMb);
+    ctx = &local_context;
+  }
+
+  Move best_move = node_get_best_move(*tree->root);
+  ctx->start_ms = get_time_ms();
+  atomic_store(&ctx->nodes, 0);
+  memset(&ctx->info, 0, sizeof(ctx->info));
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
 
   MinimaxOutput output = {};
   int depth = tree->depth;
+  if (search_probe_root(ctx, tree, &best_move))
+    depth = 0; // Nothing left to search
   int local_depth = 1;
   int value;
+  // Totals at the end of the last iteration
+  u64 last_nodes = 0;
+  u64 last_ms = 0;
   while (local_depth <= depth)
   {
+    // If the search might be cut short then any iteration could be the last,
+    // and holding on to the whole tree would use far too much memory
     bool prune = false;
-    if (local_depth == depth)
+    if (local_depth == depth || search_is_limited(ctx))
       prune = true;
 
     MinimaxArgs args = {
@@ -170,6 +618,8 @@ Move search(Tree* tree)
       .beta = INT_MAX,
       .max_depth = depth,
       .prune = prune,
+      .ply = 0,
+      .ctx = ctx,
     };
 
     // @@Rework If we want to play as black, this 'false' needs to change to
@@ -179,11 +629,39 @@ Move search(Tree* tree)
     value = minimax(tree->board, local_depth++, tree->root->isWhite,
         tree->root, args, &output);
 
-    if (value == -INT_MAX)
+    // An aborted iteration can't be trusted, use the last complete one
+    if (atomic_load(&ctx->stop))
+      break;
+
+    best_move = node_get_best_move(*tree->root);
+
+    ctx->info.depth = local_depth - 1;
+    ctx->info.value = value;
+    ctx->info.nodes = atomic_load(&ctx->nodes);
+    ctx->info.time_ms = get_time_ms() - ctx->start_ms;
+    ctx->info.pv_len = search_get_pv(tree->root, ctx->info.pv, SearchMaxPly);
+    if (ctx->on_info)
+      ctx->on_info(&ctx->info, ctx->userdata);
+
+    SearchStats* stats = &ctx->stats;
+    stats->depth = ctx->info.depth;
+    stats->iteration_nodes[stats->depth - 1] = ctx->info.nodes - last_nodes;
+    stats->iteration_ms[stats->depth - 1] = ctx->info.time_ms - last_ms;
+    last_nodes = ctx->info.nodes;
+    last_ms = ctx->info.time_ms;
+
+    if (value < -TablebaseWinScore)
       break;
   }
 
-  best_move = node_get_best_move(*tree->root);
+  ctx->stats.nodes = atomic_load(&ctx->nodes);
+  ctx->stats.time_ms = get_time_ms() - ctx->start_ms;
+  ctx->stats.nps = ctx->stats.nodes * 1000 /
+                   (ctx->stats.time_ms ? ctx->stats.time_ms : 1);
+  search_stats_log(&ctx->stats);
+
+  if (ctx == &local_context)
+    search_context_free(&local_context);
 
   return best_move;
 }
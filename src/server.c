@@ -0,0 +1,590 @@
+#include <rgl/logging.h>
+#include <rgl/util.h>
+
+#include <chess/board.h>
+#include <chess/evaluate.h>
+#include <chess/message.h>
+#include <chess/move.h>
+#include <chess/profile.h>
+#include <chess/server.h>
+#include <chess/util.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static void message_handler(MessageQueueItem* item);
+static void client_on_search_info(SearchInfo* info, void* userdata);
+
+Client* client_new(Server* server)
+{
+  Client* client = calloc(1, sizeof(*client));
+  client->server = server;
+  session_new(&client->session, server->start_fen, server->depth);
+  client->session.book = server->book;
+  client->session.context.tb = server->tb;
+  client->session.results = server->results;
+  client->session.scheduler = server->scheduler;
+  client->session.thread_setup = server->thread_setup;
+  client->session.context.on_info = client_on_search_info;
+  client->session.context.userdata = client;
+  pthread_mutex_init(&client->lock, NULL);
+  pthread_mutex_init(&client->send_lock, NULL);
+  ILOG("Client %p connected\n", client);
+  return client;
+}
+
+static void client_free(Client* client)
+{
+  ILOG("Freeing client %p\n", client);
+#ifdef __linux__
+  connection_free(client->conn);
+#endif
+  session_free(&client->session);
+  pthread_mutex_destroy(&client->lock);
+  pthread_mutex_destroy(&client->send_lock);
+  free(client);
+}
+
+// Replies are built here rather than in a new allocation every time. Replies
+// are sent before the handler returns so each worker only needs the one.
+static byte* reply_data(u32 len)
+{
+  static _Thread_local byte* data;
+  static _Thread_local u32 cap;
+  if (len > cap)
+  {
+    cap = len;
+    data = realloc(data, len);
+  }
+  return data;
+}
+
+static void client_send(Client* client, Message mess)
+{
+  pthread_mutex_lock(&client->send_lock);
+#ifdef __linux__
+  connection_send(client->conn, mess);
+#else
+  message_send(mess, &client->sock_out);
+#endif
+  pthread_mutex_unlock(&client->send_lock);
+}
+
+// Called once we're done with a request's data
+static void client_release(Client* client, Message mess)
+{
+#ifdef __linux__
+  connection_release(client->conn, mess);
+#else
+  free(mess.data);
+#endif
+}
+
+// Requests that can safely be handled alongside each other
+static bool message_is_read_only(MessageType type)
+{
+  switch (type)
+  {
+  case MessageTypeMakeMoveRequest:
+  case MessageTypeBestMoveRequest:
+  case MessageTypeSetBoardRequest:
+  case MessageTypePromotionRequest:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Searches can take seconds so they're kept from holding up everything else
+static SchedulerPriority message_priority(MessageType type)
+{
+  return type == MessageTypeBestMoveRequest ? SchedulerPrioritySearch
+                                            : SchedulerPriorityInteractive;
+}
+
+static void* client_run(void* void_item);
+
+// Starts as many queued requests as we can. Must hold client->lock.
+static void client_dispatch(Client* client)
+{
+  while (client->queue_head && !client->writer)
+  {
+    MessageQueueItem* item = client->queue_head;
+    if (message_is_read_only(item->mess.type))
+      client->readers++;
+    else if (client->readers == 0)
+      client->writer = true;
+    else
+      break;
+
+    client->queue_head = item->next;
+    if (!client->queue_head)
+      client->queue_tail = NULL;
+
+    scheduler_queue(client->server->scheduler, message_priority(item->mess.type),
+                    client_run, item);
+  }
+}
+
+static bool client_is_idle(Client* client)
+{
+  return !client->queue_head && client->readers == 0 && !client->writer;
+}
+
+// Handles a single request then starts whatever it was holding up
+static void* client_run(void* void_item)
+{
+  MessageQueueItem* item = void_item;
+  Client* client = item->client;
+  if (client->server->thread_setup)
+    client->server->thread_setup();
+  bool read_only = message_is_read_only(item->mess.type);
+
+  message_handler(item);
+  free(item);
+
+  pthread_mutex_lock(&client->lock);
+  if (read_only)
+    client->readers--;
+  else
+    client->writer = false;
+  client_dispatch(client);
+  bool done = client->closed && client_is_idle(client);
+  pthread_mutex_unlock(&client->lock);
+
+  if (done)
+    client_free(client);
+
+  return NULL;
+}
+
+// Sends the progress of a search for our move to the client that asked for it
+static void client_on_search_info(SearchInfo* info, void* userdata)
+{
+  Client* client = userdata;
+  // Pondering searches with the same context, but nobody's waiting on that
+  if (atomic_load(&client->session.pondering))
+    return;
+
+  byte data[sizeof(WireSearchInfo) + SearchMaxPly * sizeof(WireMove)];
+  Message mess = {.type = MessageTypeSearchInfo, .data = data};
+  mess.len = message_search_info_to_wire(info, data);
+  memcpy(mess.guid, client->search_guid, sizeof(mess.guid));
+  client_send(client, mess);
+}
+
+void client_queue_message(Client* client, Message mess)
+{
+  // Numbered now so a stop also catches the searches still in the queue
+  if (mess.type == MessageTypeBestMoveRequest)
+    session_ask_search(&client->session);
+
+  MessageQueueItem* item = calloc(1, sizeof(*item));
+  item->client = client;
+  item->mess = mess;
+
+  // A stop can't wait behind the search it's meant to stop, so the search is
+  // stopped straight away. The reply is left to a worker so sending it never
+  // holds up this thread, and it skips the queue since it doesn't touch the
+  // game.
+  if (mess.type == MessageTypeStopSearchRequest)
+  {
+    item->stopped = session_stop_search(&client->session);
+    pthread_mutex_lock(&client->lock);
+    client->readers++;
+    pthread_mutex_unlock(&client->lock);
+    scheduler_queue(client->server->scheduler, message_priority(mess.type),
+                    client_run, item);
+    return;
+  }
+
+  pthread_mutex_lock(&client->lock);
+  if (client->queue_tail)
+    client->queue_tail->next = item;
+  else
+    client->queue_head = item;
+  client->queue_tail = item;
+  client_dispatch(client);
+  pthread_mutex_unlock(&client->lock);
+}
+
+// Called once a client has disconnected. The client is freed here or by the
+// last task to run for it, whichever finishes later.
+void client_close(Client* client)
+{
+  pthread_mutex_lock(&client->lock);
+  client->closed = true;
+  bool idle = client_is_idle(client);
+  pthread_mutex_unlock(&client->lock);
+
+  if (idle)
+    client_free(client);
+}
+
+#ifdef __linux__
+static void on_connect(Connection* conn)
+{
+  Client* client = client_new(conn->loop->userdata);
+  client->conn = conn;
+  conn->userdata = client;
+}
+
+static void on_message(Connection* conn, Message mess)
+{
+  client_queue_message(conn->userdata, mess);
+}
+
+static void on_close(Connection* conn)
+{
+  ILOG("Client %p disconnected\n", conn->userdata);
+  client_close(conn->userdata);
+}
+#else
+// Reads requests from a client until it disconnects
+static void* client_reader(void* void_client)
+{
+  Client* client = void_client;
+  if (client->server->thread_setup)
+    client->server->thread_setup();
+
+  for (;;)
+  {
+    if (!socket_is_connected(&client->sock_in) ||
+        !socket_is_connected(&client->sock_out))
+    {
+      ELOG("Socket lost connection\n");
+      break;
+    }
+
+    Message mess_in;
+    message_receive(&mess_in, &client->sock_in);
+    client_queue_message(client, mess_in);
+  }
+
+  client_close(client);
+  return NULL;
+}
+#endif
+
+// Packs a list of moves into a reply, moves is left for the caller to free
+static Message moves_reply(Array moves)
+{
+  Message mess = {0};
+  mess.len = moves.used * sizeof(WireMove);
+  mess.data = reply_data(mess.len);
+  u64 written = 0;
+  for (int i = 0; i < moves.capacity; i++)
+  {
+    if (!array_index_is_allocated(&moves, i))
+      continue;
+    WireMove wire = message_move_to_wire(*(Move*)array_get(&moves, i));
+    memcpy(mess.data + written, &wire, sizeof(wire));
+    written += sizeof(wire);
+  }
+  return mess;
+}
+
+// Logs the board as it is after a request changed it
+static void log_board(Session* session, char* what)
+{
+  BoardSnapshot* snapshot = session_snapshot_acquire(session);
+  ILOG("%s:\n%s\n", what, board_tostring(snapshot->board));
+  session_snapshot_release(session, snapshot);
+}
+
+static void message_handler(MessageQueueItem* item)
+{
+  Client* client = item->client;
+  Message mess_in = item->mess;
+  Message mess_out = {0};
+  Session* session = &client->session;
+  // Requests that only look at the board read this rather than session->board
+  // so they don't have to wait for the session's lock. Requests that change the
+  // game don't need it.
+  bool read_only = message_is_read_only(mess_in.type);
+  BoardSnapshot* snapshot = read_only ? session_snapshot_acquire(session) : NULL;
+  Board* board = snapshot ? &snapshot->board : NULL;
+
+  Move move;
+  int pos;
+  Array moves;
+  memset(&moves, 0, sizeof(moves));
+  switch (mess_in.type)
+  {
+  case MessageTypeLegalMoveRequest:
+    mess_out.type = MessageTypeLegalMoveReply;
+    mess_out.len = sizeof(int);
+    mess_out.data = reply_data(sizeof(int));
+    move = message_move_from_wire(mess_in.data);
+    // Promotions come separately in a PromotionRequest, so any piece will do
+    // to check the move
+    bool promoting = (board->state[move.from] & ChessPiecePawn) &&
+                     (torank64(move.to) == 0 || torank64(move.to) == 7);
+    move_set_promotion(&move, promoting ? ChessPieceQueen : ChessPieceNone);
+    // The client asks about whichever piece is dragged, not just the side to
+    // move's, which the session has the moves for
+    int response = session_is_legal(session, move);
+    memcpy(mess_out.data, &response, sizeof(int));
+    break;
+
+  case MessageTypeMakeMoveRequest:
+    mess_out.type = MessageTypeMakeMoveReply;
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    // Promotions come separately in a PromotionRequest
+    move = message_move_from_wire(mess_in.data);
+    move_set_promotion(&move, ChessPieceNone);
+    ILOG("Client move: %s\n", move_tostring(move));
+    session_make_move(session, move);
+    log_board(session, "Board Updated");
+    break;
+
+  case MessageTypeBestMoveRequest:
+    mess_out.type = MessageTypeBestMoveReply;
+    mess_out.len = sizeof(WireMove);
+    mess_out.data = reply_data(mess_out.len);
+    memcpy(client->search_guid, mess_in.guid, sizeof(client->search_guid));
+    move = session_best_move(session);
+    ILOG("Server move: %s\n", move_tostring(move));
+    log_board(session, "Board Updated");
+    WireMove wire = message_move_to_wire(move);
+    memcpy(mess_out.data, &wire, mess_out.len);
+    break;
+
+  case MessageTypeBoardStateRequest:
+    mess_out.type = MessageTypeBoardStateReply;
+    mess_out.len = 64 * sizeof(s32);
+    mess_out.data = reply_data(mess_out.len);
+    message_board_state_to_wire(*board, mess_out.data);
+    break;
+
+  case MessageTypeGetMovesRequest:
+    memcpy(&pos, mess_in.data, sizeof(pos));
+    moves = session_get_moves(session, pos);
+    mess_out = moves_reply(moves);
+    mess_out.type = MessageTypeGetMovesReply;
+    break;
+
+  // Sets the board from a FEN string
+  case MessageTypeSetBoardRequest:
+    mess_out.type = MessageTypeSetBoardReply;
+    // The data lives in the receive buffer so it might not be terminated
+    char* fen = strndup((char*)mess_in.data, mess_in.len);
+    session_set_board(session, fen);
+    free(fen);
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    log_board(session, "Board Set");
+    break;
+
+  // @@FIXME This will mess up precomputation since promoting after move.
+  case MessageTypePromotionRequest:
+    mess_out.type = MessageTypePromotionReply;
+    ChessPiece piece;
+    memcpy(&piece, mess_in.data, sizeof(piece));
+    ILOG("Promoting to: %d\n", piece);
+    session_promote(session, piece);
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    log_board(session, "Board Promotion");
+    break;
+  case MessageTypeIsInCheckRequest:
+    mess_out.type = MessageTypeIsInCheckReply;
+    mess_out.len = 2;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = is_in_check(*board, true);
+    mess_out.data[1] = is_in_check(*board, false);
+    break;
+
+  case MessageTypeIsInCheckmateRequest:
+    if (mess_in.len != 1)
+      ELOG("MessageTypeIsInCheckmateRequest does not have length of 1.");
+    bool is_white = mess_in.data[0];
+    mess_out.type = MessageTypeIsInCheckmateReply;
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = is_in_checkmate(*board, is_white);
+    break;
+  case MessageTypeIsInStalemateRequest:
+    if (mess_in.len != 1)
+      ELOG("MessageTypeIsInCheckmateRequest does not have length of 1.");
+    is_white = mess_in.data[0];
+    mess_out.type = MessageTypeIsInStalemateReply;
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = is_in_stalemate(*board, is_white);
+    break;
+
+  case MessageTypeCheckInfoRequest:
+    if (mess_in.len != 1)
+      ELOG("MessageTypeCheckInfoRequest does not have length of 1.");
+    is_white = mess_in.data[0];
+    mess_out.type = MessageTypeCheckInfoReply;
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = get_check_info(*board, is_white);
+    break;
+
+  // Every legal move for the side to move
+  case MessageTypeGetAllMovesRequest:
+    moves = board_get_moves_all(*board, board->white_to_move ? GetMovesWhite
+                                                             : GetMovesBlack);
+    mess_out = moves_reply(moves);
+    mess_out.type = MessageTypeGetAllMovesReply;
+    break;
+
+  // Check info indexed by colour, i.e. data[isWhite]
+  case MessageTypeCheckInfoBothRequest:
+    mess_out.type = MessageTypeCheckInfoBothReply;
+    mess_out.len = 2;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = get_check_info(*board, false);
+    mess_out.data[1] = get_check_info(*board, true);
+    break;
+
+  // Evaluates a list of null separated FEN strings, independent of the game
+  case MessageTypeEvaluateRequest:
+    mess_out.type = MessageTypeEvaluateReply;
+    mess_out.len = 0;
+    for (u32 i = 0; i < mess_in.len; i++)
+      if (mess_in.data[i] != '\0' &&
+          (i == mess_in.len - 1 || mess_in.data[i + 1] == '\0'))
+        mess_out.len += sizeof(s32);
+    mess_out.data = reply_data(mess_out.len);
+
+    u32 offset = 0;
+    for (u32 i = 0; offset < mess_in.len; offset++)
+    {
+      size_t fen_len = strnlen((char*)mess_in.data + offset,
+                               mess_in.len - offset);
+      if (fen_len == 0)
+        continue;
+
+      char* fen = strndup((char*)mess_in.data + offset, fen_len);
+      Board fen_board;
+      s32 value = board_new(&fen_board, fen) ? evaluate_board(fen_board)
+                                             : EvaluateInvalidFen;
+      free(fen);
+      memcpy(mess_out.data + i++ * sizeof(value), &value, sizeof(value));
+      offset += fen_len;
+    }
+    break;
+
+  // Counters from the last BestMoveRequest, laid out like SearchStats
+  case MessageTypeSearchStatsRequest:
+    mess_out.type = MessageTypeSearchStatsReply;
+    mess_out.len = sizeof(session->stats);
+    mess_out.data = reply_data(mess_out.len);
+    memcpy(mess_out.data, &session->stats, mess_out.len);
+    break;
+
+  // The profiling zones so far, for every client. Ask for the Chrome trace
+  // with a first byte of 1.
+  case MessageTypeProfileReportRequest:
+  {
+    ProfileFormat format = mess_in.len > 0 && mess_in.data[0] == 1
+                               ? ProfileFormatChrome
+                               : ProfileFormatText;
+    char* report = profile_report_string(format);
+    mess_out.type = MessageTypeProfileReportReply;
+    mess_out.len = report ? strlen(report) + 1 : 0;
+    mess_out.data = reply_data(mess_out.len);
+    if (report)
+      memcpy(mess_out.data, report, mess_out.len);
+    free(report);
+    break;
+  }
+
+  // The search for our move was stopped as the request came in, and it still
+  // sends its BestMoveReply with the best move found so far. data[0] says
+  // whether there was one.
+  case MessageTypeStopSearchRequest:
+    mess_out.type = MessageTypeStopSearchReply;
+    mess_out.len = 1;
+    mess_out.data = reply_data(mess_out.len);
+    mess_out.data[0] = item->stopped;
+    break;
+
+  // Queue lengths and waits for each SchedulerPriority, for every client
+  case MessageTypeSchedulerStatsRequest:
+  {
+    SchedulerStats stats[SchedulerPriorityCount];
+    scheduler_get_stats(client->server->scheduler, stats);
+    mess_out.type = MessageTypeSchedulerStatsReply;
+    mess_out.len = sizeof(stats);
+    mess_out.data = reply_data(mess_out.len);
+    memcpy(mess_out.data, stats, mess_out.len);
+    break;
+  }
+
+  // The best move cache shared by every client, zeroed if there isn't one
+  case MessageTypeResultCacheStatsRequest:
+  {
+    ResultCacheStats stats = {0};
+    if (client->server->results)
+      stats = result_cache_stats(client->server->results);
+    mess_out.type = MessageTypeResultCacheStatsReply;
+    mess_out.len = sizeof(stats);
+    mess_out.data = reply_data(mess_out.len);
+    memcpy(mess_out.data, &stats, mess_out.len);
+    break;
+  }
+
+  default:
+    WLOG("Unknown message type %d\n", mess_in.type);
+    break;
+  }
+  if (snapshot)
+    session_snapshot_release(session, snapshot);
+
+  memcpy(mess_out.guid, mess_in.guid, sizeof(mess_in.guid));
+  client_send(client, mess_out);
+  client_release(client, mess_in);
+  array_free(&moves);
+}
+
+#ifdef __linux__
+EventLoopCallbacks server_callbacks()
+{
+  EventLoopCallbacks callbacks = {
+      .on_connect = on_connect,
+      .on_message = on_message,
+      .on_close = on_close,
+  };
+  return callbacks;
+}
+#endif
+
+int server_run(Server* server, char* requests_name, char* replies_name)
+{
+#ifdef __linux__
+  EventLoop loop;
+  if (eventloop_new(&loop, requests_name, replies_name, server_callbacks()))
+    return 1;
+  loop.userdata = server;
+  eventloop_run(&loop);
+  eventloop_free(&loop);
+  return 0;
+#else
+  for (;;)
+  {
+    Socket sock_in;
+    Socket sock_out;
+    socket_init(&sock_in, requests_name, SocketServer);
+    socket_init(&sock_out, replies_name, SocketServer);
+
+    while (socket_connect(&sock_in))
+      sleep_ms(200);
+    while (socket_connect(&sock_out))
+      sleep_ms(200);
+
+    Client* client = client_new(server);
+    client->sock_in = sock_in;
+    client->sock_out = sock_out;
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, client_reader, client);
+    pthread_detach(reader);
+  }
+#endif
+}
@@ -0,0 +1,424 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/move.h>
+#include <chess/session.h>
+#include <chess/tree.h>
+#include <chess/util.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Throws away the search tree and starts a new one at the current board. The
+// search context is kept since the hash table is keyed by position anyway.
+static void session_reset_tree(Session* session)
+{
+  if (session->tree)
+    tree_free(&session->tree);
+  Node* root = node_new(NULL, move_new(-1, -1), session->board.white_to_move);
+  session->tree = tree_new(root, session->board, session->depth);
+  session->tree->context = &session->context;
+}
+
+// Makes the board as it is now the one readers see. Must be called with the
+// lock held after every change to the board.
+static void session_publish(Session* session)
+{
+  BoardSnapshot* snapshot = malloc(sizeof(*snapshot));
+  snapshot->board = session->board;
+  snapshot->version = ++session->board_version;
+  snapshot->readers = 0;
+  snapshot->replaced = false;
+
+  pthread_mutex_lock(&session->snapshot_lock);
+  BoardSnapshot* old = session->snapshot;
+  session->snapshot = snapshot;
+  if (old && old->readers > 0)
+  {
+    old->replaced = true;
+    session->replaced++;
+    old = NULL;
+  }
+  pthread_mutex_unlock(&session->snapshot_lock);
+  free(old);
+}
+
+// Lines the context's killers up with a search rooted root_plies into the game
+static void session_age_context(Session* session, u64 root_plies)
+{
+  if (root_plies != session->context_plies)
+    search_context_age(&session->context,
+                       (int)(root_plies - session->context_plies));
+  session->context_plies = root_plies;
+}
+
+typedef enum
+{
+  SessionPonderQueued,
+  SessionPonderRunning,
+  SessionPonderDone,
+  SessionPonderCancelled,
+} SessionPonderState;
+
+// Owned by the session once it's running, but by the task until then, since
+// the session may have stopped pondering and gone before a worker gets to it
+struct SessionPonder
+{
+  Session* session;
+  _Atomic(SessionPonderState) state;
+};
+
+static void* session_ponder(void* void_ponder)
+{
+  SessionPonder* ponder = void_ponder;
+  SessionPonderState queued = SessionPonderQueued;
+  if (!atomic_compare_exchange_strong(&ponder->state, &queued,
+                                      SessionPonderRunning))
+  {
+    free(ponder);
+    return NULL;
+  }
+
+  Session* session = ponder->session;
+  if (session->thread_setup)
+    session->thread_setup();
+  search(session->tree);
+
+  pthread_mutex_lock(&session->ponder_lock);
+  atomic_store(&ponder->state, SessionPonderDone);
+  pthread_cond_signal(&session->ponder_done);
+  pthread_mutex_unlock(&session->ponder_lock);
+  return NULL;
+}
+
+static void session_ponder_start(Session* session)
+{
+  if (!session->scheduler)
+    return;
+  Move reply = node_get_best_move(*session->tree->root);
+  if (move_equals(reply, move_new(-1, -1)))
+    return;
+
+  session->ponder_move = reply;
+  search_context_push_position(&session->context, session->board);
+  tree_advance(session->tree, reply);
+  session->tree->depth = session->depth;
+  session_age_context(session, session->plies + 1);
+
+  DLOG("Pondering on %s\n", move_tostring(reply));
+  atomic_store(&session->pondering, true);
+  session->ponder = malloc(sizeof(*session->ponder));
+  session->ponder->session = session;
+  atomic_init(&session->ponder->state, SessionPonderQueued);
+  scheduler_queue(session->scheduler, SchedulerPrioritySearch, session_ponder,
+                  session->ponder);
+}
+
+static void session_ponder_stop(Session* session)
+{
+  if (!atomic_load(&session->pondering))
+    return;
+
+  // If it hasn't started it never will, and we mustn't wait for it since we
+  // may be holding up the only worker that could run it
+  SessionPonderState queued = SessionPonderQueued;
+  if (!atomic_compare_exchange_strong(&session->ponder->state, &queued,
+                                      SessionPonderCancelled))
+  {
+    atomic_store(&session->context.stop, true);
+    pthread_mutex_lock(&session->ponder_lock);
+    while (atomic_load(&session->ponder->state) != SessionPonderDone)
+      pthread_cond_wait(&session->ponder_done, &session->ponder_lock);
+    pthread_mutex_unlock(&session->ponder_lock);
+    atomic_store(&session->context.stop, false);
+    free(session->ponder);
+  }
+  session->ponder = NULL;
+
+  search_context_pop_position(&session->context);
+  atomic_store(&session->pondering, false);
+}
+
+void session_new(Session* session, char* fen, int depth)
+{
+  board_new(&session->board, fen);
+  session->board_version = 0;
+  session->moves.board_version = 0;
+  session->snapshot = NULL;
+  session->replaced = 0;
+  pthread_mutex_init(&session->snapshot_lock, NULL);
+  session_publish(session);
+  pthread_mutex_init(&session->moves_lock, NULL);
+  session->depth = depth;
+  session->tree = NULL;
+  session->book = NULL;
+  session->results = NULL;
+  session->scheduler = NULL;
+  session->thread_setup = NULL;
+  atomic_init(&session->pondering, false);
+  session->ponder = NULL;
+  pthread_mutex_init(&session->ponder_lock, NULL);
+  pthread_cond_init(&session->ponder_done, NULL);
+  memset(&session->stats, 0, sizeof(session->stats));
+  session->plies = 0;
+  session->context_plies = 0;
+  search_context_new(&session->context, SearchDefaultHashMb);
+  session->searches_asked = 0;
+  session->searches_started = 0;
+  session->searches_stopped = 0;
+  session->searching = false;
+  pthread_mutex_init(&session->stop_lock, NULL);
+  pthread_mutex_init(&session->lock, NULL);
+  session_reset_tree(session);
+}
+
+void session_free(Session* session)
+{
+  session_ponder_stop(session);
+  tree_free(&session->tree);
+  search_context_free(&session->context);
+  pthread_mutex_destroy(&session->ponder_lock);
+  pthread_cond_destroy(&session->ponder_done);
+  pthread_mutex_destroy(&session->stop_lock);
+  pthread_mutex_destroy(&session->moves_lock);
+  pthread_mutex_destroy(&session->lock);
+  pthread_mutex_destroy(&session->snapshot_lock);
+  free(session->snapshot);
+}
+
+void session_set_board(Session* session, char* fen)
+{
+  pthread_mutex_lock(&session->lock);
+  session_ponder_stop(session);
+  board_new(&session->board, fen);
+  session_publish(session);
+  session->plies = session->context_plies = 0;
+  search_context_clear_positions(&session->context);
+  session_reset_tree(session);
+  pthread_mutex_unlock(&session->lock);
+}
+
+void session_make_move(Session* session, Move move)
+{
+  pthread_mutex_lock(&session->lock);
+  bool was_pondering = atomic_load(&session->pondering);
+  session_ponder_stop(session);
+
+  search_context_push_position(&session->context, session->board);
+  board_update(&session->board, &move);
+  session_publish(session);
+  session->plies++;
+
+  if (!was_pondering)
+    tree_advance(session->tree, move);
+  else if (move_equals(move, session->ponder_move))
+    DLOG("Ponder hit on %s\n", move_tostring(move));
+  else
+    session_reset_tree(session);
+
+  pthread_mutex_unlock(&session->lock);
+}
+
+// @@FIXME This will mess up precomputation since promoting after move.
+void session_promote(Session* session, ChessPiece piece)
+{
+  pthread_mutex_lock(&session->lock);
+  session_ponder_stop(session);
+
+  Board* board = &session->board;
+  for (int i = 0; i < 8; i++)
+    if (board->state[i] & ChessPiecePawn)
+      board->state[i] = piece | (board->state[i] & ChessPieceIsWhite);
+  for (int i = topos64(0x70); i < 64; i++)
+    if (board->state[i] & ChessPiecePawn)
+      board->state[i] = piece | (board->state[i] & ChessPieceIsWhite);
+  session_publish(session);
+
+  // The tree was built without the promotion so we can't reuse it
+  session_reset_tree(session);
+  pthread_mutex_unlock(&session->lock);
+}
+
+Move session_best_move(Session* session)
+{
+  pthread_mutex_lock(&session->lock);
+  session_ponder_stop(session);
+
+  pthread_mutex_lock(&session->stop_lock);
+  session->searching = true;
+  u64 number = ++session->searches_started;
+  atomic_store(&session->context.stop, number <= session->searches_stopped);
+  pthread_mutex_unlock(&session->stop_lock);
+
+  // Cached results don't know about this game's earlier positions, so they
+  // could walk into a repetition the search would avoid or avoid one it would
+  // walk into. Only once there's been a capture or pawn move since the last of
+  // them can nothing come round again.
+  bool has_history =
+      session->board.halfmove_clock > 0 && session->context.nkeys > 0;
+  ResultCache* results = has_history ? NULL : session->results;
+
+  Move move = book_probe(session->book, session->board);
+  ResultEntry result;
+  if (!move_equals(move, move_new(-1, -1)))
+  {
+    DLOG("Book move %s\n", move_tostring(move));
+    memset(&session->stats, 0, sizeof(session->stats));
+  }
+  else if (result_cache_probe(results, session->board, session->depth,
+                              &result) &&
+           board_is_legal(&session->board, result.move))
+  {
+    move = result.move;
+    DLOG("Cached move %s\n", move_tostring(move));
+    memset(&session->stats, 0, sizeof(session->stats));
+  }
+  else
+  {
+    // Nothing to do after a ponder hit, that search was already rooted here
+    session_age_context(session, session->plies);
+    session->tree->depth = session->depth;
+    move = search(session->tree);
+    // Pondering is about to reuse the context's copy
+    session->stats = session->context.stats;
+
+    // A stopped search didn't get to the depth the cache is keyed by, and it
+    // may not have finished a single iteration
+    if (!atomic_load(&session->context.stop))
+      result_cache_store(results, session->board, session->depth, move,
+                         session->context.info.value, session->stats.depth);
+    else if (move_is_null(move))
+    {
+      Array moves = board_get_moves_all(session->board,
+                                        session->board.white_to_move
+                                            ? GetMovesWhite
+                                            : GetMovesBlack);
+      if (moves.used)
+        move = *(Move*)array_get(&moves, 0);
+      array_free(&moves);
+    }
+  }
+
+  pthread_mutex_lock(&session->stop_lock);
+  session->searching = false;
+  atomic_store(&session->context.stop, false);
+  pthread_mutex_unlock(&session->stop_lock);
+
+  if (!move_equals(move, move_new(-1, -1)))
+  {
+    search_context_push_position(&session->context, session->board);
+    board_update(&session->board, &move);
+    session_publish(session);
+    session->plies++;
+    tree_advance(session->tree, move);
+    session_ponder_start(session);
+  }
+
+  pthread_mutex_unlock(&session->lock);
+  return move;
+}
+
+// Called as each session_best_move is asked for, in the same order they'll run
+void session_ask_search(Session* session)
+{
+  pthread_mutex_lock(&session->stop_lock);
+  session->searches_asked++;
+  pthread_mutex_unlock(&session->stop_lock);
+}
+
+// Stops the running search for our move, which returns the best move found so
+// far, and makes any that have been asked for but not started return at once
+/// @return Whether there was anything to stop
+bool session_stop_search(Session* session)
+{
+  pthread_mutex_lock(&session->stop_lock);
+  bool stopped = session->searching ||
+                 session->searches_asked > session->searches_started;
+  session->searches_stopped = session->searches_asked;
+  if (session->searching)
+    atomic_store(&session->context.stop, true);
+  pthread_mutex_unlock(&session->stop_lock);
+  return stopped;
+}
+
+// The board as of its last change. It stays valid, and the same, until it's
+// given back with session_snapshot_release, however the game moves on.
+BoardSnapshot* session_snapshot_acquire(Session* session)
+{
+  pthread_mutex_lock(&session->snapshot_lock);
+  BoardSnapshot* snapshot = session->snapshot;
+  snapshot->readers++;
+  pthread_mutex_unlock(&session->snapshot_lock);
+  return snapshot;
+}
+
+void session_snapshot_release(Session* session, BoardSnapshot* snapshot)
+{
+  pthread_mutex_lock(&session->snapshot_lock);
+  bool done = --snapshot->readers == 0 && snapshot->replaced;
+  if (done)
+    session->replaced--;
+  pthread_mutex_unlock(&session->snapshot_lock);
+  if (done)
+    free(snapshot);
+}
+
+// Works out the moves again if they're for a different snapshot. Must be
+// called with moves_lock held.
+static SessionMoves* session_moves(Session* session, BoardSnapshot* snapshot)
+{
+  SessionMoves* cache = &session->moves;
+  if (cache->board_version == snapshot->version)
+    return cache;
+
+  // board_get_moves_all goes through the squares in order, so the moves come
+  // out already grouped by the square they're from
+  Array moves = board_get_moves_all(snapshot->board,
+                                    GetMovesWhite | GetMovesBlack);
+  int n = 0;
+  for (int pos = 0; pos < 64; pos++)
+  {
+    cache->first[pos] = n;
+    while (n < moves.used && n < SessionMaxMoves &&
+           array_get_as(&moves, n, Move).from == pos)
+    {
+      cache->moves[n] = array_get_as(&moves, n, Move);
+      n++;
+    }
+  }
+  cache->first[64] = n;
+  array_free(&moves);
+
+  cache->board_version = snapshot->version;
+  return cache;
+}
+
+Array session_get_moves(Session* session, int pos)
+{
+  Array moves;
+  array_new(&moves, 32, sizeof(Move));
+  if (pos < 0 || pos >= 64)
+    return moves;
+
+  BoardSnapshot* snapshot = session_snapshot_acquire(session);
+  pthread_mutex_lock(&session->moves_lock);
+  SessionMoves* cache = session_moves(session, snapshot);
+  for (int i = cache->first[pos]; i < cache->first[pos + 1]; i++)
+    array_push(&moves, &cache->moves[i]);
+  pthread_mutex_unlock(&session->moves_lock);
+  session_snapshot_release(session, snapshot);
+  return moves;
+}
+
+bool session_is_legal(Session* session, Move move)
+{
+  bool legal = false;
+  BoardSnapshot* snapshot = session_snapshot_acquire(session);
+  pthread_mutex_lock(&session->moves_lock);
+  SessionMoves* cache = session_moves(session, snapshot);
+  for (int i = cache->first[move.from]; i < cache->first[move.from + 1]; i++)
+    legal = legal || move_equals(cache->moves[i], move);
+  pthread_mutex_unlock(&session->moves_lock);
+  session_snapshot_release(session, snapshot);
+  return legal;
+}
@@ -0,0 +1,955 @@
+#include <rgl/logging.h>
+
+#include <chess/board.h>
+#include <chess/move.h>
+#include <chess/piece.h>
+#include <chess/tablebase.h>
+#include <chess/util.h>
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char tablebase_magic[4] = {'C', 'T', 'B', '1'};
+
+void tablebase_new(Tablebase* tb, char* path)
+{
+  memset(tb, 0, sizeof(*tb));
+  tb->path = strdup(path);
+  tb->max_pieces = TablebaseMaxPieces;
+  atomic_init(&tb->tables, NULL);
+  pthread_mutex_init(&tb->lock, NULL);
+}
+
+void tablebase_free(Tablebase* tb)
+{
+  TablebaseTable* table = atomic_load(&tb->tables);
+  while (table)
+  {
+    TablebaseTable* next = table->next;
+    if (table->data)
+      unmap_file(table->data, table->size);
+    free(table);
+    table = next;
+  }
+  free(tb->path);
+  pthread_mutex_destroy(&tb->lock);
+}
+
+int tablebase_count_pieces(Board board)
+{
+  int count = 0;
+  for (int i = 0; i < 64; i++)
+    if (board.state[i] != ChessPieceNone)
+      count++;
+  return count;
+}
+
+// Same position with the colours swapped and the board turned upside down
+static Board tablebase_flip(Board board)
+{
+  Board flipped = board;
+  for (int i = 0; i < 64; i++)
+  {
+    ChessPiece piece = board.state[i];
+    flipped.state[i ^ 56] =
+        piece == ChessPieceNone ? piece : piece ^ ChessPieceIsWhite;
+  }
+  flipped.white_to_move = !board.white_to_move;
+  if (board.en_passant_tile >= 0 && board.en_passant_tile < 64)
+    flipped.en_passant_tile = board.en_passant_tile ^ 56;
+  for (int i = 0; i < 2; i++)
+  {
+    flipped.can_castle_qs[i] = board.can_castle_qs[!i];
+    flipped.can_castle_ks[i] = board.can_castle_ks[!i];
+  }
+  return flipped;
+}
+
+// Strongest first, since the piece values go king, queen, rook, bishop,
+// knight, pawn. Pieces of the same kind are ordered by square.
+static int tablebase_side(Board board, bool white, u8* squares)
+{
+  int n = 0;
+  for (int i = 0; i < 64; i++)
+  {
+    ChessPiece piece = board.state[i];
+    if (piece == ChessPieceNone || !(piece & ChessPieceIsWhite) != !white)
+      continue;
+    if (n == TablebaseMaxPieces)
+      return n + 1;
+    int j = n++;
+    for (; j > 0 && board.state[squares[j - 1]] < piece; j--)
+      squares[j] = squares[j - 1];
+    squares[j] = i;
+  }
+  return n;
+}
+
+// Puts the squares of the pieces in signature order, flipping the board first
+// if black is the stronger side.
+/// @return The number of pieces or -1 if there are too many for a table
+int tablebase_sort_pieces(Board* board, u8* squares)
+{
+  u8 white[TablebaseMaxPieces + 1];
+  u8 black[TablebaseMaxPieces + 1];
+  int nwhite = tablebase_side(*board, true, white);
+  int nblack = tablebase_side(*board, false, black);
+  if (nwhite + nblack > TablebaseMaxPieces)
+    return -1;
+
+  bool black_stronger = nblack > nwhite;
+  for (int i = 0; nblack == nwhite && i < nwhite; i++)
+  {
+    ChessPiece w = board->state[white[i]] & ~ChessPieceIsWhite;
+    ChessPiece b = board->state[black[i]];
+    if (w != b)
+    {
+      black_stronger = b > w;
+      break;
+    }
+  }
+
+  if (black_stronger)
+  {
+    *board = tablebase_flip(*board);
+    return tablebase_sort_pieces(board, squares);
+  }
+
+  memcpy(squares, white, nwhite);
+  memcpy(squares + nwhite, black, nblack);
+  return nwhite + nblack;
+}
+
+// e.g. KRvKN, always with the stronger side first
+void tablebase_signature(Board board, char* signature)
+{
+  u8 squares[TablebaseMaxPieces];
+  int npieces = tablebase_sort_pieces(&board, squares);
+  char* c = signature;
+  for (int i = 0; i < npieces; i++)
+  {
+    ChessPiece piece = board.state[squares[i]];
+    if (i > 0 && !(piece & ChessPieceIsWhite) &&
+        (board.state[squares[i - 1]] & ChessPieceIsWhite))
+      *c++ = 'v';
+    *c++ = toupper(piece_to_char(piece));
+  }
+  *c = '\0';
+}
+
+u64 tablebase_index(u8* squares, int npieces)
+{
+  u64 index = 0;
+  for (int i = 0; i < npieces; i++)
+    index = index * 64 + squares[i];
+  return index;
+}
+
+// The other way round from tablebase_signature
+/// @return The number of pieces or -1 if the signature doesn't make sense
+int tablebase_parse_signature(char* signature, ChessPiece* pieces)
+{
+  int npieces = 0;
+  bool white = true;
+  for (char* c = signature; *c; c++)
+  {
+    if (*c == 'v' && white)
+    {
+      white = false;
+      continue;
+    }
+    if (npieces == TablebaseMaxPieces || !strchr("KQRBNP", *c))
+      return -1;
+    pieces[npieces++] =
+        piece_from_char(tolower(*c)) | (white ? ChessPieceIsWhite : 0);
+  }
+  return white ? -1 : npieces;
+}
+
+// Sets up the position at index in a table of the given pieces
+/// @return false if two pieces share a square or a pawn is on a back rank
+bool tablebase_board(ChessPiece* pieces, int npieces, u64 index,
+                     bool white_to_move, Board* board)
+{
+  memset(board, 0, sizeof(*board));
+  board->white_to_move = white_to_move;
+  board->en_passant_tile = -1;
+  board->fullmove_count = 1;
+  for (int i = npieces - 1; i >= 0; i--, index /= 64)
+  {
+    int pos = index % 64;
+    bool back_rank = torank64(pos) == 0 || torank64(pos) == 7;
+    if (board->state[pos] != ChessPieceNone ||
+        ((pieces[i] & ChessPiecePawn) && back_rank))
+      return false;
+    board->state[pos] = pieces[i];
+  }
+  return true;
+}
+
+byte tablebase_entry(TablebaseResult result)
+{
+  switch (result.wdl)
+  {
+  case TablebaseWdlWin:
+    return result.plies;
+  case TablebaseWdlLoss:
+    return TablebaseEntryLoss + result.plies;
+  default:
+    return TablebaseEntryDraw;
+  }
+}
+
+TablebaseResult tablebase_result(byte entry)
+{
+  if (entry == TablebaseEntryDraw)
+    return (TablebaseResult){TablebaseWdlDraw, 0};
+  if (entry < TablebaseEntryLoss)
+    return (TablebaseResult){TablebaseWdlWin, entry};
+  return (TablebaseResult){TablebaseWdlLoss, entry - TablebaseEntryLoss};
+}
+
+// Writes a table for the generator. Entries are all the white to move ones
+// followed by the black to move ones.
+/// @return 0 on success
+int tablebase_write(char* path, ChessPiece* pieces, int npieces,
+                    byte* entries, u64 nentries)
+{
+  FILE* f = fopen(path, "wb");
+  if (!f)
+  {
+    ELOG("Couldn't open %s\n", path);
+    return -1;
+  }
+
+  TablebaseHeader header = {.npieces = npieces, .nentries = nentries};
+  memcpy(header.magic, tablebase_magic, sizeof(header.magic));
+  for (int i = 0; i < npieces; i++)
+    header.pieces[i] = pieces[i];
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(entries, 1, 2 * nentries, f) == 2 * nentries;
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+  {
+    ELOG("Couldn't write %s\n", path);
+    remove(path);
+    return -1;
+  }
+  return 0;
+}
+
+// Tables are mapped the first time they're asked for. A missing file is
+// remembered too so we don't go looking for it on every probe.
+static TablebaseTable* tablebase_table(Tablebase* tb, char* signature)
+{
+  for (TablebaseTable* table = atomic_load(&tb->tables); table;
+       table = table->next)
+    if (strcmp(table->signature, signature) == 0)
+      return table;
+
+  pthread_mutex_lock(&tb->lock);
+  // Someone else might have loaded it while we were waiting
+  TablebaseTable* head = atomic_load(&tb->tables);
+  for (TablebaseTable* table = head; table; table = table->next)
+  {
+    if (strcmp(table->signature, signature) == 0)
+    {
+      pthread_mutex_unlock(&tb->lock);
+      return table;
+    }
+  }
+
+  TablebaseTable* table = calloc(1, sizeof(*table));
+  strcpy(table->signature, signature);
+
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.ctb", tb->path, signature);
+  table->data = map_file(path, &table->size);
+  if (table->data)
+  {
+    TablebaseHeader* header = (TablebaseHeader*)table->data;
+    u64 expected = 1;
+    for (int i = 0; i < strlen(signature) - 1; i++)
+      expected *= 64;
+    bool valid = table->size >= sizeof(*header) &&
+                 memcmp(header->magic, tablebase_magic, 4) == 0 &&
+                 header->nentries == expected &&
+                 table->size == sizeof(*header) + 2 * header->nentries;
+    if (valid)
+    {
+      table->entries = (byte*)table->data + sizeof(*header);
+      table->nentries = header->nentries;
+      ILOG("Mapped tablebase %s\n", path);
+    }
+    else
+    {
+      ELOG("Ignoring broken tablebase %s\n", path);
+      unmap_file(table->data, table->size);
+      table->data = NULL;
+    }
+  }
+
+  table->next = head;
+  atomic_store(&tb->tables, table);
+  pthread_mutex_unlock(&tb->lock);
+  return table;
+}
+
+// The result for the side to move, ignoring the fifty move rule.
+/// @return false if the position isn't covered by the tables we have
+bool tablebase_probe(Tablebase* tb, Board board, TablebaseResult* result)
+{
+  // Tables don't know about castling or en passant
+  if (!tb || can_take_en_passant(board) || board.can_castle_qs[0] ||
+      board.can_castle_qs[1] || board.can_castle_ks[0] ||
+      board.can_castle_ks[1])
+    return false;
+
+  u8 squares[TablebaseMaxPieces];
+  int npieces = tablebase_sort_pieces(&board, squares);
+  if (npieces < 0 || npieces > tb->max_pieces)
+    return false;
+  // Two bare kings don't need a table
+  if (npieces == 2)
+  {
+    *result = (TablebaseResult){TablebaseWdlDraw, 0};
+    return true;
+  }
+
+  char signature[16];
+  tablebase_signature(board, signature);
+  TablebaseTable* table = tablebase_table(tb, signature);
+  if (!table->data)
+    return false;
+
+  u64 index = tablebase_index(squares, npieces);
+  if (!board.white_to_move)
+    index += table->nentries;
+  *result = tablebase_result(table->entries[index]);
+  return true;
+}
+
+// Picks the quickest win, or failing that a draw, or failing that the
+// slowest loss.
+/// @return false if the position or any of its replies isn't in the tables
+bool tablebase_root_move(Tablebase* tb, Board board, Move* move,
+                         TablebaseResult* result)
+{
+  TablebaseResult root;
+  if (!tablebase_probe(tb, board, &root))
+    return false;
+
+  Array moves = board_get_moves_all(
+      board, board.white_to_move ? GetMovesWhite : GetMovesBlack);
+  bool found = moves.used > 0;
+  int best_score = 0;
+  for (int i = 0; found && i < moves.used; i++)
+  {
+    Move child_move = *(Move*)array_get(&moves, i);
+    Board child = board;
+    board_update(&child, &child_move);
+
+    TablebaseResult reply;
+    if (!tablebase_probe(tb, child, &reply))
+    {
+      found = false;
+      break;
+    }
+
+    TablebaseResult ours = {-reply.wdl, reply.plies + 1};
+    if (ours.wdl == TablebaseWdlDraw)
+      ours.plies = 0;
+    int score = tablebase_score(ours, true);
+    if (i == 0 || score > best_score)
+    {
+      best_score = score;
+      *move = child_move;
+      *result = ours;
+    }
+  }
+  array_free(&moves);
+  return found;
+}
+
+// As a search value from white's point of view. Quicker wins score higher.
+int tablebase_score(TablebaseResult result, bool white_to_move)
+{
+  int score = 0;
+  if (result.wdl == TablebaseWdlWin)
+    score = TablebaseWinScore - result.plies;
+  else if (result.wdl == TablebaseWdlLoss)
+    score = -TablebaseWinScore + result.plies;
+  return white_to_move ? score : -score;
+}
+
+/// {{{ Generation
+
+// Generates endgame tables by retrograde analysis.
+//
+// A first pass over every position uses board_get_moves_all to find the
+// mates and stalemates, count the moves that stay inside the table and look
+// up the ones that don't (captures and promotions) in the smaller tables.
+// After that we work backwards one ply at a time: anything that can move
+// into a position lost in n plies is won in n + 1, and anything whose moves
+// all lead to positions won by the opponent is lost once the last of them is
+// found. Whatever is left at the end is a draw.
+//
+// The backwards steps don't use the move generator, so the two have to agree
+// on which moves exist. Any disagreement shows up as a position running out
+// of moves twice, and --verify checks every position against its children
+// afterwards, which makes this a decent workout for board_get_moves.
+
+enum
+{
+  TbgenChunkSize = 1 << 14, // Positions per task
+  TbgenMaxPlies = TablebaseEntryLoss - 1,
+};
+
+typedef enum
+{
+  TbgenFlagIllegal = 1 << 0,
+  TbgenFlagStalemate = 1 << 1,
+  TbgenFlagCanDraw = 1 << 2,     // A capture or promotion draws
+  TbgenFlagPendingLoss = 1 << 3, // Lost in conv_loss plies
+} TbgenFlags;
+
+typedef struct Tbgen Tbgen;
+typedef void (*TbgenPass)(Tbgen* gen, u64 start, u64 end);
+
+struct Tbgen
+{
+  ThreadPool* pool;
+  Tablebase* tb; // For the tables captures and promotions lead to
+  char signature[16];
+  ChessPiece pieces[TablebaseMaxPieces];
+  int npieces;
+  u64 nentries; // Per side to move
+
+  // Indexed like the table, white to move first. Entries that are still 0
+  // haven't been resolved yet.
+  _Atomic(byte)* entries;
+  _Atomic(u8)* remaining; // Moves that stay in the table not yet known to
+                          // lose
+  _Atomic(u8)* flags;
+  u8* conv_win;  // Quickest win through a capture or promotion, 0 if none
+  u8* conv_loss; // Slowest loss through a capture or promotion, 0 if none
+
+  int ply; // Being resolved by the current pass
+  atomic_uint_fast64_t resolved;
+  atomic_uint_fast64_t errors;
+
+  // The tasks still running for the current pass
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  u64 ntasks;
+};
+
+typedef struct
+{
+  Tbgen* gen;
+  TbgenPass pass;
+  u64 start, end;
+} TbgenTask;
+
+static void* tbgen_task_run(void* void_task)
+{
+  TbgenTask* task = void_task;
+  Tbgen* gen = task->gen;
+  task->pass(gen, task->start, task->end);
+  free(task);
+
+  pthread_mutex_lock(&gen->lock);
+  if (--gen->ntasks == 0)
+    pthread_cond_signal(&gen->cond);
+  pthread_mutex_unlock(&gen->lock);
+  return NULL;
+}
+
+// Splits every position in the table between the pool and waits for them
+static void tbgen_run_pass(Tbgen* gen, TbgenPass pass)
+{
+  u64 total = 2 * gen->nentries;
+  pthread_mutex_lock(&gen->lock);
+  gen->ntasks = (total + TbgenChunkSize - 1) / TbgenChunkSize;
+  pthread_mutex_unlock(&gen->lock);
+
+  for (u64 start = 0; start < total; start += TbgenChunkSize)
+  {
+    TbgenTask* args = malloc(sizeof(*args));
+    *args = (TbgenTask){gen, pass, start, start + TbgenChunkSize};
+    if (args->end > total)
+      args->end = total;
+    Task* task = task_new(NULL, tbgen_task_run, args);
+    task->free_on_complete = true;
+    threadpool_queue_task(gen->pool, task);
+  }
+
+  pthread_mutex_lock(&gen->lock);
+  while (gen->ntasks > 0)
+    pthread_cond_wait(&gen->cond, &gen->lock);
+  pthread_mutex_unlock(&gen->lock);
+}
+
+static bool tbgen_board(Tbgen* gen, u64 i, Board* board)
+{
+  bool white = i < gen->nentries;
+  u64 index = white ? i : i - gen->nentries;
+  return tablebase_board(gen->pieces, gen->npieces, index, white, board);
+}
+
+static bool tbgen_resolve(Tbgen* gen, u64 i, TablebaseResult result)
+{
+  byte expected = 0;
+  if (!atomic_compare_exchange_strong(&gen->entries[i], &expected,
+                                      tablebase_entry(result)))
+    return false;
+  atomic_fetch_add(&gen->resolved, 1);
+  return true;
+}
+
+static void tbgen_first_pass(Tbgen* gen, u64 start, u64 end)
+{
+  for (u64 i = start; i < end; i++)
+  {
+    Board board;
+    if (!tbgen_board(gen, i, &board) ||
+        is_in_check(board, !board.white_to_move))
+    {
+      atomic_store(&gen->flags[i], TbgenFlagIllegal);
+      continue;
+    }
+
+    Array moves = board_get_moves_all(
+        board, board.white_to_move ? GetMovesWhite : GetMovesBlack);
+    u8 flags = 0;
+    u8 remaining = 0;
+    for (int j = 0; j < moves.used; j++)
+    {
+      Move move = *(Move*)array_get(&moves, j);
+      if (board.state[move.to] == ChessPieceNone && !move.promo)
+      {
+        remaining++;
+        continue;
+      }
+
+      // Anything else leaves the table
+      Board child = board;
+      board_update(&child, &move);
+      TablebaseResult reply;
+      if (!tablebase_probe(gen->tb, child, &reply))
+      {
+        char signature[16];
+        tablebase_signature(child, signature);
+        ELOG("%s: No table for %s\n", gen->signature, signature);
+        atomic_fetch_add(&gen->errors, 1);
+        continue;
+      }
+
+      int plies = reply.plies + 1;
+      if (plies > TbgenMaxPlies)
+        plies = TbgenMaxPlies;
+      if (reply.wdl == TablebaseWdlLoss &&
+          (!gen->conv_win[i] || plies < gen->conv_win[i]))
+        gen->conv_win[i] = plies;
+      else if (reply.wdl == TablebaseWdlWin && plies > gen->conv_loss[i])
+        gen->conv_loss[i] = plies;
+      else if (reply.wdl == TablebaseWdlDraw)
+        flags |= TbgenFlagCanDraw;
+    }
+
+    if (moves.used == 0)
+    {
+      if (is_in_check(board, board.white_to_move))
+        tbgen_resolve(gen, i, (TablebaseResult){TablebaseWdlLoss, 0});
+      else
+        flags |= TbgenFlagStalemate;
+    }
+    else if (remaining == 0 && !gen->conv_win[i] &&
+             !(flags & TbgenFlagCanDraw))
+      flags |= TbgenFlagPendingLoss;
+    array_free(&moves);
+
+    atomic_store(&gen->remaining[i], remaining);
+    atomic_store(&gen->flags[i], flags);
+  }
+}
+
+static int tbgen_step(int pos, int df, int dr)
+{
+  int file = tofile64(pos) + df;
+  int rank = torank64(pos) + dr;
+  if (file < 0 || file > 7 || rank < 0 || rank > 7)
+    return -1;
+  return topos64fr(file, rank);
+}
+
+static const int tbgen_knight[8][2] = {
+    {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2},
+};
+// Straight lines then diagonals
+static const int tbgen_dirs[8][2] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1},
+};
+
+// Where the piece in the given slot could have moved from to get here,
+// without capturing or promoting
+/// @return The number of squares written to from
+static int tbgen_unmoves(ChessPiece piece, int pos, bool* occupied, int* from)
+{
+  int n = 0;
+  if (piece & ChessPiecePawn)
+  {
+    // Ranks count down from black's side, so white pawns move up the board
+    bool white = piece & ChessPieceIsWhite;
+    int back = white ? 1 : -1;
+    int prev = tbgen_step(pos, 0, back);
+    int first_rank = white ? 6 : 1;
+    if (prev < 0 || occupied[prev])
+      return 0;
+    if (torank64(prev) != 0 && torank64(prev) != 7)
+      from[n++] = prev;
+    int prev2 = tbgen_step(prev, 0, back);
+    if (prev2 >= 0 && torank64(prev2) == first_rank && !occupied[prev2])
+      from[n++] = prev2;
+    return n;
+  }
+
+  bool jumps = piece & (ChessPieceKnight | ChessPieceKing);
+  int first_dir = piece & ChessPieceBishop ? 4 : 0;
+  int last_dir = piece & ChessPieceCastle ? 4 : 8;
+  for (int d = 0; d < 8; d++)
+  {
+    int df = piece & ChessPieceKnight ? tbgen_knight[d][0] : tbgen_dirs[d][0];
+    int dr = piece & ChessPieceKnight ? tbgen_knight[d][1] : tbgen_dirs[d][1];
+    if (!jumps && (d < first_dir || d >= last_dir))
+      continue;
+    for (int to = tbgen_step(pos, df, dr); to >= 0 && !occupied[to];
+         to = tbgen_step(to, df, dr))
+    {
+      from[n++] = to;
+      if (jumps)
+        break;
+    }
+  }
+  return n;
+}
+
+// The position at i was resolved on the last pass, so pass its result back
+// to every position that could have led to it
+static void tbgen_propagate(Tbgen* gen, u64 i, bool lost)
+{
+  bool white = i < gen->nentries;
+  u64 index = white ? i : i - gen->nentries;
+  u8 squares[TablebaseMaxPieces];
+  bool occupied[64] = {0};
+  for (int s = gen->npieces - 1; s >= 0; s--, index /= 64)
+  {
+    squares[s] = index % 64;
+    occupied[squares[s]] = true;
+  }
+
+  for (int s = 0; s < gen->npieces; s++)
+  {
+    // The side that just moved
+    if (!(gen->pieces[s] & ChessPieceIsWhite) != white)
+      continue;
+
+    int from[32];
+    int n = tbgen_unmoves(gen->pieces[s], squares[s], occupied, from);
+    u8 to = squares[s];
+    for (int j = 0; j < n; j++)
+    {
+      squares[s] = from[j];
+      u64 pred =
+          tablebase_index(squares, gen->npieces) + (white ? gen->nentries : 0);
+      if (atomic_load(&gen->flags[pred]) & TbgenFlagIllegal)
+        continue;
+
+      if (lost)
+      {
+        tbgen_resolve(gen, pred, (TablebaseResult){TablebaseWdlWin, gen->ply});
+        continue;
+      }
+
+      u8 left = atomic_fetch_sub(&gen->remaining[pred], 1);
+      if (left == 0)
+      {
+        // More moves were undone than board_get_moves_all made
+        ELOG("%s: Move generation disagrees at %llu\n", gen->signature,
+             (unsigned long long)pred);
+        atomic_fetch_add(&gen->errors, 1);
+      }
+      else if (left == 1 && !gen->conv_win[pred] &&
+               !(atomic_load(&gen->flags[pred]) & TbgenFlagCanDraw))
+      {
+        // A capture or promotion might hold out for longer
+        if (gen->conv_loss[pred] > gen->ply)
+          atomic_fetch_or(&gen->flags[pred], TbgenFlagPendingLoss);
+        else
+          tbgen_resolve(gen, pred,
+                        (TablebaseResult){TablebaseWdlLoss, gen->ply});
+      }
+    }
+    squares[s] = to;
+  }
+}
+
+static void tbgen_ply_pass(Tbgen* gen, u64 start, u64 end)
+{
+  int ply = gen->ply;
+  byte lost = tablebase_entry((TablebaseResult){TablebaseWdlLoss, ply - 1});
+  byte won = tablebase_entry((TablebaseResult){TablebaseWdlWin, ply - 1});
+  for (u64 i = start; i < end; i++)
+  {
+    byte entry = atomic_load(&gen->entries[i]);
+    if (entry == lost)
+      tbgen_propagate(gen, i, true);
+    else if (ply > 1 && entry == won)
+      tbgen_propagate(gen, i, false);
+    else if (entry == 0)
+    {
+      // Results that come from leaving the table, once their time comes
+      u8 flags = atomic_load(&gen->flags[i]);
+      if (gen->conv_win[i] == ply)
+        tbgen_resolve(gen, i, (TablebaseResult){TablebaseWdlWin, ply});
+      else if ((flags & TbgenFlagPendingLoss) && gen->conv_loss[i] <= ply)
+        tbgen_resolve(gen, i, (TablebaseResult){TablebaseWdlLoss, ply});
+    }
+  }
+}
+
+// Checks every position against the best of its children in the finished
+// table
+// What a position should be given its replies, like tablebase_root_move
+// except that a double push the other side could take en passant is probed as
+// if they couldn't, the same as the generator treats it
+/// @return false if a reply isn't in the tables
+static bool tbgen_expected(Tbgen* gen, Board board, TablebaseResult* expected)
+{
+  bool mated = is_in_check(board, board.white_to_move);
+  *expected = (TablebaseResult){mated ? TablebaseWdlLoss : TablebaseWdlDraw};
+
+  Array moves = board_get_moves_all(
+      board, board.white_to_move ? GetMovesWhite : GetMovesBlack);
+  bool found = true;
+  int best_score = 0;
+  for (int i = 0; i < moves.used; i++)
+  {
+    Move move = *(Move*)array_get(&moves, i);
+    Board child = board;
+    board_update(&child, &move);
+    child.en_passant_tile = -1;
+
+    TablebaseResult reply;
+    if (!tablebase_probe(gen->tb, child, &reply))
+    {
+      found = false;
+      break;
+    }
+
+    TablebaseResult ours = {-reply.wdl, reply.plies + 1};
+    if (ours.wdl == TablebaseWdlDraw)
+      ours.plies = 0;
+    int score = tablebase_score(ours, true);
+    if (i == 0 || score > best_score)
+    {
+      best_score = score;
+      *expected = ours;
+    }
+  }
+  array_free(&moves);
+  return found;
+}
+
+static void tbgen_verify_pass(Tbgen* gen, u64 start, u64 end)
+{
+  for (u64 i = start; i < end; i++)
+  {
+    Board board;
+    if (!tbgen_board(gen, i, &board) ||
+        is_in_check(board, !board.white_to_move))
+      continue;
+
+    TablebaseResult stored, expected;
+    tablebase_probe(gen->tb, board, &stored);
+    if (!tbgen_expected(gen, board, &expected))
+    {
+      ELOG("%s: Position %llu has a reply that isn't in the tables\n",
+           gen->signature, (unsigned long long)i);
+      atomic_fetch_add(&gen->errors, 1);
+      continue;
+    }
+    if (expected.plies > TbgenMaxPlies)
+      expected.plies = TbgenMaxPlies;
+
+    if (tablebase_entry(stored) != tablebase_entry(expected))
+    {
+      ELOG("%s: Position %llu should be %d in %d, table has %d in %d\n",
+           gen->signature, (unsigned long long)i, expected.wdl,
+           expected.plies, stored.wdl, stored.plies);
+      atomic_fetch_add(&gen->errors, 1);
+    }
+  }
+}
+
+// The signature in the order the probe expects
+static void tbgen_canonical(ChessPiece* pieces, int npieces, char* signature)
+{
+  Board board;
+  memset(&board, 0, sizeof(board));
+  board.en_passant_tile = -1;
+  // Away from the back ranks so that pawns are fine
+  for (int i = 0; i < npieces; i++)
+    board.state[16 + i] = pieces[i];
+  tablebase_signature(board, signature);
+}
+
+// Captures and promotions lead to these
+static int tbgen_generate_children(ThreadPool* pool, char* dir,
+                                   ChessPiece* pieces, int npieces,
+                                   bool verify)
+{
+  ChessPiece promotions[] = {ChessPieceQueen, ChessPieceCastle,
+                             ChessPieceBishop, ChessPieceKnight};
+  for (int s = 0; s < npieces; s++)
+  {
+    if (pieces[s] & ChessPieceKing)
+      continue;
+
+    ChessPiece child[TablebaseMaxPieces];
+    char signature[16];
+    memcpy(child, pieces, sizeof(child));
+    child[s] = child[npieces - 1];
+    tbgen_canonical(child, npieces - 1, signature);
+    if (tablebase_generate(pool, dir, signature, verify))
+      return -1;
+
+    for (int p = 0; (pieces[s] & ChessPiecePawn) && p < 4; p++)
+    {
+      memcpy(child, pieces, sizeof(child));
+      child[s] = promotions[p] | (pieces[s] & ChessPieceIsWhite);
+      tbgen_canonical(child, npieces, signature);
+      if (tablebase_generate(pool, dir, signature, verify))
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/// @return 0 on success
+int tablebase_generate(ThreadPool* pool, char* dir, char* signature,
+                       bool verify)
+{
+  Tbgen gen;
+  memset(&gen, 0, sizeof(gen));
+  gen.pool = pool;
+  gen.npieces = tablebase_parse_signature(signature, gen.pieces);
+  if (gen.npieces < 2)
+  {
+    ELOG("Bad signature %s\n", signature);
+    return -1;
+  }
+  tbgen_canonical(gen.pieces, gen.npieces, gen.signature);
+  gen.npieces = tablebase_parse_signature(gen.signature, gen.pieces);
+  // Bare kings are always a draw and don't get a table
+  if (gen.npieces == 2)
+    return 0;
+
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.ctb", dir, gen.signature);
+  FILE* existing = fopen(path, "rb");
+  if (existing)
+  {
+    fclose(existing);
+    return 0;
+  }
+  if (tbgen_generate_children(pool, dir, gen.pieces, gen.npieces, verify))
+    return -1;
+
+  ILOG("Generating %s\n", gen.signature);
+  u64 start_ms = get_time_ms();
+  Tablebase tb;
+  tablebase_new(&tb, dir);
+  gen.tb = &tb;
+  gen.nentries = 1;
+  for (int i = 0; i < gen.npieces; i++)
+    gen.nentries *= 64;
+  u64 total = 2 * gen.nentries;
+  gen.entries = calloc(total, sizeof(*gen.entries));
+  gen.remaining = calloc(total, sizeof(*gen.remaining));
+  gen.flags = calloc(total, sizeof(*gen.flags));
+  gen.conv_win = calloc(total, 1);
+  gen.conv_loss = calloc(total, 1);
+  atomic_init(&gen.resolved, 0);
+  atomic_init(&gen.errors, 0);
+  pthread_mutex_init(&gen.lock, NULL);
+  pthread_cond_init(&gen.cond, NULL);
+
+  tbgen_run_pass(&gen, tbgen_first_pass);
+  ILOG("%s: %llu mates after %llums\n", gen.signature,
+       (unsigned long long)atomic_load(&gen.resolved),
+       (unsigned long long)(get_time_ms() - start_ms));
+
+  // Nothing can be resolved after a ply where nothing was, unless it's
+  // waiting on a result from another table
+  int last_conv = 0;
+  for (u64 i = 0; i < total; i++)
+  {
+    if (gen.conv_win[i] > last_conv)
+      last_conv = gen.conv_win[i];
+    if (gen.conv_loss[i] > last_conv)
+      last_conv = gen.conv_loss[i];
+  }
+  for (gen.ply = 1; gen.ply <= TbgenMaxPlies; gen.ply++)
+  {
+    u64 before = atomic_load(&gen.resolved);
+    tbgen_run_pass(&gen, tbgen_ply_pass);
+    u64 found = atomic_load(&gen.resolved) - before;
+    DLOG("%s: %llu resolved at ply %d\n", gen.signature,
+         (unsigned long long)found, gen.ply);
+    if (found == 0 && gen.ply > last_conv)
+      break;
+  }
+
+  // Anything still unresolved is a draw, which is already 0
+  byte* entries = malloc(total);
+  for (u64 i = 0; i < total; i++)
+    entries[i] = atomic_load(&gen.entries[i]);
+  int rv = atomic_load(&gen.errors) ? -1 : 0;
+  if (!rv)
+    rv = tablebase_write(path, gen.pieces, gen.npieces, entries, gen.nentries);
+  free(entries);
+  free(gen.entries);
+  free(gen.remaining);
+  free(gen.flags);
+  free(gen.conv_win);
+  free(gen.conv_loss);
+
+  if (!rv && verify)
+  {
+    tbgen_run_pass(&gen, tbgen_verify_pass);
+    if (atomic_load(&gen.errors))
+    {
+      ELOG("%s: %llu positions failed verification\n", gen.signature,
+           (unsigned long long)atomic_load(&gen.errors));
+      remove(path);
+      rv = -1;
+    }
+  }
+
+  if (!rv)
+    ILOG("%s: %llu decisive positions, longest %d plies, took %llums\n",
+         gen.signature, (unsigned long long)atomic_load(&gen.resolved),
+         gen.ply - 1, (unsigned long long)(get_time_ms() - start_ms));
+  tablebase_free(&tb);
+  pthread_mutex_destroy(&gen.lock);
+  pthread_cond_destroy(&gen.cond);
+  return rv;
+}
+
+// }}}
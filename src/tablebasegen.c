@@ -0,0 +1,73 @@
+#include <rgl/logging.h>
+#include <rgl/threadpool.h>
+
+#include <chess/defs.h>
+#include <chess/tablebase.h>
+#include <chess/util.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generates endgame tables, see tablebase_generate
+
+int depth = 5;
+
+enum
+{
+  TbgenMaxThreads = 256,
+};
+
+static void usage(char* name)
+{
+  fprintf(stderr,
+          "Usage: %s <dir> <signature>... [--threads n] [--verify]\n"
+          "Signatures look like KQvK or KRvKN, tables the given endings\n"
+          "depend on are generated first.\n",
+          name);
+}
+
+int main(int argc, char* argv[])
+{
+  rgl_logger_thread_setup();
+  rgl_logger_thread_add_stream(stderr);
+
+  char* dir = NULL;
+  char* signatures[64];
+  int nsignatures = 0;
+  int nthreads = cpu_count();
+  bool verify = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      nthreads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--verify") == 0)
+      verify = true;
+    else if (argv[i][0] == '-')
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    else if (!dir)
+      dir = argv[i];
+    else if (nsignatures < 64)
+      signatures[nsignatures++] = argv[i];
+  }
+  if (!dir || nsignatures == 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > TbgenMaxThreads)
+    nthreads = TbgenMaxThreads;
+
+  ThreadPool pool;
+  threadpool_new(&pool, nthreads);
+  for (int i = 0; i < nsignatures; i++)
+    if (tablebase_generate(&pool, dir, signatures[i], verify))
+      return 1;
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include <chess/transtable.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+void transtable_new(TransTable* tt, size_t size_mb)
+{
+  size_t max_entries = (size_mb << 20) / sizeof(TTEntry);
+  tt->size = 1;
+  while (tt->size * 2 <= max_entries)
+    tt->size *= 2;
+  tt->entries = calloc(tt->size, sizeof(TTEntry));
+}
+
+void transtable_free(TransTable* tt)
+{
+  free(tt->entries);
+  tt->entries = NULL;
+  tt->size = 0;
+}
+
+void transtable_clear(TransTable* tt)
+{
+  memset(tt->entries, 0, tt->size * sizeof(TTEntry));
+}
+
+/// @return the entry for key or NULL if there isn't one
+TTEntry* transtable_probe(TransTable* tt, u64 key)
+{
+  TTEntry* entry = &tt->entries[key & (tt->size - 1)];
+  if (entry->key != key)
+    return NULL;
+  return entry;
+}
+
+void transtable_store(TransTable* tt, u64 key, Move move, int value, int depth,
+                      TTBound bound)
+{
+  TTEntry* entry = &tt->entries[key & (tt->size - 1)];
+
+  // Prefer to keep results from deeper searches of the same position
+  if (entry->key == key && entry->depth > depth)
+    return;
+
+  entry->key = key;
+  entry->move = move;
+  entry->value = value;
+  entry->depth = depth;
+  entry->bound = bound;
+}
@@ -2,6 +2,7 @@
 
 #include <chess/tree.h>
 #include <chess/move.h>
+#include <chess/profile.h>
 
 #include <stdlib.h>
 
@@ -77,11 +78,38 @@ Tree* tree_new(Node* node, Board board, size_t depth)
   tree->root = node;
   tree->board = board;
   tree->depth = depth;
+  tree->context = NULL;
   return tree;
 }
 
+// Moves the root of the tree down to the child reached by move and frees
+// every other branch. If move hasn't been searched a fresh root is made.
+void tree_advance(Tree* tree, Move move)
+{
+  Node* old_root = tree->root;
+  Node* new_root = NULL;
+  for (size_t i = 0; i < old_root->nchilds; i++)
+  {
+    if (!move_equals(old_root->children[i]->move, move))
+      continue;
+    // Detach the child so it isn't freed along with the old root
+    new_root = old_root->children[i];
+    old_root->children[i] = old_root->children[--old_root->nchilds];
+    break;
+  }
+
+  if (!new_root)
+    new_root = node_new(NULL, move, !old_root->isWhite);
+  new_root->parent = NULL;
+
+  node_free(&old_root);
+  board_update(&tree->board, &move);
+  tree->root = new_root;
+}
+
 Node* node_new(Node* parent, Move move, bool isWhite)
 {
+  PROFILE_ZONE(ProfileZoneNodeNew);
   Node* node = malloc(sizeof(Node));
   node->parent = parent;
   node->children = NULL;
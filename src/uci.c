@@ -0,0 +1,440 @@
+#include <rgl/logging.h>
+#include <rgl/util.h>
+
+#include <chess/board.h>
+#include <chess/book.h>
+#include <chess/defs.h>
+#include <chess/move.h>
+#include <chess/search.h>
+#include <chess/tablebase.h>
+#include <chess/transtable.h>
+#include <chess/tree.h>
+#include <chess/util.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Speaks UCI over stdin/stdout so the engine can be run by the usual chess
+// GUIs and tournament managers.
+//
+// Only the commands we have some use for are handled, anything else is
+// ignored as the protocol asks.
+
+int depth = 5;
+
+enum
+{
+  UciMaxThreads = 64,
+  UciMaxHashMb = 4096,
+  UciLineMax = 16384,
+  // Kept back from the clock so that we don't lose on time to GUI overhead
+  UciMoveOverheadMs = 30,
+};
+
+static char* g_start_fen =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+typedef struct
+{
+  SearchContext context;
+  Tree* tree;
+  pthread_t thread;
+} UciHelper;
+
+typedef struct
+{
+  Board board;
+  SearchContext context;
+  size_t hash_mb;
+  int nthreads;
+  Book book;
+  bool have_book;
+  Tablebase tb;
+  bool have_tb;
+  int tb_max_pieces;
+
+  int go_depth;
+  bool searching;
+  pthread_t search_thread;
+  UciHelper helpers[UciMaxThreads - 1];
+} Uci;
+
+static pthread_mutex_t g_print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Replies come from both the input and search threads so don't let them mix
+static void uci_printf(char* format, ...)
+{
+  pthread_mutex_lock(&g_print_lock);
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  fflush(stdout);
+  pthread_mutex_unlock(&g_print_lock);
+}
+
+static void uci_thread_setup()
+{
+  rgl_logger_thread_setup();
+  // stdout belongs to the GUI
+  rgl_logger_thread_add_stream(stderr);
+}
+
+static Tree* uci_tree_new(Board board, int depth)
+{
+  Node* root = node_new(NULL, move_new(-1, -1), board.white_to_move);
+  return tree_new(root, board, depth);
+}
+
+static void uci_on_info(SearchInfo* info, void* userdata)
+{
+  Uci* uci = userdata;
+
+  // The helpers' work counts towards our speed too
+  u64 nodes = info->nodes;
+  for (int i = 0; i < uci->nthreads - 1; i++)
+    nodes += atomic_load(&uci->helpers[i].context.nodes);
+  u64 nps = nodes * 1000 / (info->time_ms ? info->time_ms : 1);
+
+  // UCI wants scores from the side to move's point of view
+  int value = uci->board.white_to_move ? info->value : -info->value;
+  char score[32];
+  int plies = search_mate_plies(value);
+  if (plies >= 0)
+    sprintf(score, "mate %d", (value > 0 ? 1 : -1) * (plies + 1) / 2);
+  else
+    sprintf(score, "cp %d", value);
+
+  char pv[SearchMaxPly * 6 + 1] = {0};
+  for (int i = 0; i < info->pv_len; i++)
+  {
+    char* move = move_to_uci(info->pv[i]);
+    strcat(pv, " ");
+    strcat(pv, move);
+    free(move);
+  }
+
+  uci_printf("info depth %d score %s nodes %llu nps %llu time %llu pv%s\n",
+             info->depth, score, (unsigned long long)nodes,
+             (unsigned long long)nps, (unsigned long long)info->time_ms, pv);
+}
+
+static void* uci_helper_run(void* void_helper)
+{
+  uci_thread_setup();
+  UciHelper* helper = void_helper;
+  search(helper->tree);
+  return NULL;
+}
+
+static void* uci_search(void* void_uci)
+{
+  uci_thread_setup();
+  Uci* uci = void_uci;
+
+  Tree* tree = uci_tree_new(uci->board, uci->go_depth);
+  tree->context = &uci->context;
+
+  // Lazy SMP: the helpers search the same position and share our table. Odd
+  // helpers go a ply deeper so the threads don't all do the same work.
+  for (int i = 0; i < uci->nthreads - 1; i++)
+  {
+    UciHelper* helper = &uci->helpers[i];
+    helper->context.limits = (SearchLimits){.infinite = true};
+    atomic_store(&helper->context.stop, false);
+    atomic_store(&helper->context.nodes, 0);
+    memcpy(helper->context.keys, uci->context.keys,
+           uci->context.nkeys * sizeof(*uci->context.keys));
+    helper->context.nkeys = uci->context.nkeys;
+    // The odd ones go a ply deeper, but never past what search keeps stats for
+    int depth = uci->go_depth + i % 2;
+    if (depth > SearchMaxPly)
+      depth = SearchMaxPly;
+    helper->tree = uci_tree_new(uci->board, depth);
+    helper->tree->context = &helper->context;
+    pthread_create(&helper->thread, NULL, uci_helper_run, helper);
+  }
+
+  Move move = search(tree);
+
+  // We aren't allowed to answer an infinite search until told to stop
+  while (uci->context.limits.infinite && !atomic_load(&uci->context.stop))
+    sleep_ms(1);
+
+  for (int i = 0; i < uci->nthreads - 1; i++)
+  {
+    UciHelper* helper = &uci->helpers[i];
+    atomic_store(&helper->context.stop, true);
+    pthread_join(helper->thread, NULL);
+    tree_free(&helper->tree);
+  }
+
+  // Stopped before the first iteration finished, any legal move will do
+  if (move_is_null(move))
+  {
+    Array moves = board_get_moves_all(uci->board, uci->board.white_to_move
+                                                      ? GetMovesWhite
+                                                      : GetMovesBlack);
+    if (moves.used > 0)
+      move = *(Move*)array_get(&moves, 0);
+    array_free(&moves);
+  }
+
+  // The GUI expects a promotion piece whenever a pawn reaches the back rank
+  bool is_pawn = !move_is_null(move) &&
+                 (uci->board.state[move.from] & ChessPiecePawn);
+  bool back_rank = torank64(move.to) == 0 || torank64(move.to) == 7;
+  if (is_pawn && back_rank && !move.promo)
+    move_set_promotion(&move, ChessPieceQueen);
+
+  char* str = move_to_uci(move);
+  uci_printf("bestmove %s\n", str);
+  free(str);
+
+  tree_free(&tree);
+  return NULL;
+}
+
+static void uci_stop(Uci* uci)
+{
+  if (!uci->searching)
+    return;
+  atomic_store(&uci->context.stop, true);
+  pthread_join(uci->search_thread, NULL);
+  uci->searching = false;
+}
+
+static void uci_set_threads(Uci* uci, int nthreads)
+{
+  for (int i = 0; i < uci->nthreads - 1; i++)
+    search_context_free(&uci->helpers[i].context);
+
+  uci->nthreads = nthreads < 1 ? 1 : nthreads;
+  if (uci->nthreads > UciMaxThreads)
+    uci->nthreads = UciMaxThreads;
+
+  for (int i = 0; i < uci->nthreads - 1; i++)
+    search_context_new_helper(&uci->helpers[i].context, &uci->context);
+}
+
+// The helpers point at the main table so they have to be remade with it
+static void uci_reset_context(Uci* uci)
+{
+  int nthreads = uci->nthreads;
+  uci_set_threads(uci, 1);
+  search_context_free(&uci->context);
+  search_context_new(&uci->context, uci->hash_mb);
+  uci->context.on_info = uci_on_info;
+  uci->context.userdata = uci;
+  uci->context.tb = uci->have_tb ? &uci->tb : NULL;
+  uci_set_threads(uci, nthreads);
+}
+
+// position [startpos | fen <fen>] [moves <move> ...]
+static void uci_position(Uci* uci, char* args)
+{
+  char* moves = strstr(args, "moves");
+  if (moves)
+    moves[-1] = '\0';
+
+  if (strncmp(args, "fen ", 4) == 0)
+    board_new(&uci->board, args + 4);
+  else
+    board_new(&uci->board, g_start_fen);
+  search_context_clear_positions(&uci->context);
+
+  if (!moves)
+    return;
+
+  for (char* tok = strtok(moves + strlen("moves"), " "); tok;
+       tok = strtok(NULL, " "))
+  {
+    Move move = move_from_uci(tok);
+    if (move_is_null(move))
+    {
+      WLOG("Bad move in position command: %s\n", tok);
+      break;
+    }
+    search_context_push_position(&uci->context, uci->board);
+    board_update(&uci->board, &move);
+  }
+}
+
+static u64 uci_arg(char* args, char* name)
+{
+  char* arg = strstr(args, name);
+  if (!arg)
+    return 0;
+  return strtoull(arg + strlen(name), NULL, 10);
+}
+
+// go [depth n] [movetime ms] [wtime ms] [btime ms] [winc ms] [binc ms]
+//    [movestogo n] [nodes n] [infinite]
+static void uci_go(Uci* uci, char* args)
+{
+  uci_stop(uci);
+
+  SearchLimits limits = {0};
+  limits.nodes = uci_arg(args, "nodes ");
+  limits.infinite = strstr(args, "infinite") != NULL;
+
+  bool white = uci->board.white_to_move;
+  u64 time_left = uci_arg(args, white ? "wtime " : "btime ");
+  u64 inc = uci_arg(args, white ? "winc " : "binc ");
+  u64 moves_to_go = uci_arg(args, "movestogo ");
+  if (time_left)
+  {
+    // Assume the game lasts a while longer if we aren't told otherwise
+    u64 budget = time_left / (moves_to_go ? moves_to_go : 30) + inc / 2;
+    u64 max = time_left > UciMoveOverheadMs ? time_left - UciMoveOverheadMs
+                                            : 1;
+    limits.time_ms = budget < max ? budget : max;
+  }
+  if (uci_arg(args, "movetime "))
+    limits.time_ms = uci_arg(args, "movetime ");
+
+  uci->go_depth = uci_arg(args, "depth ");
+  if (!uci->go_depth)
+  {
+    // Without any limits we fall back to our usual fixed depth
+    bool limited = limits.nodes || limits.time_ms || limits.infinite;
+    uci->go_depth = limited ? SearchMaxPly : depth;
+  }
+  if (uci->go_depth > SearchMaxPly)
+    uci->go_depth = SearchMaxPly;
+
+  // Book moves are answered straight away, except when the GUI wants us to
+  // think until it says otherwise
+  Move book_move = move_new(-1, -1);
+  if (uci->have_book && !limits.infinite)
+    book_move = book_probe(&uci->book, uci->board);
+  if (!move_equals(book_move, move_new(-1, -1)))
+  {
+    char* str = move_to_uci(book_move);
+    uci_printf("bestmove %s\n", str);
+    free(str);
+    return;
+  }
+
+  uci->context.limits = limits;
+  atomic_store(&uci->context.stop, false);
+  uci->searching = true;
+  pthread_create(&uci->search_thread, NULL, uci_search, uci);
+}
+
+// setoption name <id> [value <x>]
+static void uci_setoption(Uci* uci, char* args)
+{
+  char* value = strstr(args, " value ");
+  if (!value)
+    return;
+  value += strlen(" value ");
+  int n = atoi(value);
+
+  uci_stop(uci);
+  if (strncmp(args, "name Hash ", 10) == 0)
+  {
+    uci->hash_mb = n < 1 ? 1 : n > UciMaxHashMb ? UciMaxHashMb : n;
+    uci_reset_context(uci);
+  }
+  else if (strncmp(args, "name Threads ", 13) == 0)
+    uci_set_threads(uci, n);
+  else if (strncmp(args, "name BookFile ", 14) == 0)
+  {
+    if (uci->have_book)
+      book_close(&uci->book);
+    uci->have_book = strcmp(value, "<empty>") != 0 && *value &&
+                     book_open(&uci->book, value) == 0;
+  }
+  else if (strncmp(args, "name TablebasePath ", 19) == 0)
+  {
+    if (uci->have_tb)
+      tablebase_free(&uci->tb);
+    uci->have_tb = strcmp(value, "<empty>") != 0 && *value;
+    if (uci->have_tb)
+    {
+      tablebase_new(&uci->tb, value);
+      uci->tb.max_pieces = uci->tb_max_pieces;
+    }
+    uci_reset_context(uci);
+  }
+  else if (strncmp(args, "name TablebaseProbeLimit ", 25) == 0)
+  {
+    uci->tb_max_pieces = n < 0                    ? 0
+                         : n > TablebaseMaxPieces ? TablebaseMaxPieces
+                                                  : n;
+    uci->tb.max_pieces = uci->tb_max_pieces;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  uci_thread_setup();
+
+  static Uci uci;
+  uci.hash_mb = SearchDefaultHashMb;
+  uci.nthreads = 1;
+  uci.tb_max_pieces = TablebaseMaxPieces;
+  search_context_new(&uci.context, uci.hash_mb);
+  uci.context.on_info = uci_on_info;
+  uci.context.userdata = &uci;
+  board_new(&uci.board, g_start_fen);
+
+  static char line[UciLineMax];
+  while (fgets(line, sizeof(line), stdin))
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    char* args = strchr(line, ' ');
+    args = args ? args + 1 : line + strlen(line);
+
+    if (strcmp(line, "uci") == 0)
+    {
+      uci_printf("id name ChessEngine\n");
+      uci_printf("id author rleathart\n");
+      uci_printf("option name Hash type spin default %d min 1 max %d\n",
+                 SearchDefaultHashMb, UciMaxHashMb);
+      uci_printf("option name Threads type spin default 1 min 1 max %d\n",
+                 UciMaxThreads);
+      uci_printf("option name BookFile type string default <empty>\n");
+      uci_printf("option name TablebasePath type string default <empty>\n");
+      uci_printf("option name TablebaseProbeLimit type spin default %d min 0 "
+                 "max %d\n",
+                 TablebaseMaxPieces, TablebaseMaxPieces);
+      uci_printf("uciok\n");
+    }
+    else if (strcmp(line, "isready") == 0)
+      uci_printf("readyok\n");
+    else if (strcmp(line, "ucinewgame") == 0)
+    {
+      uci_stop(&uci);
+      uci_reset_context(&uci);
+    }
+    else if (strncmp(line, "position ", 9) == 0)
+    {
+      uci_stop(&uci);
+      uci_position(&uci, args);
+    }
+    else if (strncmp(line, "go", 2) == 0 && (!line[2] || line[2] == ' '))
+      uci_go(&uci, args);
+    else if (strcmp(line, "stop") == 0)
+      uci_stop(&uci);
+    else if (strncmp(line, "setoption ", 10) == 0)
+      uci_setoption(&uci, args);
+    else if (strcmp(line, "quit") == 0)
+      break;
+  }
+
+  uci_stop(&uci);
+  if (uci.have_book)
+    book_close(&uci.book);
+  uci_set_threads(&uci, 1);
+  search_context_free(&uci.context);
+  if (uci.have_tb)
+    tablebase_free(&uci.tb);
+  return 0;
+}
@@ -4,10 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <stdio.h>
+#include <time.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 /* Return a random int between lower and upper inclusive. */
@@ -73,3 +78,89 @@ char* get_dotnet_pipe_name(char* name)
   pipename = realloc(pipename, strlen(pipename) + 1);
   return pipename;
 }
+
+// Nanoseconds from some arbitrary starting point, only useful for measuring
+// how long something took. The clock never jumps when the system time is set.
+u64 get_time_ns()
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (u64)(count.QuadPart / frequency.QuadPart) * 1000000000 +
+         (u64)(count.QuadPart % frequency.QuadPart) * 1000000000 /
+             frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Same again in milliseconds
+u64 get_time_ms()
+{
+  return get_time_ns() / 1000000;
+}
+
+// Maps a whole file read only. Free it with unmap_file.
+/// @return NULL on failure
+char* map_file(char* path, size_t* size)
+{
+#ifdef _WIN32
+  // @@Speed Map this too
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* data = malloc(*size + 1);
+  size_t nread = fread(data, 1, *size, f);
+  fclose(f);
+  if (nread != *size)
+  {
+    free(data);
+    return NULL;
+  }
+  return data;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st))
+  {
+    close(fd);
+    return NULL;
+  }
+  *size = st.st_size;
+  // mmap doesn't like empty files but we still want to hand back something
+  // that can be unmapped
+  char* data = mmap(NULL, *size ? *size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+void unmap_file(char* data, size_t size)
+{
+#ifdef _WIN32
+  free(data);
+#else
+  munmap(data, size ? size : 1);
+#endif
+}
+
+/// @return At least 1
+int cpu_count()
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+#endif
+}
@@ -4,11 +4,36 @@
 #include "chess/search.h"
 #include "chess/tree.h"
 #include <chess/board.h>
+#include <chess/book.h>
+#include <chess/hash.h>
+#include <chess/message.h>
 #include <chess/move.h>
+#include <chess/profile.h>
+#include <chess/resultcache.h>
+#include <chess/scheduler.h>
+#include <chess/session.h>
+#include <chess/tablebase.h>
+#include <chess/transtable.h>
 #include <chess/util.h>
 
+#ifdef __linux__
+#include <chess/eventloop.h>
+#include <chess/ringbuffer.h>
+#endif
+#include <chess/server.h>
+
 #include <check.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 START_TEST(test_pawn_moves)
 {
@@ -538,6 +563,36 @@ START_TEST(test_starting_moves)
 }
 END_TEST
 
+START_TEST(test_move_stages)
+{
+  Board board;
+  board_new(&board, "4k3/8/8/3p4/4P3/8/8/R3K3 w Q - 0 1");
+  Array all = board_get_moves_all(board, GetMovesWhite);
+  Array captures = board_get_moves_stage(board, true, GetMovesCaptures);
+  Array quiets = board_get_moves_stage(board, true, GetMovesQuiets);
+  Array checks = board_get_moves_stage(board, true, GetMovesQuietChecks);
+
+  ck_assert_int_eq(captures.used, 1);
+  ck_assert(move_equals(array_get_as(&captures, 0, Move),
+                        move_from_uci("e4d5")));
+  ck_assert_int_eq(captures.used + quiets.used, all.used);
+  ck_assert_int_eq(checks.used, 1);
+  ck_assert(move_equals(array_get_as(&checks, 0, Move), move_from_uci("a1a8")));
+  array_free(&all);
+  array_free(&captures);
+  array_free(&quiets);
+  array_free(&checks);
+
+  // Only the king can get out of this one
+  board_new(&board, "4k3/8/8/8/8/8/4r3/R3K3 w Q - 0 1");
+  Array evasions = board_get_moves_stage(board, true, GetMovesEvasions);
+  ck_assert_int_eq(evasions.used, 3);
+  for (int i = 0; i < evasions.used; i++)
+    ck_assert_int_eq(array_get_as(&evasions, i, Move).from, 60);
+  array_free(&evasions);
+}
+END_TEST
+
 START_TEST(test_checkmate)
 {
   Board board;
@@ -563,6 +618,79 @@ START_TEST(test_checkmate)
 }
 END_TEST
 
+START_TEST(test_check_info)
+{
+  Board board;
+
+  // Fool's mate
+  board_new(&board,
+            "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3");
+  ck_assert(!board_has_legal_move(board, true));
+  ck_assert(board_has_legal_move(board, false));
+  ck_assert_int_eq(get_check_info(board, true), CheckInfoCheckmate);
+  ck_assert_int_eq(get_check_info(board, false), CheckInfoNone);
+  ck_assert(is_in_checkmate(board, true));
+  ck_assert(!is_in_stalemate(board, true));
+
+  board_new(&board, "k7/8/1Q6/8/8/8/8/7K b - - 0 1");
+  ck_assert(!board_has_legal_move(board, false));
+  ck_assert_int_eq(get_check_info(board, false), CheckInfoStalemate);
+  ck_assert(is_in_stalemate(board, false));
+  ck_assert(!is_in_checkmate(board, false));
+
+  // The only way out of check is taking the checker
+  board_new(&board, "k7/1Q6/8/8/8/8/8/7K b - - 0 1");
+  ck_assert(board_has_legal_move(board, false));
+  ck_assert_int_eq(get_check_info(board, false), CheckInfoCheck);
+}
+END_TEST
+
+START_TEST(test_is_legal)
+{
+  Board board;
+  board_new(&board, "r3k2r/1b6/8/3pP3/8/8/6P1/R3K1qR w KQkq d6 0 1");
+
+  // The rook on g1 has us in check
+  ck_assert(board_is_legal(&board, move_new(63, 62)));
+  ck_assert(!board_is_legal(&board, move_new(60, 59)));
+  ck_assert(!board_is_legal(&board, move_new(60, 58)));
+  ck_assert(!board_is_legal(&board, move_new(60, 62)));
+  ck_assert(!board_is_legal(&board, move_new(28, 19)));
+
+  // Without the check we can take en passant and castle queen side but not
+  // move black's pawn, slide through pieces or push too far
+  board_new(&board, "r3k2r/1b6/8/3pP3/8/8/6P1/R3K1R1 w Qkq d6 0 1");
+  ck_assert(board_is_legal(&board, move_new(28, 19)));
+  ck_assert(board_is_legal(&board, move_new(60, 58)));
+  ck_assert(!board_is_legal(&board, move_new(60, 62)));
+  ck_assert(!board_is_legal(&board, move_new(27, 35)));
+  ck_assert(board_is_legal(&board, move_new(56, 0)));
+  ck_assert(!board_is_legal(&board, move_new(56, 49)));
+  ck_assert(!board_is_legal(&board, move_new(62, 46)));
+  ck_assert(board_is_legal(&board, move_new(54, 38)));
+  ck_assert(!board_is_legal(&board, move_new(54, 30)));
+  ck_assert(!board_is_legal(&board, move_new(-1, -1)));
+
+  // Every move the generator finds is legal
+  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  Array moves = board_get_moves_all(board, GetMovesWhite);
+  for (int i = 0; i < moves.used; i++)
+    ck_assert(board_is_legal(&board, *(Move*)array_get(&moves, i)));
+  ck_assert_int_eq(moves.used, 20);
+  array_free(&moves);
+
+  // Promotions need a piece to promote to
+  board_new(&board, "4k3/1P6/8/8/8/8/8/4K3 w - - 0 1");
+  Move promotion = move_new(9, 1);
+  ck_assert(!board_is_legal(&board, promotion));
+  move_set_promotion(&promotion, ChessPieceKnight);
+  ck_assert(board_is_legal(&board, promotion));
+  // and only the one
+  move_set_promotion(&promotion, ChessPieceKnight | ChessPieceBishop);
+  ck_assert(!board_is_legal(&board, promotion));
+}
+END_TEST
+
 void rook_nmoves(Board board, int defending_rook_pos)
 {
   int expected_nmoves = 1;
@@ -723,34 +851,35 @@ START_TEST(test_promotion)
     if (!array_index_is_allocated(&moves, i))
       continue;
     if (array_get_as(&moves, i, Move).to == topos64(0x72) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceKnight)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceKnight)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x72) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceCastle)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceCastle)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x72) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceBishop)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceBishop)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x72) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceQueen)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceQueen)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x73) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceKnight)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceKnight)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x73) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceCastle)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceCastle)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x73) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceBishop)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceBishop)
       found_moves[idx++] = true;
     if (array_get_as(&moves, i, Move).to == topos64(0x73) &&
-        array_get_as(&moves, i, Move).promotion == ChessPieceQueen)
+        move_promotion(array_get_as(&moves, i, Move)) == ChessPieceQueen)
       found_moves[idx++] = true;
   }
 
   for (int i = 0; i < expected_nmoves; i++)
     fail_if(!found_moves[i], "!found_moves[%d]", i);
 }
+END_TEST
 
 START_TEST(test_node_copy)
 {
@@ -814,6 +943,1351 @@ START_TEST(test_can_force_mate)
 }
 END_TEST
 
+START_TEST(test_search_mate_score)
+{
+  // Rb7 then Rh8 mates, on the third ply whatever the depth
+  Board board;
+  board_new(&board, "4k3/8/8/8/8/8/8/KR5R w - - 0 1");
+  SearchContext ctx;
+  search_context_new(&ctx, 1);
+  for (int depth = 4; depth <= 6; depth++)
+  {
+    Node* node = node_new(NULL, move_new(-1, -1), true);
+    Tree* tree = tree_new(node, board, depth);
+    tree->context = &ctx;
+    search(tree);
+    ck_assert_int_eq(ctx.info.value, SearchMateScore - 3);
+    ck_assert_int_eq(search_mate_plies(ctx.info.value), 3);
+    tree_free(&tree);
+  }
+  search_context_free(&ctx);
+
+  ck_assert_int_eq(search_mate_plies(-SearchMateScore + 4), 4);
+  ck_assert_int_eq(search_mate_plies(-TablebaseWinScore + 7), 7);
+  ck_assert_int_eq(search_mate_plies(300), -1);
+}
+END_TEST
+
+START_TEST(test_board_hash)
+{
+  Board a, b;
+  board_new(&a, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  board_new(&b, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  ck_assert(board_hash(a) == board_hash(b));
+
+  // Reach the same position by transposing knight moves
+  Move a_moves[] = {move_new(62, 45), move_new(1, 18), move_new(57, 42),
+                    move_new(6, 21)};
+  Move b_moves[] = {move_new(57, 42), move_new(6, 21), move_new(62, 45),
+                    move_new(1, 18)};
+  for (int i = 0; i < 4; i++)
+  {
+    board_update(&a, &a_moves[i]);
+    board_update(&b, &b_moves[i]);
+  }
+  ck_assert(board_hash(a) == board_hash(b));
+
+  b.white_to_move = !b.white_to_move;
+  ck_assert(board_hash(a) != board_hash(b));
+}
+END_TEST
+
+START_TEST(test_transtable)
+{
+  TransTable tt;
+  transtable_new(&tt, 1);
+
+  u64 key = 0x123456789abcdefULL;
+  ck_assert_ptr_null(transtable_probe(&tt, key));
+
+  transtable_store(&tt, key, move_new(8, 16), 42, 3, TTBoundExact);
+  TTEntry* entry = transtable_probe(&tt, key);
+  ck_assert_ptr_nonnull(entry);
+  ck_assert_int_eq(entry->value, 42);
+  ck_assert_int_eq(entry->depth, 3);
+  fail_if(!move_equals(entry->move, move_new(8, 16)));
+
+  // Shallower results shouldn't replace deeper ones
+  transtable_store(&tt, key, move_new(8, 24), 7, 1, TTBoundLower);
+  ck_assert_int_eq(transtable_probe(&tt, key)->value, 42);
+
+  transtable_free(&tt);
+}
+END_TEST
+
+START_TEST(test_tree_advance)
+{
+  Board board;
+  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+  Node* root = node_new(NULL, move_new(-1, -1), true);
+  Node* child = node_new(root, move_new(52, 36), false);
+  node_new(root, move_new(51, 35), false);
+  node_new(child, move_new(12, 28), true);
+
+  Tree* tree = tree_new(root, board, 2);
+  Move move = move_new(52, 36);
+  tree_advance(tree, move);
+
+  // The subtree under the move we made should be kept
+  fail_if(tree->root != child);
+  fail_if(tree->root->parent != NULL);
+  ck_assert_int_eq(tree->root->nchilds, 1);
+  ck_assert_int_eq(tree->board.state[36], ChessPiecePawn | ChessPieceIsWhite);
+  fail_if(tree->board.white_to_move);
+
+  // Moves that weren't searched get a fresh root
+  move = move_new(11, 27);
+  tree_advance(tree, move);
+  ck_assert_int_eq(tree->root->nchilds, 0);
+  fail_if(!tree->root->isWhite);
+
+  tree_free(&tree);
+}
+END_TEST
+
+START_TEST(test_session_ponder)
+{
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 1, 1);
+  Session session;
+  session_new(&session, "8/8/8/8/7k/8/6qr/K7 b - - 0 1", 3);
+  session.scheduler = &scheduler;
+
+  Move move = session_best_move(&session);
+  fail_if(move_equals(move, move_new(-1, -1)));
+  ck_assert(session.board.white_to_move);
+
+  // Pondering is one of the scheduler's searches rather than a thread of its own
+  SchedulerStats stats[SchedulerPriorityCount];
+  scheduler_get_stats(&scheduler, stats);
+  ck_assert_int_eq(stats[SchedulerPrioritySearch].max_queued,
+                   atomic_load(&session.pondering) ? 1 : 0);
+
+  // The search tree should follow the board whether or not we guessed the
+  // player's reply
+  Move reply = atomic_load(&session.pondering) ? session.ponder_move : move_new(56, 48);
+  session_make_move(&session, reply);
+  ck_assert(session.tree->root->isWhite == session.board.white_to_move);
+  fail_if(memcmp(session.tree->board.state, session.board.state,
+                 sizeof(session.board.state)));
+
+  session_free(&session);
+  scheduler_free(&scheduler);
+}
+END_TEST
+
+START_TEST(test_session_age)
+{
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 1, 1);
+  Session session;
+  session_new(&session,
+              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 3);
+  session.scheduler = &scheduler;
+
+  // Pondering searches the position after the expected reply, so the killers
+  // are moved on two plies from our search's root
+  session_best_move(&session);
+  ck_assert(atomic_load(&session.pondering));
+  ck_assert_int_eq(session.plies, 1);
+  ck_assert_int_eq(session.context_plies, 2);
+
+  // After a ponder hit the next search starts where pondering did, so the
+  // killers don't need moving again
+  session_make_move(&session, session.ponder_move);
+  ck_assert_int_eq(session.plies, session.context_plies);
+  session_best_move(&session);
+  ck_assert_int_eq(session.plies, 3);
+  ck_assert_int_eq(session.context_plies, 4);
+
+  session_free(&session);
+  scheduler_free(&scheduler);
+}
+END_TEST
+
+START_TEST(test_session_moves)
+{
+  Session session;
+  session_new(&session,
+              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 3);
+
+  // Moves are kept for both colours
+  Array moves = session_get_moves(&session, 52);
+  ck_assert_int_eq(moves.used, 2);
+  array_free(&moves);
+  moves = session_get_moves(&session, 1);
+  ck_assert_int_eq(moves.used, 2);
+  array_free(&moves);
+  ck_assert(session_is_legal(&session, move_new(52, 36)));
+  ck_assert(!session_is_legal(&session, move_new(52, 28)));
+
+  // And worked out again once the board changes
+  session_make_move(&session, move_new(52, 36));
+  ck_assert(!session_is_legal(&session, move_new(52, 36)));
+  ck_assert(session_is_legal(&session, move_new(36, 28)));
+  moves = session_get_moves(&session, 60);
+  ck_assert_int_eq(moves.used, 1);
+  array_free(&moves);
+
+  session_free(&session);
+}
+END_TEST
+
+START_TEST(test_session_snapshot)
+{
+  Session session;
+  session_new(&session,
+              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 3);
+
+  // A snapshot doesn't change when the game moves on
+  BoardSnapshot* before = session_snapshot_acquire(&session);
+  session_make_move(&session, move_new(52, 36));
+  ck_assert(before->board.state[52] & ChessPiecePawn);
+  ck_assert(before->board.white_to_move);
+
+  BoardSnapshot* after = session_snapshot_acquire(&session);
+  ck_assert_ptr_ne(before, after);
+  ck_assert(after->version > before->version);
+  ck_assert(after->board.state[36] & ChessPiecePawn);
+  ck_assert(!after->board.white_to_move);
+  session_snapshot_release(&session, after);
+
+  // Only the snapshots still being read are kept, however many changes there
+  // are while they're held, and they go as soon as they're given back
+  ck_assert_int_eq(session.replaced, 1);
+  session_make_move(&session, move_new(12, 28));
+  session_make_move(&session, move_new(62, 45));
+  ck_assert_int_eq(session.replaced, 1);
+  session_snapshot_release(&session, before);
+  ck_assert_int_eq(session.replaced, 0);
+
+  session_free(&session);
+}
+END_TEST
+
+START_TEST(test_session_stop)
+{
+  Session session;
+  session_new(&session,
+              "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+              3);
+
+  // Stopped before it starts, we still get a legal move
+  Board board = session.board;
+  session_ask_search(&session);
+  ck_assert(session_stop_search(&session));
+  Move move = session_best_move(&session);
+  ck_assert(board_is_legal(&board, move));
+  ck_assert_int_eq(session.stats.depth, 0);
+
+  // With nothing asked for there's nothing to stop, and the stop doesn't carry
+  // over to the next search
+  ck_assert(!session_stop_search(&session));
+  session_make_move(&session, move_from_uci("a7a6"));
+  session_ask_search(&session);
+  move = session_best_move(&session);
+  ck_assert_int_eq(session.stats.depth, 3);
+
+  session_free(&session);
+}
+END_TEST
+
+START_TEST(test_search_stats)
+{
+  SearchContext ctx;
+  search_context_new(&ctx, 1);
+  Board board;
+  board_new(&board, "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3");
+  Node* root = node_new(NULL, move_new(-1, -1), true);
+  Tree* tree = tree_new(root, board, 3);
+  tree->context = &ctx;
+  search(tree);
+
+  SearchStats* stats = &ctx.stats;
+  ck_assert_int_eq(stats->depth, 3);
+  ck_assert(stats->nodes == atomic_load(&ctx.nodes));
+  ck_assert(stats->qnodes > 0 && stats->qnodes < stats->nodes);
+  ck_assert(stats->tt_hits <= stats->tt_probes);
+  ck_assert(stats->tt_cutoffs <= stats->tt_hits);
+  ck_assert(stats->fail_highs_first <= stats->fail_highs);
+  ck_assert(stats->fail_highs > 0);
+
+  u64 total = 0;
+  for (int d = 1; d <= stats->depth; d++)
+    total += stats->iteration_nodes[d - 1];
+  ck_assert(total == stats->nodes);
+  ck_assert(search_stats_branching(stats, 3) > 1);
+
+  tree_free(&tree);
+  search_context_free(&ctx);
+}
+END_TEST
+
+START_TEST(test_profile)
+{
+  Board board;
+  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  Array moves = board_get_moves_all(board, GetMovesWhite);
+  array_free(&moves);
+
+  char* text = profile_report_string(ProfileFormatText);
+  ck_assert_ptr_nonnull(text);
+#ifdef CHESS_PROFILE
+  ck_assert_ptr_nonnull(strstr(text, "board_get_moves"));
+#endif
+  free(text);
+
+  char* trace = profile_report_string(ProfileFormatChrome);
+  ck_assert_ptr_nonnull(trace);
+  ck_assert(strncmp(trace, "{\"traceEvents\":[", 16) == 0);
+  free(trace);
+}
+END_TEST
+
+START_TEST(test_uci_moves)
+{
+  // e2e4 goes from index 52 to 36
+  Move move = move_from_uci("e2e4");
+  ck_assert(move_equals(move, move_new(52, 36)));
+  char* str = move_to_uci(move);
+  ck_assert_str_eq(str, "e2e4");
+  free(str);
+
+  move = move_from_uci("a7a8q");
+  ck_assert_int_eq(move.from, 8);
+  ck_assert_int_eq(move.to, 0);
+  ck_assert_int_eq(move_promotion(move), ChessPieceQueen);
+  str = move_to_uci(move);
+  ck_assert_str_eq(str, "a7a8q");
+  free(str);
+
+  ck_assert(move_is_null(move_from_uci("z9a1")));
+
+  // Standard FENs give the en passant square in algebraic notation
+  Board board;
+  board_new(&board,
+            "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2");
+  ck_assert_int_eq(board.en_passant_tile, 19);
+  ck_assert_int_eq(board.halfmove_clock, 0);
+  ck_assert_int_eq(board.fullmove_count, 2);
+}
+END_TEST
+
+START_TEST(test_wire_move)
+{
+  ck_assert(sizeof(Move) == 2);
+  ck_assert(sizeof(WireMove) == 8);
+
+  Move move = move_from_uci("b2b1n");
+  WireMove wire = message_move_to_wire(move);
+  ck_assert_int_eq(wire.from, 49);
+  ck_assert_int_eq(wire.to, 57);
+  ck_assert_int_eq(wire.promotion, ChessPieceKnight);
+  ck_assert(move_equals(message_move_from_wire((byte*)&wire), move));
+
+  wire = message_move_to_wire(move_new(-1, -1));
+  ck_assert_int_eq(wire.from, 255);
+  ck_assert(move_is_null(message_move_from_wire((byte*)&wire)));
+
+  // Promotions to more than one piece, or to something a pawn can't become,
+  // are thrown out
+  wire = message_move_to_wire(move);
+  wire.promotion = ChessPieceKnight | ChessPieceBishop;
+  ck_assert(move_is_null(message_move_from_wire((byte*)&wire)));
+  wire.promotion = ChessPieceKing;
+  ck_assert(move_is_null(message_move_from_wire((byte*)&wire)));
+  wire.promotion = ChessPieceQueen | ChessPieceIsWhite;
+  ck_assert(!move_is_null(message_move_from_wire((byte*)&wire)));
+
+  Board board;
+  board_new(&board, "4k3/8/8/8/8/8/8/4K2R w K - 0 1");
+  s32 state[64];
+  message_board_state_to_wire(board, (byte*)state);
+  ck_assert_int_eq(state[60], ChessPieceKing | ChessPieceIsWhite);
+  ck_assert_int_eq(state[63], ChessPieceCastle | ChessPieceIsWhite);
+  ck_assert_int_eq(state[4], ChessPieceKing);
+  ck_assert_int_eq(state[0], ChessPieceNone);
+}
+END_TEST
+
+START_TEST(test_repetition)
+{
+  // White is a queen down so shuffling the knights back and forth to repeat
+  // is the best it can do
+  char* fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNB1KBNR w KQkq - 0 1";
+  Board board;
+  board_new(&board, fen);
+
+  SearchContext ctx;
+  search_context_new(&ctx, 1);
+
+  Move moves[] = {move_from_uci("g1f3"), move_from_uci("g8f6"),
+                  move_from_uci("f3g1"), move_from_uci("f6g8")};
+  for (int i = 0; i < 4; i++)
+  {
+    search_context_push_position(&ctx, board);
+    board_update(&board, &moves[i]);
+  }
+  ck_assert_int_eq(board.halfmove_clock, 4);
+  ck_assert_int_eq(board.fullmove_count, 3);
+
+  Node* root = node_new(NULL, move_new(-1, -1), true);
+  Tree* tree = tree_new(root, board, 3);
+  tree->context = &ctx;
+  Move move = search(tree);
+  ck_assert(move_equals(move, moves[0]));
+  ck_assert_int_eq(ctx.info.value, 0);
+  tree_free(&tree);
+
+  // Without the history it's just a bad position
+  search_context_clear(&ctx);
+  search_context_clear_positions(&ctx);
+  root = node_new(NULL, move_new(-1, -1), true);
+  tree = tree_new(root, board, 3);
+  tree->context = &ctx;
+  search(tree);
+  ck_assert_int_lt(ctx.info.value, 0);
+  tree_free(&tree);
+
+  // A pawn move resets the clock
+  Move push = move_from_uci("e2e4");
+  board_update(&board, &push);
+  ck_assert_int_eq(board.halfmove_clock, 0);
+
+  // Mating on the hundredth ply wins rather than drawing
+  board_new(&board, "k7/8/1K6/8/8/8/7Q/8 w - - 99 80");
+  search_context_clear(&ctx);
+  root = node_new(NULL, move_new(-1, -1), true);
+  tree = tree_new(root, board, 2);
+  tree->context = &ctx;
+  move = search(tree);
+  board_update(&board, &move);
+  ck_assert_int_eq(board.halfmove_clock, SearchFiftyMovePly);
+  ck_assert(is_in_checkmate(board, false));
+  ck_assert_int_gt(ctx.info.value, 0);
+  tree_free(&tree);
+
+  search_context_free(&ctx);
+}
+END_TEST
+
+START_TEST(test_book)
+{
+  FILE* f = fopen("test_book_lines.txt", "w");
+  fputs("e2e4 e7e5 g1f3 b8c6 f1c4 g8f6 e1g1\n", f);
+  fputs("e2e4 e7e5 g1f3 b8c6 f1c4 g8f6 e1g1\n", f);
+  fputs("d2d4 d7d5\n", f);
+  fclose(f);
+  ck_assert_int_eq(book_build("test_book_lines.txt", "test_book.bin", 16), 0);
+
+  Book book;
+  ck_assert_int_eq(book_open(&book, "test_book.bin"), 0);
+  book.variety = 0;
+
+  Board board;
+  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  Move move = book_probe(&book, board);
+  ck_assert(move_equals(move, move_from_uci("e2e4")));
+
+  // Castling is stored as the king taking its rook
+  char* ucis[] = {"e2e4", "e7e5", "g1f3", "b8c6", "f1c4", "g8f6"};
+  for (int i = 0; i < 6; i++)
+  {
+    move = move_from_uci(ucis[i]);
+    board_update(&board, &move);
+  }
+  move = book_probe(&book, board);
+  ck_assert(move_equals(move, move_from_uci("e1g1")));
+
+  // Out of book
+  board_update(&board, &move);
+  move = book_probe(&book, board);
+  ck_assert(move_is_null(move));
+
+  book_close(&book);
+  remove("test_book_lines.txt");
+  remove("test_book.bin");
+}
+END_TEST
+
+// Polyglot's own test positions, which only tell us the key's structure while
+// book_random isn't the official table
+START_TEST(test_book_key)
+{
+  Board start;
+  board_new(&start, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+  // Knights out and back transpose to the start
+  Board board = start;
+  char* knights[] = {"g1f3", "g8f6", "f3g1", "f6g8"};
+  for (int i = 0; i < 4; i++)
+  {
+    Move move = move_from_uci(knights[i]);
+    board_update(&board, &move);
+  }
+  ck_assert(book_key(board) == book_key(start));
+
+  // No black pawn can take on e3, so the en passant square doesn't count
+  board = start;
+  Move move = move_from_uci("e2e4");
+  board_update(&board, &move);
+  ck_assert(book_key(board) != book_key(start));
+  Board no_ep = board;
+  no_ep.en_passant_tile = -1;
+  ck_assert(book_key(board) == book_key(no_ep));
+
+  // b4 can take on c3, so it does
+  board = start;
+  char* ucis[] = {"a2a4", "b7b5", "h2h4", "b5b4", "c2c4"};
+  for (int i = 0; i < 5; i++)
+  {
+    move = move_from_uci(ucis[i]);
+    board_update(&board, &move);
+  }
+  no_ep = board;
+  no_ep.en_passant_tile = -1;
+  ck_assert(book_key(board) != book_key(no_ep));
+
+  // Castling rights and the side to move each change the key
+  no_ep = start;
+  no_ep.can_castle_qs[0] = false;
+  ck_assert(book_key(start) != book_key(no_ep));
+  no_ep = start;
+  no_ep.white_to_move = false;
+  ck_assert(book_key(start) != book_key(no_ep));
+}
+END_TEST
+
+START_TEST(test_result_cache)
+{
+  ResultCache cache;
+  result_cache_new(&cache, 1);
+  u64 capacity = result_cache_stats(&cache).capacity;
+
+  Board board;
+  board_new(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  Move e4 = move_from_uci("e2e4");
+  ResultEntry entry;
+  ck_assert(!result_cache_probe(&cache, board, 4, &entry));
+  result_cache_store(&cache, board, 4, e4, 30, 4);
+  ck_assert(result_cache_probe(&cache, board, 4, &entry));
+  ck_assert(move_equals(entry.move, e4));
+  ck_assert_int_eq(entry.value, 30);
+  // Searches to other depths are kept apart
+  ck_assert(!result_cache_probe(&cache, board, 5, &entry));
+
+  // Fill it up, using the first result so that the second is the oldest
+  result_cache_store(&cache, board, 1000, e4, 0, 1000);
+  for (u64 i = 0; i + 2 < capacity; i++)
+    result_cache_store(&cache, board, 2000 + i, e4, 0, 1);
+  ck_assert(result_cache_probe(&cache, board, 4, &entry));
+  result_cache_store(&cache, board, 5, e4, 0, 5);
+  ck_assert(!result_cache_probe(&cache, board, 1000, &entry));
+  ck_assert(result_cache_probe(&cache, board, 4, &entry));
+
+  ResultCacheStats stats = result_cache_stats(&cache);
+  ck_assert(stats.entries == capacity);
+  ck_assert(stats.evictions == 1);
+  ck_assert(stats.hits == 3);
+
+  // And it comes back the same from disk. There's no file to load the first
+  // time, which only sets where to save.
+  ck_assert_int_eq(result_cache_load(&cache, "test_results.crc"), 0);
+  ck_assert_int_eq(result_cache_save(&cache), 0);
+  result_cache_free(&cache);
+  result_cache_new(&cache, 1);
+  ck_assert_int_eq(result_cache_load(&cache, "test_results.crc"), 0);
+  ck_assert(result_cache_stats(&cache).entries == capacity);
+  ck_assert(result_cache_probe(&cache, board, 4, &entry));
+  ck_assert(move_equals(entry.move, e4));
+  ck_assert(!result_cache_probe(&cache, board, 1000, &entry));
+
+  result_cache_free(&cache);
+  remove("test_results.crc");
+
+  // Games only use the cache when none of their earlier positions can come
+  // round again
+  result_cache_new(&cache, 1);
+  Session session;
+  session_new(&session,
+              "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 2);
+  session.results = &cache;
+  session_best_move(&session);
+  stats = result_cache_stats(&cache);
+  ck_assert(stats.probes == 1);
+  ck_assert(stats.stores == 1);
+  session_make_move(&session, move_from_uci("g8f6"));
+  session_best_move(&session);
+  stats = result_cache_stats(&cache);
+  ck_assert(stats.probes == 1);
+  ck_assert(stats.stores == 1);
+  session_free(&session);
+  result_cache_free(&cache);
+}
+END_TEST
+
+static atomic_bool g_scheduler_release;
+static atomic_int g_scheduler_done;
+
+// Holds up its worker until the test lets it go
+static void* scheduler_search_task(void* arg)
+{
+  while (!atomic_load(&g_scheduler_release))
+    sched_yield();
+  atomic_fetch_add(&g_scheduler_done, 1);
+  return NULL;
+}
+
+static void* scheduler_query_task(void* arg)
+{
+  atomic_fetch_add(&g_scheduler_done, 1);
+  return NULL;
+}
+
+START_TEST(test_scheduler)
+{
+  atomic_store(&g_scheduler_release, false);
+  atomic_store(&g_scheduler_done, 0);
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 2, 1);
+
+  // The searches both wait on the one worker that takes them, which leaves
+  // the other for the queries
+  scheduler_queue(&scheduler, SchedulerPrioritySearch, scheduler_search_task,
+                  NULL);
+  scheduler_queue(&scheduler, SchedulerPrioritySearch, scheduler_search_task,
+                  NULL);
+  for (int i = 0; i < 10; i++)
+    scheduler_queue(&scheduler, SchedulerPriorityInteractive,
+                    scheduler_query_task, NULL);
+  u64 start = get_time_ms();
+  while (atomic_load(&g_scheduler_done) < 10 && get_time_ms() - start < 5000)
+    sched_yield();
+  ck_assert_int_eq(atomic_load(&g_scheduler_done), 10);
+
+  atomic_store(&g_scheduler_release, true);
+  scheduler_free(&scheduler);
+  ck_assert_int_eq(atomic_load(&g_scheduler_done), 12);
+  SchedulerStats* stats = scheduler.stats;
+  ck_assert(stats[SchedulerPriorityInteractive].completed == 10);
+  ck_assert(stats[SchedulerPrioritySearch].completed == 2);
+  ck_assert(stats[SchedulerPrioritySearch].max_queued >= 1);
+  ck_assert(stats[SchedulerPrioritySearch].queued == 0);
+}
+END_TEST
+
+#ifdef __linux__
+static Connection* g_eventloop_conn;
+static Message g_eventloop_messages[16];
+static int g_eventloop_nmessages;
+static bool g_eventloop_closed;
+
+static void eventloop_test_on_connect(Connection* conn)
+{
+  conn->userdata = conn;
+  g_eventloop_conn = conn;
+}
+
+static void eventloop_test_on_message(Connection* conn, Message mess)
+{
+  if (g_eventloop_nmessages < 16)
+    g_eventloop_messages[g_eventloop_nmessages++] = mess;
+}
+
+static void eventloop_test_on_close(Connection* conn)
+{
+  g_eventloop_closed = true;
+  connection_free(conn);
+}
+
+static int eventloop_test_connect(char* path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strcpy(addr.sun_path, path);
+  ck_assert_int_eq(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  return fd;
+}
+
+// Connects a client, fds[0] for requests and fds[1] for replies, and waits for
+// the loop to pair it up
+static Connection* eventloop_test_open(EventLoop* loop, char* requests,
+                                       char* replies, int fds[2])
+{
+  g_eventloop_conn = NULL;
+  g_eventloop_nmessages = 0;
+  g_eventloop_closed = false;
+  fds[0] = eventloop_test_connect(requests);
+  fds[1] = eventloop_test_connect(replies);
+  for (int i = 0; i < 100 && !g_eventloop_conn; i++)
+    eventloop_run_once(loop, 10);
+  ck_assert_ptr_nonnull(g_eventloop_conn);
+  return g_eventloop_conn;
+}
+
+/// @return The size of the message written to data, len bytes of fill
+static size_t eventloop_test_message(byte* data, u32 len, byte fill)
+{
+  MessageHeader header = {.len = len, .type = MessageTypeEvaluateRequest};
+  memcpy(data, &header, sizeof(header));
+  memset(data + sizeof(header), fill, len);
+  return sizeof(header) + len;
+}
+
+START_TEST(test_eventloop)
+{
+  char requests[64];
+  char replies[64];
+  snprintf(requests, sizeof(requests), "/tmp/ChessTestRequests%d", getpid());
+  snprintf(replies, sizeof(replies), "/tmp/ChessTestReplies%d", getpid());
+  EventLoopCallbacks callbacks = {
+      .on_connect = eventloop_test_on_connect,
+      .on_message = eventloop_test_on_message,
+      .on_close = eventloop_test_on_close,
+  };
+  EventLoop loop;
+  ck_assert_int_eq(eventloop_new(&loop, requests, replies, callbacks), 0);
+  int fds[2];
+  Connection* conn = eventloop_test_open(&loop, requests, replies, fds);
+  RingBuffer* ring = conn->ring;
+
+  // Messages released out of order are held back until everything before them
+  // is released, then the ring moves past them all at once
+  byte small[3 * (sizeof(MessageHeader) + 100)];
+  size_t small_len = 0;
+  for (int i = 0; i < 3; i++)
+    small_len += eventloop_test_message(small + small_len, 100, i);
+  ck_assert_int_eq(write(fds[0], small, small_len), small_len);
+  for (int i = 0; i < 100 && g_eventloop_nmessages < 3; i++)
+    eventloop_run_once(&loop, 10);
+  ck_assert_int_eq(g_eventloop_nmessages, 3);
+  ck_assert_int_eq(g_eventloop_messages[2].data[99], 2);
+  connection_release(conn, g_eventloop_messages[2]);
+  connection_release(conn, g_eventloop_messages[1]);
+  ck_assert_int_eq(atomic_load(&ring->tail), 0);
+  ck_assert_int_eq(conn->nreleased, 2);
+  connection_release(conn, g_eventloop_messages[0]);
+  ck_assert_int_eq(atomic_load(&ring->tail), small_len);
+  ck_assert_int_eq(conn->nreleased, 0);
+
+  // A client sending faster than its requests are handled fills the ring, and
+  // we stop reading until handlers give some of it back
+  enum
+  {
+    Count = 12,
+    Size = 60000,
+  };
+  size_t big_len = Count * (sizeof(MessageHeader) + Size);
+  byte* big = malloc(big_len);
+  for (int i = 0; i < Count; i++)
+    eventloop_test_message(big + i * (sizeof(MessageHeader) + Size), Size,
+                           10 + i);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  g_eventloop_nmessages = 0;
+  size_t written = 0;
+  for (int i = 0; i < 100; i++)
+  {
+    ssize_t n = write(fds[0], big + written, big_len - written);
+    if (n > 0)
+      written += n;
+    eventloop_run_once(&loop, 10);
+    if (n < 0 && atomic_load(&conn->paused))
+      break;
+  }
+  ck_assert(atomic_load(&conn->paused));
+  ck_assert_int_eq(ringbuffer_free_space(ring), 0);
+  ck_assert_int_lt(g_eventloop_nmessages, Count);
+
+  int released = 0;
+  for (int i = 0; i < 1000 && released < Count; i++)
+  {
+    for (; released < g_eventloop_nmessages; released++)
+    {
+      Message mess = g_eventloop_messages[released];
+      ck_assert_int_eq(mess.len, Size);
+      ck_assert_int_eq(mess.data[Size - 1], 10 + released);
+      connection_release(conn, mess);
+    }
+    ssize_t n = write(fds[0], big + written, big_len - written);
+    if (n > 0)
+      written += n;
+    eventloop_run_once(&loop, 10);
+  }
+  free(big);
+  ck_assert_int_eq(released, Count);
+  ck_assert(!atomic_load(&conn->paused));
+  ck_assert_int_eq(atomic_load(&ring->tail), ring->head);
+
+  close(fds[0]);
+  close(fds[1]);
+  for (int i = 0; i < 100 && !g_eventloop_closed; i++)
+    eventloop_run_once(&loop, 10);
+  ck_assert(g_eventloop_closed);
+
+  // A message that could never fit in the ring closes the connection rather
+  // than waiting for it forever
+  eventloop_test_open(&loop, requests, replies, fds);
+  MessageHeader header = {.len = RingBufferSize,
+                          .type = MessageTypeEvaluateRequest};
+  ck_assert_int_eq(write(fds[0], &header, sizeof(header)), sizeof(header));
+  for (int i = 0; i < 100 && !g_eventloop_closed; i++)
+    eventloop_run_once(&loop, 10);
+  ck_assert(g_eventloop_closed);
+  ck_assert_int_eq(g_eventloop_nmessages, 0);
+
+  close(fds[0]);
+  close(fds[1]);
+  eventloop_free(&loop);
+  unlink(requests);
+  unlink(replies);
+}
+END_TEST
+
+// Writes all of data, running the loop whenever the socket is full
+static void eventloop_test_write(EventLoop* loop, int fd, byte* data,
+                                 size_t len)
+{
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  for (size_t written = 0; written < len;)
+  {
+    ssize_t n = write(fd, data + written, len - written);
+    if (n > 0)
+      written += n;
+    else
+      eventloop_run_once(loop, 10);
+  }
+}
+
+START_TEST(test_ringbuffer)
+{
+  // Anything written across the end of the buffer can be read back in one go
+  // from either side, since both halves map the same memory
+  RingBuffer* ring = ringbuffer_acquire();
+  ck_assert_ptr_nonnull(ring);
+  byte pattern[30];
+  for (int i = 0; i < 30; i++)
+    pattern[i] = i + 1;
+  memcpy(ringbuffer_at(ring, ring->size - 10), pattern, sizeof(pattern));
+  ck_assert_int_eq(ring->base[ring->size - 1], 10);
+  ck_assert_int_eq(ring->base[0], 11);
+  ck_assert(!memcmp(ringbuffer_at(ring, 3 * ring->size - 10), pattern,
+                    sizeof(pattern)));
+  ck_assert(!memcmp(ring->base, pattern + 10, 20));
+
+  ring->head = ring->size + 20;
+  atomic_store(&ring->tail, ring->size - 10);
+  ck_assert_int_eq(ringbuffer_free_space(ring), ring->size - 30);
+  ringbuffer_return(ring);
+
+  // Messages are framed where they land, even with the header or the data
+  // split across the end of the ring
+  char requests[64];
+  char replies[64];
+  snprintf(requests, sizeof(requests), "/tmp/ChessTestRequests%d", getpid());
+  snprintf(replies, sizeof(replies), "/tmp/ChessTestReplies%d", getpid());
+  EventLoopCallbacks callbacks = {
+      .on_connect = eventloop_test_on_connect,
+      .on_message = eventloop_test_on_message,
+      .on_close = eventloop_test_on_close,
+  };
+  EventLoop loop;
+  ck_assert_int_eq(eventloop_new(&loop, requests, replies, callbacks), 0);
+  int fds[2];
+  Connection* conn = eventloop_test_open(&loop, requests, replies, fds);
+  ring = conn->ring;
+
+  // Bytes of the message before the end of the ring
+  int splits[] = {10, sizeof(MessageHeader) + 50};
+  byte* data = malloc(RingBufferSize);
+  for (int i = 0; i < 2; i++)
+  {
+    // Pad up to where the message should start
+    size_t pad = (2 * ring->size - splits[i] - ring->head % ring->size) %
+                 ring->size;
+    ck_assert_int_ge(pad, sizeof(MessageHeader));
+    g_eventloop_nmessages = 0;
+    size_t len = eventloop_test_message(data, pad - sizeof(MessageHeader), 0);
+    eventloop_test_write(&loop, fds[0], data, len);
+    for (int j = 0; j < 100 && g_eventloop_nmessages < 1; j++)
+      eventloop_run_once(&loop, 10);
+    ck_assert_int_eq(g_eventloop_nmessages, 1);
+    connection_release(conn, g_eventloop_messages[0]);
+
+    u64 start = ring->head;
+    len = eventloop_test_message(data, 100, 0);
+    for (int j = 0; j < 100; j++)
+      data[sizeof(MessageHeader) + j] = i * 100 + j;
+    eventloop_test_write(&loop, fds[0], data, len);
+    for (int j = 0; j < 100 && g_eventloop_nmessages < 2; j++)
+      eventloop_run_once(&loop, 10);
+    ck_assert_int_eq(g_eventloop_nmessages, 2);
+    ck_assert_int_eq(ring->size - start % ring->size, splits[i]);
+
+    Message mess = g_eventloop_messages[1];
+    ck_assert_int_eq(mess.len, 100);
+    ck_assert_int_eq(mess.type, MessageTypeEvaluateRequest);
+    for (int j = 0; j < 100; j++)
+      ck_assert_int_eq(mess.data[j], (byte)(i * 100 + j));
+    connection_release(conn, mess);
+    ck_assert_int_eq(atomic_load(&ring->tail), start + len);
+    ck_assert_int_eq(conn->nreleased, 0);
+  }
+  free(data);
+
+  close(fds[0]);
+  close(fds[1]);
+  for (int i = 0; i < 100 && !g_eventloop_closed; i++)
+    eventloop_run_once(&loop, 10);
+  eventloop_free(&loop);
+  unlink(requests);
+  unlink(replies);
+}
+END_TEST
+
+static Client* g_server_client;
+static bool g_server_closed;
+
+static void server_test_on_connect(Connection* conn)
+{
+  server_callbacks().on_connect(conn);
+  g_server_client = conn->userdata;
+}
+
+static void server_test_on_close(Connection* conn)
+{
+  g_server_closed = true;
+  server_callbacks().on_close(conn);
+}
+
+// Starts a server on loop with a client connected to it, fds[0] for requests
+// and fds[1] for replies
+static void server_test_open(EventLoop* loop, Server* server, char* requests,
+                             char* replies, int fds[2])
+{
+  snprintf(requests, 64, "/tmp/ChessTestRequests%d", getpid());
+  snprintf(replies, 64, "/tmp/ChessTestReplies%d", getpid());
+  EventLoopCallbacks callbacks = server_callbacks();
+  callbacks.on_connect = server_test_on_connect;
+  callbacks.on_close = server_test_on_close;
+  ck_assert_int_eq(eventloop_new(loop, requests, replies, callbacks), 0);
+  loop->userdata = server;
+
+  g_server_client = NULL;
+  g_server_closed = false;
+  fds[0] = eventloop_test_connect(requests);
+  fds[1] = eventloop_test_connect(replies);
+  for (int i = 0; i < 100 && !g_server_client; i++)
+    eventloop_run_once(loop, 10);
+  ck_assert_ptr_nonnull(g_server_client);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+static void server_test_close(EventLoop* loop, char* requests, char* replies,
+                              int fds[2])
+{
+  close(fds[0]);
+  close(fds[1]);
+  for (int i = 0; i < 100 && !g_server_closed; i++)
+    eventloop_run_once(loop, 10);
+  ck_assert(g_server_closed);
+  eventloop_free(loop);
+  unlink(requests);
+  unlink(replies);
+}
+
+// Adds a request to data with guid[0] set to id
+/// @return The size of the request
+static size_t server_test_request(byte* data, MessageType type, byte id,
+                                  void* payload, u32 len)
+{
+  MessageHeader header = {.len = len, .type = type, .guid = {id}};
+  memcpy(data, &header, sizeof(header));
+  if (len)
+    memcpy(data + sizeof(header), payload, len);
+  return sizeof(header) + len;
+}
+
+// Runs the loop until n replies have arrived, their data is left in buf
+/// @return How many arrived
+static int server_test_replies(EventLoop* loop, int fd, byte* buf, size_t cap,
+                               Message* replies, int n)
+{
+  size_t len = 0;
+  size_t parsed = 0;
+  int count = 0;
+  for (int i = 0; i < 1000 && count < n; i++)
+  {
+    ssize_t got = read(fd, buf + len, cap - len);
+    if (got > 0)
+      len += got;
+    else
+      eventloop_run_once(loop, 10);
+
+    while (count < n && len - parsed >= sizeof(MessageHeader))
+    {
+      MessageHeader header;
+      memcpy(&header, buf + parsed, sizeof(header));
+      if (len - parsed - sizeof(header) < header.len)
+        break;
+      replies[count++] =
+          message_from_header(header, buf + parsed + sizeof(header));
+      parsed += sizeof(header) + header.len;
+    }
+  }
+  return count;
+}
+
+START_TEST(test_server_batch)
+{
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 3, 1);
+  Server server = {
+      .scheduler = &scheduler,
+      .start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      .depth = 2,
+  };
+  EventLoop loop;
+  char requests[64];
+  char replies[64];
+  int fds[2];
+  server_test_open(&loop, &server, requests, replies, fds);
+
+  // Batched queries either side of a move, all sent in one go before any
+  // replies come back
+  char fens[] = "8/8/8/8/8/8/8/K6k w - - 0 1\0"
+                "8/8/8/8/8/8/8/KQ5k w - - 0 1";
+  WireMove e4 = message_move_to_wire(move_new(52, 36));
+  byte batch[1024];
+  size_t len = 0;
+  len += server_test_request(batch + len, MessageTypeGetAllMovesRequest, 1,
+                             NULL, 0);
+  len += server_test_request(batch + len, MessageTypeCheckInfoBothRequest, 2,
+                             NULL, 0);
+  len += server_test_request(batch + len, MessageTypeEvaluateRequest, 3, fens,
+                             sizeof(fens) - 1);
+  len += server_test_request(batch + len, MessageTypeMakeMoveRequest, 4, &e4,
+                             sizeof(e4));
+  len += server_test_request(batch + len, MessageTypeBoardStateRequest, 5,
+                             NULL, 0);
+  len += server_test_request(batch + len, MessageTypeGetAllMovesRequest, 6,
+                             NULL, 0);
+  ck_assert_int_eq(write(fds[0], batch, len), len);
+
+  byte buf[4096];
+  Message out[6];
+  ck_assert_int_eq(server_test_replies(&loop, fds[1], buf, sizeof(buf), out, 6),
+                   6);
+
+  // The queries before the move can be answered in any order but all come
+  // before it, and the ones after it all come after
+  for (int i = 0; i < 6; i++)
+  {
+    int id = out[i].guid[0];
+    if (i < 3)
+      ck_assert(id >= 1 && id <= 3);
+    else if (i == 3)
+      ck_assert_int_eq(id, 4);
+    else
+      ck_assert(id >= 5 && id <= 6);
+    for (int j = 0; j < i; j++)
+      ck_assert_int_ne(out[j].guid[0], id);
+
+    switch (id)
+    {
+    case 1:
+    case 6:
+      // 20 moves for white before the move, 20 for black after it
+      ck_assert_int_eq(out[i].type, MessageTypeGetAllMovesReply);
+      ck_assert_int_eq(out[i].len, 20 * sizeof(WireMove));
+      ck_assert_int_eq(out[i].data[0] < 32, id == 6);
+      break;
+    case 2:
+      ck_assert_int_eq(out[i].type, MessageTypeCheckInfoBothReply);
+      ck_assert_int_eq(out[i].len, 2);
+      break;
+    case 3:
+    {
+      ck_assert_int_eq(out[i].type, MessageTypeEvaluateReply);
+      ck_assert_int_eq(out[i].len, 2 * sizeof(s32));
+      s32 values[2];
+      memcpy(values, out[i].data, sizeof(values));
+      ck_assert_int_gt(values[1], values[0]);
+      break;
+    }
+    case 4:
+      ck_assert_int_eq(out[i].type, MessageTypeMakeMoveReply);
+      break;
+    case 5:
+    {
+      ck_assert_int_eq(out[i].type, MessageTypeBoardStateReply);
+      s32 e4_piece;
+      memcpy(&e4_piece, out[i].data + 36 * sizeof(s32), sizeof(e4_piece));
+      ck_assert_int_eq(e4_piece, ChessPiecePawn | ChessPieceIsWhite);
+      break;
+    }
+    }
+  }
+
+  server_test_close(&loop, requests, replies, fds);
+  scheduler_free(&scheduler);
+}
+END_TEST
+
+START_TEST(test_server_evaluate)
+{
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 2, 1);
+  Server server = {
+      .scheduler = &scheduler,
+      .start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      .depth = 2,
+  };
+  EventLoop loop;
+  char requests[64];
+  char replies[64];
+  int fds[2];
+  server_test_open(&loop, &server, requests, replies, fds);
+
+  // Empty FENs are skipped, and ones that would run off the board or name
+  // pieces we don't have are marked rather than evaluated
+  char fens[] = "\0"
+                "8/8/8/8/8/8/8/K6k w - - 0 1\0\0"
+                "9999999/9\0"
+                "8/8/8/8/8/8/8/K6x w - - 0 1\0"
+                "8/8/8/8/8/8/8/K6k w - 99999 0 1\0"
+                "8/8/8/8/8/8/8/KQ5k w - - 0 1";
+  byte request[256];
+  size_t len = server_test_request(request, MessageTypeEvaluateRequest, 1, fens,
+                                   sizeof(fens) - 1);
+  ck_assert_int_eq(write(fds[0], request, len), len);
+
+  byte buf[1024];
+  Message out;
+  ck_assert_int_eq(server_test_replies(&loop, fds[1], buf, sizeof(buf), &out, 1),
+                   1);
+  ck_assert_int_eq(out.type, MessageTypeEvaluateReply);
+  ck_assert_int_eq(out.len, 5 * sizeof(s32));
+  s32 values[5];
+  memcpy(values, out.data, sizeof(values));
+  ck_assert_int_ne(values[0], EvaluateInvalidFen);
+  ck_assert_int_eq(values[1], EvaluateInvalidFen);
+  ck_assert_int_eq(values[2], EvaluateInvalidFen);
+  ck_assert_int_eq(values[3], EvaluateInvalidFen);
+  ck_assert_int_gt(values[4], values[0]);
+
+  server_test_close(&loop, requests, replies, fds);
+  scheduler_free(&scheduler);
+}
+END_TEST
+
+START_TEST(test_server_snapshots)
+{
+  Scheduler scheduler;
+  scheduler_new(&scheduler, 3, 1);
+  Server server = {
+      .scheduler = &scheduler,
+      .start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      .depth = 2,
+  };
+  EventLoop loop;
+  char requests[64];
+  char replies[64];
+  int fds[2];
+  server_test_open(&loop, &server, requests, replies, fds);
+
+  // Moves with queries either side of each. The old snapshots can go once
+  // each move has been made, since no query runs alongside a move.
+  char* ucis[] = {"e2e4", "e7e5", "g1f3", "b8c6"};
+  byte batch[1024];
+  size_t len = 0;
+  byte id = 1;
+  for (int i = 0; i < 4; i++)
+  {
+    WireMove wire = message_move_to_wire(move_from_uci(ucis[i]));
+    len += server_test_request(batch + len, MessageTypeBoardStateRequest, id++,
+                               NULL, 0);
+    len += server_test_request(batch + len, MessageTypeMakeMoveRequest, id++,
+                               &wire, sizeof(wire));
+    len += server_test_request(batch + len, MessageTypeGetAllMovesRequest,
+                               id++, NULL, 0);
+  }
+  ck_assert_int_eq(write(fds[0], batch, len), len);
+
+  byte buf[16384];
+  Message out[12];
+  ck_assert_int_eq(
+      server_test_replies(&loop, fds[1], buf, sizeof(buf), out, 12), 12);
+  ck_assert_int_eq(g_server_client->session.replaced, 0);
+  ck_assert_int_eq(g_server_client->session.snapshot->readers, 0);
+
+  server_test_close(&loop, requests, replies, fds);
+  scheduler_free(&scheduler);
+}
+END_TEST
+#endif
+
+START_TEST(test_tablebase)
+{
+  // Every KQvK position a win in 5 for white, or a loss in 4 for black
+  TablebaseHeader header = {.magic = {'C', 'T', 'B', '1'}, .npieces = 3};
+  header.nentries = 64 * 64 * 64;
+  FILE* f = fopen("KQvK.ctb", "wb");
+  fwrite(&header, sizeof(header), 1, f);
+  for (u64 i = 0; i < 2 * header.nentries; i++)
+    fputc(i < header.nentries ? 5 : TablebaseEntryLoss + 4, f);
+  fclose(f);
+
+  Tablebase tb;
+  tablebase_new(&tb, ".");
+  TablebaseResult result;
+  Board board;
+
+  board_new(&board, "7k/8/8/8/8/8/8/KQ6 w - - 0 1");
+  char signature[16];
+  tablebase_signature(board, signature);
+  ck_assert_str_eq(signature, "KQvK");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlWin);
+  ck_assert_int_eq(result.plies, 5);
+
+  // Black with the queen is looked up with the colours swapped
+  board_new(&board, "kq6/8/8/8/8/8/8/7K w - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlLoss);
+  ck_assert_int_eq(result.plies, 4);
+
+  // Missing tables and castling rights aren't covered
+  board_new(&board, "7k/8/8/8/8/8/8/KR6 w - - 0 1");
+  ck_assert(!tablebase_probe(&tb, board, &result));
+  board_new(&board, "4k3/8/8/8/8/8/8/4K2R w K - 0 1");
+  ck_assert(!tablebase_probe(&tb, board, &result));
+
+  // Taking the queen leaves a draw which beats any loss
+  board_new(&board, "8/8/8/8/8/8/1q6/K6k w - - 0 1");
+  Move move;
+  ck_assert(tablebase_root_move(&tb, board, &move, &result));
+  ck_assert(move_equals(move, move_from_uci("a1b2")));
+  ck_assert_int_eq(result.wdl, TablebaseWdlDraw);
+
+  tablebase_free(&tb);
+  remove("KQvK.ctb");
+
+  // The generator walks tables by index
+  ChessPiece pieces[TablebaseMaxPieces];
+  ck_assert_int_eq(tablebase_parse_signature("KRvKN", pieces), 4);
+  ck_assert_int_eq(pieces[1], ChessPieceCastle | ChessPieceIsWhite);
+  ck_assert_int_eq(pieces[3], ChessPieceKnight);
+  u8 squares[TablebaseMaxPieces] = {60, 7, 4, 33};
+  ck_assert(tablebase_board(pieces, 4, tablebase_index(squares, 4), false,
+                            &board));
+  ck_assert_int_eq(board.state[7], ChessPieceCastle | ChessPieceIsWhite);
+  ck_assert_int_eq(board.state[33], ChessPieceKnight);
+  ck_assert(!board.white_to_move);
+  tablebase_signature(board, signature);
+  ck_assert_str_eq(signature, "KRvKN");
+
+  // Two pieces on one square
+  squares[3] = 60;
+  ck_assert(!tablebase_board(pieces, 4, tablebase_index(squares, 4), true,
+                             &board));
+}
+END_TEST
+
+START_TEST(test_tablebase_generate)
+{
+  ThreadPool pool;
+  threadpool_new(&pool, 4);
+  remove("KQvK.ctb");
+  ck_assert_int_eq(tablebase_generate(&pool, ".", "KQvK", false), 0);
+
+  // The longest win takes ten moves
+  size_t size;
+  char* data = map_file("KQvK.ctb", &size);
+  ck_assert_ptr_nonnull(data);
+  ck_assert_int_eq(size, sizeof(TablebaseHeader) + 2 * 64 * 64 * 64);
+  byte* entries = (byte*)data + sizeof(TablebaseHeader);
+  int longest = 0;
+  for (u64 i = 0; i < 64 * 64 * 64; i++)
+    if (entries[i] < TablebaseEntryLoss && entries[i] > longest)
+      longest = entries[i];
+  ck_assert_int_eq(longest, 19);
+  unmap_file(data, size);
+
+  Tablebase tb;
+  tablebase_new(&tb, ".");
+  TablebaseResult result;
+  Board board;
+
+  // Mate in one
+  board_new(&board, "k7/8/1K6/8/8/8/7Q/8 w - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlWin);
+  ck_assert_int_eq(result.plies, 1);
+
+  // Mated
+  board_new(&board, "k7/1Q6/1K6/8/8/8/8/8 b - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlLoss);
+  ck_assert_int_eq(result.plies, 0);
+
+  // Stalemate
+  board_new(&board, "k7/8/1Q6/8/8/8/8/7K b - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlDraw);
+
+  // The queen hangs
+  board_new(&board, "k7/1Q6/8/8/8/8/8/K7 b - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  ck_assert_int_eq(result.wdl, TablebaseWdlDraw);
+
+  tablebase_free(&tb);
+  remove("KQvK.ctb");
+}
+END_TEST
+
+#ifdef __linux__
+// Needs every table a pawn can promote into on either side, which takes far
+// too long to generate on every run
+START_TEST(test_tablebase_generate_pawns)
+{
+  char dir[] = "tablebasesXXXXXX";
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  ThreadPool pool;
+  threadpool_new(&pool, cpu_count());
+
+  // Verifying probes the replies to double pushes as if they couldn't be taken
+  // en passant, the same as they're generated
+  ck_assert_int_eq(tablebase_generate(&pool, dir, "KPvKP", true), 0);
+
+  Tablebase tb;
+  tablebase_new(&tb, dir);
+  TablebaseResult result;
+  Board board;
+  board_new(&board, "k7/8/8/8/3p4/8/4P3/7K w - - 0 1");
+  ck_assert(tablebase_probe(&tb, board, &result));
+  Move move = move_new(52, 36);
+  board_update(&board, &move);
+  ck_assert(!tablebase_probe(&tb, board, &result));
+  board.en_passant_tile = -1;
+  ck_assert(tablebase_probe(&tb, board, &result));
+  tablebase_free(&tb);
+
+  DIR* d = opendir(dir);
+  struct dirent* entry;
+  char path[sizeof(dir) + sizeof(entry->d_name) + 1];
+  while ((entry = readdir(d)))
+  {
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    if (entry->d_name[0] != '.')
+      remove(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+END_TEST
+#endif
+
 int main(int argc, char** argv)
 {
   rgl_logger_thread_setup();
@@ -835,7 +2309,10 @@ int main(int argc, char** argv)
   tcase_add_test(tc1_1, test_castling);
   tcase_add_test(tc1_1, test_pinned_check);
   tcase_add_test(tc1_1, test_starting_moves);
+  tcase_add_test(tc1_1, test_move_stages);
   tcase_add_test(tc1_1, test_checkmate);
+  tcase_add_test(tc1_1, test_check_info);
+  tcase_add_test(tc1_1, test_is_legal);
   tcase_add_test(tc1_1, test_same_move);
   tcase_add_test(tc1_1, test_parse_fen);
   tcase_add_test(tc1_1, test_knight_check_king);
@@ -847,9 +2324,52 @@ int main(int argc, char** argv)
   tcase_add_test(tc1_1, test_promotion);
   tcase_add_test(tc1_1, test_node_copy);
   tcase_add_test(tc1_1, test_can_force_mate);
+  tcase_add_test(tc1_1, test_search_mate_score);
+  tcase_add_test(tc1_1, test_board_hash);
+  tcase_add_test(tc1_1, test_transtable);
+  tcase_add_test(tc1_1, test_tree_advance);
+  tcase_add_test(tc1_1, test_session_ponder);
+  tcase_add_test(tc1_1, test_session_age);
+  tcase_add_test(tc1_1, test_session_moves);
+  tcase_add_test(tc1_1, test_session_snapshot);
+  tcase_add_test(tc1_1, test_session_stop);
+  tcase_add_test(tc1_1, test_search_stats);
+  tcase_add_test(tc1_1, test_profile);
+  tcase_add_test(tc1_1, test_uci_moves);
+  tcase_add_test(tc1_1, test_wire_move);
+  tcase_add_test(tc1_1, test_repetition);
+  tcase_add_test(tc1_1, test_book);
+  tcase_add_test(tc1_1, test_book_key);
+  tcase_add_test(tc1_1, test_tablebase);
+  tcase_add_test(tc1_1, test_result_cache);
+  tcase_add_test(tc1_1, test_scheduler);
+#ifdef __linux__
+  tcase_add_test(tc1_1, test_eventloop);
+  tcase_add_test(tc1_1, test_ringbuffer);
+  tcase_add_test(tc1_1, test_server_batch);
+  tcase_add_test(tc1_1, test_server_evaluate);
+  tcase_add_test(tc1_1, test_server_snapshots);
+#endif
 
   suite_add_tcase(s1, tc1_1);
 
+  // Generating a whole table takes a while on one core
+  TCase* tc1_2 = tcase_create("Slow");
+  tcase_set_timeout(tc1_2, 120);
+  tcase_add_test(tc1_2, test_tablebase_generate);
+  suite_add_tcase(s1, tc1_2);
+
+#ifdef __linux__
+  // Set CHESS_TEST_TABLEBASES to run these, they can take hours
+  if (getenv("CHESS_TEST_TABLEBASES"))
+  {
+    TCase* tc1_3 = tcase_create("Tablebases");
+    tcase_set_timeout(tc1_3, 0);
+    tcase_add_test(tc1_3, test_tablebase_generate_pawns);
+    suite_add_tcase(s1, tc1_3);
+  }
+#endif
+
   srunner_run_all(sr, CK_ENV);
   num_failed = srunner_ntests_failed(sr);
   srunner_free(sr);